@@ -0,0 +1,503 @@
+// Builds the BVH and TLAS of OBJ files and synthetic scenes without the engine and prints build times, SAH costs and
+// cpu traversal speed as JSON, to track regressions of the builder and RayQuery. Built and run by `scons benchmark`.
+//
+// usage: bvh_benchmark [--rays count] [file.obj ...]
+
+#include "bvh/bvh.h"
+#include "ray_query.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace BVH;
+
+namespace
+{
+
+const int REPEATS = 3; // every measurement keeps its fastest run
+
+struct Surface
+{
+    std::vector<float> vertices;
+    std::vector<float> normals; // empty for flat shading
+    std::vector<float> uvs;
+    std::vector<int> indices;
+};
+
+// column major like BLASInstance, inverse is the affine inverse of transform
+struct Instance
+{
+    float transform[16];
+    float inverse[16];
+};
+
+// a single mesh placed by one or more instances
+struct Scene
+{
+    std::string name;
+    std::vector<Surface> surfaces;
+    std::vector<Instance> instances;
+};
+
+struct Random
+{
+    uint32_t state;
+
+    float next() // [0, 1)
+    {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        return (state >> 8) * (1.0f / 16777216.0f);
+    }
+
+    float range(float min, float max)
+    {
+        return min + (max - min) * next();
+    }
+};
+
+double milliseconds_since(const std::chrono::steady_clock::time_point &start)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+vec3 normalize(const vec3 &v)
+{
+    const float length = std::sqrt(v.x * v.x + v.y * v.y + v.z * v.z);
+    return length > 0.0f ? v / length : vec3(0.0f, 0.0f, 1.0f);
+}
+
+vec3 cross(const vec3 &a, const vec3 &b)
+{
+    return vec3(a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x);
+}
+
+// rotation about y, uniform scale and translation
+Instance make_instance(const float yaw, const float scale, const vec3 &position)
+{
+    Instance instance;
+    const float c = std::cos(yaw), s = std::sin(yaw);
+    const float linear[9] = {c * scale, 0.0f, -s * scale, 0.0f, scale, 0.0f, s * scale, 0.0f, c * scale};
+    for (int col = 0; col < 3; col++)
+    {
+        for (int row = 0; row < 3; row++)
+        {
+            instance.transform[col * 4 + row] = linear[col * 3 + row];
+            // the transpose of a rotation is its inverse
+            instance.inverse[col * 4 + row] = linear[row * 3 + col] / (scale * scale);
+        }
+        instance.transform[col * 4 + 3] = 0.0f;
+        instance.inverse[col * 4 + 3] = 0.0f;
+    }
+    for (int row = 0; row < 3; row++)
+    {
+        instance.transform[12 + row] = position[row];
+        instance.inverse[12 + row] = -(instance.inverse[row] * position.x + instance.inverse[4 + row] * position.y +
+                                       instance.inverse[8 + row] * position.z);
+    }
+    instance.transform[15] = 1.0f;
+    instance.inverse[15] = 1.0f;
+    return instance;
+}
+
+//--------- SCENES ---------
+
+// v, vt, vn, f and usemtl of the OBJ format, one surface per material, polygons as triangle fans
+bool load_obj(const std::string &path, Scene &scene)
+{
+    std::ifstream file(path);
+    if (!file)
+        return false;
+
+    std::vector<vec3> positions, normals;
+    std::vector<vec2> uvs;
+    std::map<std::string, int> materials;
+    std::vector<bool> smooth; // whether every corner of a surface has a normal
+    int current = 0;
+    scene.surfaces.assign(1, Surface());
+    smooth.assign(1, true);
+
+    // an index of the file, counted from 1, or from the end when negative
+    auto resolve = [](const int index, const size_t size) { return index < 0 ? static_cast<int>(size) + index : index - 1; };
+
+    std::string line;
+    while (std::getline(file, line))
+    {
+        std::istringstream in(line);
+        std::string keyword;
+        in >> keyword;
+        if (keyword == "v")
+        {
+            vec3 p;
+            in >> p.x >> p.y >> p.z;
+            positions.push_back(p);
+        }
+        else if (keyword == "vn")
+        {
+            vec3 n;
+            in >> n.x >> n.y >> n.z;
+            normals.push_back(n);
+        }
+        else if (keyword == "vt")
+        {
+            vec2 uv;
+            in >> uv.u >> uv.v;
+            uvs.push_back(uv);
+        }
+        else if (keyword == "usemtl")
+        {
+            std::string name;
+            in >> name;
+            auto found = materials.find(name);
+            if (found == materials.end())
+            {
+                // the faces before the first usemtl keep surface 0
+                const bool unused = materials.empty() && scene.surfaces[0].indices.empty();
+                found = materials.emplace(name, unused ? 0 : static_cast<int>(scene.surfaces.size())).first;
+                if (!unused)
+                {
+                    scene.surfaces.push_back(Surface());
+                    smooth.push_back(true);
+                }
+            }
+            current = found->second;
+        }
+        else if (keyword == "f")
+        {
+            Surface &surface = scene.surfaces[current];
+            std::vector<int> corners;
+            std::string token;
+            while (in >> token)
+            {
+                int index[3] = {0, 0, 0}; // position, uv, normal
+                std::istringstream parts(token);
+                std::string part;
+                for (int i = 0; i < 3 && std::getline(parts, part, '/'); i++)
+                    index[i] = part.empty() ? 0 : std::atoi(part.c_str());
+                if (index[0] == 0)
+                    continue;
+
+                const vec3 &p = positions[resolve(index[0], positions.size())];
+                surface.vertices.insert(surface.vertices.end(), {p.x, p.y, p.z});
+                const vec2 uv = index[1] != 0 ? uvs[resolve(index[1], uvs.size())] : vec2();
+                surface.uvs.insert(surface.uvs.end(), {uv.u, uv.v});
+                const vec3 n = index[2] != 0 ? normals[resolve(index[2], normals.size())] : vec3();
+                surface.normals.insert(surface.normals.end(), {n.x, n.y, n.z});
+                smooth[current] = smooth[current] && index[2] != 0;
+                corners.push_back(static_cast<int>(surface.vertices.size() / 3) - 1);
+            }
+            for (size_t i = 2; i < corners.size(); i++)
+                surface.indices.insert(surface.indices.end(), {corners[0], corners[i - 1], corners[i]});
+        }
+    }
+    for (size_t i = 0; i < scene.surfaces.size(); i++)
+    {
+        if (!smooth[i])
+            scene.surfaces[i].normals.clear();
+    }
+
+    const size_t slash = path.find_last_of("/\\");
+    scene.name = path.substr(slash == std::string::npos ? 0 : slash + 1);
+    scene.instances.push_back(make_instance(0.0f, 1.0f, vec3()));
+    return true;
+}
+
+// a height field of many small, evenly sized triangles
+Scene make_terrain(const int size)
+{
+    Scene scene;
+    scene.name = "terrain_" + std::to_string(size);
+    Surface surface;
+    for (int z = 0; z <= size; z++)
+    {
+        for (int x = 0; x <= size; x++)
+        {
+            const float u = static_cast<float>(x) / size, v = static_cast<float>(z) / size;
+            const float height = 0.05f * std::sin(u * 25.0f) * std::cos(v * 19.0f) + 0.1f * std::sin(u * 4.0f + v * 3.0f);
+            surface.vertices.insert(surface.vertices.end(), {u * 2.0f - 1.0f, height, v * 2.0f - 1.0f});
+            surface.uvs.insert(surface.uvs.end(), {u, v});
+        }
+    }
+    for (int z = 0; z < size; z++)
+    {
+        for (int x = 0; x < size; x++)
+        {
+            const int i = z * (size + 1) + x;
+            surface.indices.insert(surface.indices.end(), {i, i + size + 1, i + 1, i + 1, i + size + 1, i + size + 2});
+        }
+    }
+    scene.surfaces.push_back(surface);
+    scene.instances.push_back(make_instance(0.0f, 1.0f, vec3()));
+    return scene;
+}
+
+// randomly placed and oriented triangles in a unit cube, overlapping boxes make the splits hard
+Scene make_triangle_soup(const int count)
+{
+    Scene scene;
+    scene.name = "soup_" + std::to_string(count);
+    Surface surface;
+    Random random{12345u};
+    for (int i = 0; i < count; i++)
+    {
+        const vec3 center(random.range(-1.0f, 1.0f), random.range(-1.0f, 1.0f), random.range(-1.0f, 1.0f));
+        for (int j = 0; j < 3; j++)
+        {
+            const vec3 p = center + vec3(random.range(-1.0f, 1.0f), random.range(-1.0f, 1.0f), random.range(-1.0f, 1.0f)) * 0.03f;
+            surface.vertices.insert(surface.vertices.end(), {p.x, p.y, p.z});
+            surface.indices.push_back(i * 3 + j);
+        }
+    }
+    scene.surfaces.push_back(surface);
+    scene.instances.push_back(make_instance(0.0f, 1.0f, vec3()));
+    return scene;
+}
+
+// a uv sphere instanced on a grid, for the TLAS build and the traversal across instances
+Scene make_sphere_instances(const int grid)
+{
+    Scene scene;
+    scene.name = "spheres_" + std::to_string(grid * grid);
+    Surface surface;
+    const int rings = 32, segments = 64;
+    for (int r = 0; r <= rings; r++)
+    {
+        for (int s = 0; s <= segments; s++)
+        {
+            const float theta = 3.14159265f * r / rings, phi = 6.2831853f * s / segments;
+            const vec3 n(std::sin(theta) * std::cos(phi), std::cos(theta), std::sin(theta) * std::sin(phi));
+            surface.vertices.insert(surface.vertices.end(), {n.x, n.y, n.z});
+            surface.normals.insert(surface.normals.end(), {n.x, n.y, n.z});
+            surface.uvs.insert(surface.uvs.end(), {static_cast<float>(s) / segments, static_cast<float>(r) / rings});
+        }
+    }
+    for (int r = 0; r < rings; r++)
+    {
+        for (int s = 0; s < segments; s++)
+        {
+            const int i = r * (segments + 1) + s;
+            surface.indices.insert(surface.indices.end(), {i, i + 1, i + segments + 1, i + 1, i + segments + 2, i + segments + 1});
+        }
+    }
+    scene.surfaces.push_back(surface);
+
+    Random random{777u};
+    for (int z = 0; z < grid; z++)
+        for (int x = 0; x < grid; x++)
+            scene.instances.push_back(make_instance(random.range(0.0f, 6.2831853f), random.range(0.3f, 0.9f),
+                                                    vec3(x * 2.0f - grid, random.range(-0.5f, 0.5f), z * 2.0f - grid)));
+    return scene;
+}
+
+//--------- MEASUREMENTS ---------
+
+struct Result
+{
+    size_t triangles = 0;
+    size_t bvh_nodes = 0;
+    double bvh_build_ms = 0.0;
+    float bvh_sah_cost = 0.0f;
+    double tlas_build_ms = 0.0;
+    float tlas_sah_cost = 0.0f;
+    double primary_mrays = 0.0;
+    double primary_hit_rate = 0.0;
+    double diffuse_mrays = 0.0;
+    double occlusion_mrays = 0.0;
+};
+
+// fastest of REPEATS runs of trace, in million rays per second
+template <typename Trace> double measure_mrays(const int rays, const Trace &trace)
+{
+    double best = 1e30;
+    for (int i = 0; i < REPEATS; i++)
+    {
+        const auto start = std::chrono::steady_clock::now();
+        trace();
+        best = std::min(best, milliseconds_since(start));
+    }
+    return rays / (best * 1000.0);
+}
+
+Result run(const Scene &scene, const int ray_count)
+{
+    Result result;
+    std::vector<MeshSurface> surfaces;
+    for (const Surface &s : scene.surfaces)
+    {
+        MeshSurface surface;
+        surface.vertices = s.vertices.data();
+        surface.normals = s.normals.empty() ? nullptr : s.normals.data();
+        surface.uvs = s.uvs.empty() ? nullptr : s.uvs.data();
+        surface.indices = s.indices.data();
+        surface.index_count = static_cast<int>(s.indices.size());
+        surfaces.push_back(surface);
+    }
+
+    // the builder reorders the triangles, every run starts from the same input
+    std::vector<BVHNode> nodes;
+    std::vector<unsigned int> links;
+    std::vector<Triangle> triangles;
+    unsigned int root = 0;
+    result.bvh_build_ms = 1e30;
+    for (int i = 0; i < REPEATS; i++)
+    {
+        nodes.clear();
+        links.clear();
+        triangles.clear();
+        BVHBuilder builder;
+        const auto start = std::chrono::steady_clock::now();
+        root = builder.BuildBVH(nodes, links, triangles, surfaces);
+        result.bvh_build_ms = std::min(result.bvh_build_ms, milliseconds_since(start));
+    }
+    result.triangles = triangles.size();
+    result.bvh_nodes = nodes.size();
+    result.bvh_sah_cost = BVHBuilder().sah_cost(nodes, root);
+
+    std::vector<GpuTriangleGeometry> geometry;
+    for (const Triangle &tri : triangles)
+        geometry.push_back(
+            GpuTriangleGeometry{tri.vertices[0], tri.vertices[1] - tri.vertices[0], tri.vertices[2] - tri.vertices[0]});
+
+    std::vector<BLASInstance> instances;
+    for (const Instance &placement : scene.instances)
+    {
+        BLASInstance instance = {};
+        instance.blas_index = root;
+        instance.set_materials({0, 0, 0});
+        instance.set_transform(placement.transform, placement.inverse, nodes);
+        instance.reset_previous_transform();
+        instances.push_back(instance);
+    }
+
+    std::vector<TLASNode> tlas_nodes;
+    std::vector<unsigned int> tlas_links;
+    result.tlas_build_ms = 1e30;
+    for (int i = 0; i < REPEATS; i++)
+    {
+        tlas_nodes.clear();
+        TLAS tlas;
+        const auto start = std::chrono::steady_clock::now();
+        tlas.build(tlas_nodes, instances);
+        tlas.build_links(tlas_nodes, tlas_links);
+        result.tlas_build_ms = std::min(result.tlas_build_ms, milliseconds_since(start));
+    }
+    result.tlas_sah_cost = TLAS().sah_cost(tlas_nodes);
+
+    const RayQuery query(tlas_nodes, instances, nodes, geometry);
+    const vec3 bounds_min = tlas_nodes[0].aabbMin, bounds_max = tlas_nodes[0].aabbMax;
+    const vec3 center = (bounds_min + bounds_max) * 0.5f;
+    const vec3 extent = bounds_max - bounds_min;
+    const float radius = std::max(1e-3f, std::sqrt(extent.x * extent.x + extent.y * extent.y + extent.z * extent.z) * 0.5f);
+    std::vector<vec3> origins(ray_count), directions(ray_count);
+    std::vector<RayHit> hits(ray_count);
+
+    { // primary rays of a pinhole camera looking at the scene, coherent in row order
+        const int width = std::max(1, static_cast<int>(std::sqrt(static_cast<float>(ray_count))));
+        const vec3 eye = center + normalize(vec3(0.3f, 0.5f, 1.0f)) * (radius * 1.8f);
+        const vec3 forward = normalize(center - eye);
+        const vec3 right = normalize(cross(forward, vec3(0.0f, 1.0f, 0.0f)));
+        const vec3 up = cross(right, forward);
+        for (int i = 0; i < ray_count; i++)
+        {
+            const float x = ((i % width) + 0.5f) / width * 2.0f - 1.0f;
+            const float y = ((i / width) + 0.5f) / width * 2.0f - 1.0f;
+            origins[i] = eye;
+            directions[i] = normalize(forward + right * (x * 0.6f) - up * (y * 0.6f));
+        }
+        result.primary_mrays = measure_mrays(ray_count, [&]() {
+            query.intersect(origins.data(), directions.data(), ray_count, 1e9f, hits.data());
+        });
+        result.primary_hit_rate =
+            std::count_if(hits.begin(), hits.end(), [](const RayHit &hit) { return hit.t != INFINITY; }) /
+            static_cast<double>(ray_count);
+    }
+
+    { // rays from random points inside the bounds in random directions, like bounces
+        Random random{4242u};
+        for (int i = 0; i < ray_count; i++)
+        {
+            origins[i] = vec3(random.range(bounds_min.x, bounds_max.x), random.range(bounds_min.y, bounds_max.y),
+                              random.range(bounds_min.z, bounds_max.z));
+            directions[i] = normalize(vec3(random.range(-1.0f, 1.0f), random.range(-1.0f, 1.0f), random.range(-1.0f, 1.0f)));
+        }
+        result.diffuse_mrays = measure_mrays(ray_count, [&]() {
+            query.intersect(origins.data(), directions.data(), ray_count, 1e9f, hits.data());
+        });
+
+        // segments between the same points and points a scene radius away, any hit
+        std::vector<vec3> targets(ray_count);
+        for (int i = 0; i < ray_count; i++)
+            targets[i] = origins[i] + directions[i] * radius;
+        std::vector<uint8_t> occluded(ray_count);
+        result.occlusion_mrays = measure_mrays(ray_count, [&]() {
+            query.occluded(origins.data(), targets.data(), ray_count, occluded.data());
+        });
+    }
+    return result;
+}
+
+std::string escape(const std::string &text)
+{
+    std::string escaped;
+    for (const char c : text)
+    {
+        if (c == '"' || c == '\\')
+            escaped += '\\';
+        escaped += c;
+    }
+    return escaped;
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    int ray_count = 1 << 20;
+    std::vector<Scene> scenes;
+    for (int i = 1; i < argc; i++)
+    {
+        const std::string argument = argv[i];
+        if (argument == "--rays" && i + 1 < argc)
+        {
+            ray_count = std::max(4, std::atoi(argv[++i]));
+            continue;
+        }
+        Scene scene;
+        if (!load_obj(argument, scene))
+        {
+            std::fprintf(stderr, "bvh_benchmark: cannot read %s\n", argument.c_str());
+            return 1;
+        }
+        scenes.push_back(scene);
+    }
+    scenes.push_back(make_terrain(256));
+    scenes.push_back(make_triangle_soup(200000));
+    scenes.push_back(make_sphere_instances(32));
+
+    std::printf("{\n  \"threads\": %u,\n  \"rays\": %d,\n  \"scenes\": [\n", std::thread::hardware_concurrency(),
+                ray_count);
+    for (size_t i = 0; i < scenes.size(); i++)
+    {
+        const Result r = run(scenes[i], ray_count);
+        std::printf("    {\"name\": \"%s\", \"triangles\": %zu, \"instances\": %zu, \"bvh_nodes\": %zu, "
+                    "\"bvh_build_ms\": %.3f, \"bvh_sah_cost\": %.3f, \"tlas_build_ms\": %.3f, \"tlas_sah_cost\": %.3f, "
+                    "\"primary_mrays_per_second\": %.3f, \"primary_hit_rate\": %.3f, "
+                    "\"diffuse_mrays_per_second\": %.3f, \"occlusion_mrays_per_second\": %.3f}%s\n",
+                    escape(scenes[i].name).c_str(), r.triangles, scenes[i].instances.size(), r.bvh_nodes,
+                    r.bvh_build_ms, r.bvh_sah_cost, r.tlas_build_ms, r.tlas_sah_cost, r.primary_mrays,
+                    r.primary_hit_rate, r.diffuse_mrays, r.occlusion_mrays, i + 1 < scenes.size() ? "," : "");
+        std::fflush(stdout);
+    }
+    std::printf("  ]\n}\n");
+    return 0;
+}
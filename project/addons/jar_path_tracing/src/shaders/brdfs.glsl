@@ -109,16 +109,15 @@ float get_diffuse_sampling_probability(ShadingInfo shading) {
     return min(0.5, luminance);
 }
 
-vec3 sample_brdf(ShadingInfo shading, vec2 random_sample) {
+//lobe_sample picks diffuse or specular, random_sample the direction within the lobe
+vec3 sample_brdf(ShadingInfo shading, float lobe_sample, vec2 random_sample) {
     mat3 tangent_to_world = get_shading_space(shading.normal);
     float diffuse_prob = get_diffuse_sampling_probability(shading);
     
     vec3 sampled_dir;
-    if (random_sample.x < diffuse_prob) {
-        random_sample.x /= diffuse_prob;
+    if (lobe_sample < diffuse_prob) {
         sampled_dir = tangent_to_world * sample_hemisphere_psa(random_sample);
     } else {
-        random_sample.x = (random_sample.x - diffuse_prob) / (1.0 - diffuse_prob);
         vec3 local_view = transpose(tangent_to_world) * shading.out_dir;
         vec3 local_light = sample_ggx_in_dir(local_view, shading.roughness, random_sample);
         sampled_dir = tangent_to_world * local_light;
@@ -0,0 +1,157 @@
+#[compute]
+#version 460
+
+#ifndef LOCAL_SIZE_X
+#define LOCAL_SIZE_X 32
+#define LOCAL_SIZE_Y 32
+#endif
+
+// Fills the pixels that main.glsl skipped this frame with INTERLEAVE or a sample density (alpha 0). The reconstructed
+// previous frame is reprojected with the distance of the nearest traced neighbour and clamped to the colours of the
+// traced neighbours.
+// Pixels without a traced neighbour, e.g. in a sparse periphery, reproject with their own history distance unclamped.
+// Disoccluded pixels are interpolated from the neighbours of a similar distance instead.
+// Pass 0 writes the reconstructed frame into the history of this frame, pass 1 copies the filled pixels to the
+// screen, such that pass 0 only ever reads pixels traced this frame.
+
+layout(std430, set = 0, binding = 0) restrict buffer Params {
+    mat4 inverse_vp;
+    mat4 previous_vp;
+    vec4 camera_position;
+    vec4 previous_camera_position;
+    int width;
+    int height;
+    uint frame_count;
+    uint pass;
+    float near;
+    float far;
+};
+
+layout(set = 0, binding = 1, rgba32f) restrict uniform image2D screenTexture; //alpha 0 where nothing was traced
+layout(set = 0, binding = 2, r32f) restrict uniform readonly image2D depthBuffer; //non-linear depth of main.glsl
+#ifndef HISTORY_FORMAT
+#define HISTORY_FORMAT rgba32f //or rgba16f, the distance is kept in alpha
+#endif
+//reconstructed frames, ping-ponged: colour and distance to the camera
+layout(set = 0, binding = 3, HISTORY_FORMAT) restrict uniform image2D history1;
+layout(set = 0, binding = 4, HISTORY_FORMAT) restrict uniform image2D history2;
+//outputs of main.glsl that later stages read, filled in for the skipped pixels where the variant writes them
+layout(set = 0, binding = 5, rg16f) restrict uniform writeonly image2D motionVectors;
+layout(set = 0, binding = 6, rgba16f) restrict uniform image2D gNormal;
+layout(set = 0, binding = 7, rgba8) restrict uniform image2D gAlbedo;
+layout(set = 0, binding = 8, r32f) restrict uniform image2D gDepth;
+
+bool inside(const ivec2 pos) {
+    return pos.x >= 0 && pos.y >= 0 && pos.x < width && pos.y < height;
+}
+
+//inverse of write_pixel in main.glsl
+float camera_distance(const ivec2 pos) {
+    float depth = imageLoad(depthBuffer, pos).r;
+    return near / max(1.0 - depth * (far - near) / far, 1e-6);
+}
+
+vec4 load_history(const ivec2 pos, const bool first) {
+    return first ? imageLoad(history1, pos) : imageLoad(history2, pos);
+}
+
+void store_history(const ivec2 pos, const bool first, const vec4 value) {
+    first ? imageStore(history1, pos, value) : imageStore(history2, pos, value);
+}
+
+layout(local_size_x = LOCAL_SIZE_X, local_size_y = LOCAL_SIZE_Y, local_size_z = 1) in;
+void main() {
+    ivec2 pos = ivec2(gl_GlobalInvocationID.xy);
+    if (!inside(pos)) return;
+
+    bool previous_first = (frame_count % 2) == 0; //history of the previous frame, the other one is written
+    vec4 current = imageLoad(screenTexture, pos);
+    if (pass == 1) {
+        // alpha stays 0, such that progressive rendering does not count the pixel as a sample
+        if (current.a < 0.5)
+            imageStore(screenTexture, pos, vec4(load_history(pos, !previous_first).rgb, 0.0));
+        return;
+    }
+    if (current.a > 0.5) {
+        store_history(pos, !previous_first, vec4(current.rgb, camera_distance(pos)));
+        return;
+    }
+
+    // colour box of the traced neighbours and the nearest surface among them
+    vec3 lo = vec3(1e30);
+    vec3 hi = vec3(-1e30);
+    float nearest = far;
+    ivec2 nearest_tap = pos;
+    int traced = 0;
+    for (int i = 0; i < 9; i++) {
+        ivec2 tap = pos + ivec2(i % 3 - 1, i / 3 - 1);
+        if (i == 4 || !inside(tap))
+            continue;
+        vec4 c = imageLoad(screenTexture, tap);
+        if (c.a < 0.5)
+            continue;
+        float d = camera_distance(tap);
+        lo = min(lo, c.rgb);
+        hi = max(hi, c.rgb);
+        traced++;
+        if (d < nearest || traced == 1) {
+            nearest = d;
+            nearest_tap = tap;
+        }
+    }
+    if (traced == 0) { //sparse sample density or a converged neighbourhood skipped by adaptive sampling
+        if (frame_count <= 1) {
+            store_history(pos, !previous_first, vec4(0.0, 0.0, 0.0, far));
+            return;
+        }
+        nearest = load_history(pos, previous_first).a;
+        lo = vec3(0.0);
+        hi = vec3(1e30);
+    }
+
+    // world position of the pixel centre at the nearest distance, projected into the previous frame
+    vec2 ndc = (vec2(pos) + 0.5) / vec2(width, height) * 2.0 - 1.0;
+    vec4 target = inverse_vp * vec4(ndc.x, -ndc.y, 1.0, 1.0);
+    vec3 world = camera_position.xyz + normalize(target.xyz / target.w - camera_position.xyz) * nearest;
+    vec4 previous_clip = previous_vp * vec4(world, 1.0);
+    vec2 previous_pixel = (previous_clip.xy / previous_clip.w * vec2(0.5, -0.5) + 0.5) * vec2(width, height);
+
+    vec3 color = vec3(0.0);
+    bool reprojected = false;
+    ivec2 previous_tap = ivec2(floor(previous_pixel));
+    if (frame_count > 1 && previous_clip.w > 0.0 && inside(previous_tap)) {
+        vec4 history = load_history(previous_tap, previous_first);
+        float expected = length(world - previous_camera_position.xyz);
+        if (abs(history.a - expected) < 0.1 * expected) {
+            color = clamp(history.rgb, lo, hi);
+            reprojected = true;
+        }
+    }
+    if (!reprojected && traced == 0) { // nothing to interpolate from, keep the history of the pixel itself
+        color = load_history(pos, previous_first).rgb;
+    } else if (!reprojected) { // disoccluded, neighbours weighted by how close their surface is to the nearest one
+        float weight_sum = 0.0;
+        for (int i = 0; i < 9; i++) {
+            ivec2 tap = pos + ivec2(i % 3 - 1, i / 3 - 1);
+            if (i == 4 || !inside(tap))
+                continue;
+            vec4 c = imageLoad(screenTexture, tap);
+            if (c.a < 0.5)
+                continue;
+            float w = exp(-abs(camera_distance(tap) - nearest) / (0.05 * nearest));
+            color += c.rgb * w;
+            weight_sum += w;
+        }
+        color /= max(weight_sum, 1e-6);
+    }
+    store_history(pos, !previous_first, vec4(color, nearest));
+
+    // the per pixel outputs follow the nearest neighbour, textures of variants that do not write them are 1x1
+    if (all(lessThan(pos, imageSize(motionVectors))))
+        imageStore(motionVectors, pos, vec4(previous_pixel - (vec2(pos) + 0.5), 0.0, 0.0));
+    if (all(lessThan(pos, imageSize(gNormal)))) {
+        imageStore(gNormal, pos, imageLoad(gNormal, nearest_tap));
+        imageStore(gAlbedo, pos, imageLoad(gAlbedo, nearest_tap));
+        imageStore(gDepth, pos, imageLoad(gDepth, nearest_tap));
+    }
+}
@@ -1,7 +1,30 @@
 #[compute]
 #version 460
+#extension GL_KHR_shader_subgroup_basic : enable
+#extension GL_KHR_shader_subgroup_arithmetic : enable
+#extension GL_KHR_shader_subgroup_ballot : enable
 
+// variant defines are generated by PathTracingCamera::get_shader_defines
 // #define DEBUG_STEPS
+// #define TEXTURE_SAMPLING
+// #define RAY_SORTING
+// #define ADAPTIVE_SAMPLING
+// #define SAMPLER_SOBOL or SAMPLER_BLUE_NOISE, white noise otherwise
+// #define ENVIRONMENT_MAP
+// #define RESTIR_DI
+// #define GBUFFER_OUTPUT
+// #define MOTION_VECTORS
+// #define HYBRID_PRIMARY
+// #define PRIMARY_CACHE <jitter positions per pixel>, without HYBRID_PRIMARY only
+// #define INTERLEAVE 2 (checkerboard) or 4 (one pixel of every 2x2 block)
+// #define SAMPLE_DENSITY_RADIAL or SAMPLE_DENSITY_TEXTURE
+#ifndef MAX_BOUNCES
+#define MAX_BOUNCES 5
+#endif
+#ifndef LOCAL_SIZE_X
+#define LOCAL_SIZE_X 32
+#define LOCAL_SIZE_Y 32
+#endif
 
 // ----------------------------------- STRUCTS -----------------------------------
 
@@ -11,8 +34,10 @@ struct Light {
 };
 
 
-struct TriangleGeometry {
-    vec4 vertices[3];
+struct TriangleGeometry { //intersection record, v0 and both edges precomputed on the cpu
+    vec4 v0;
+    vec4 edge1;
+    vec4 edge2;
 };
 
 struct TriangleData {
@@ -60,12 +85,14 @@ struct TLASNode
 };
 
 struct HitInfo {
-    vec3 position;
+    //written for every candidate hit during traversal
     float t;
     uint blas;
     uint triangle;
     uint steps;
     vec2 barycentrics;
+    //derived once for the closest hit by finalize_hit, in global space
+    vec3 position;
     bool front;
     vec3 out_dir; //i suppose this is essentially fragment-camera direction, though only literally for the direct shading point.
 };
@@ -79,12 +106,14 @@ struct ShadingInfo {
     vec3 diffuse_albedo;
     vec3 fresnel_0;
     float roughness;
+    uint blas; //instance that was hit
 };
 
 struct BLASInstance
 {
     mat4 transform;
     mat4 inverse_transform;
+    mat4 previous_transform; //transform of the previous frame, for motion vectors
     vec4 aabbMin;
     vec4 aabbMax;
     uint root; //index to the right BLAS BVH node
@@ -95,7 +124,7 @@ struct BLASInstance
 
 // ----------------------------------- GENERAL STORAGE -----------------------------------
 
-layout(set = 0, binding = 0, rgba8) restrict uniform writeonly image2D outputImage;
+layout(set = 0, binding = 0, rgba32f) restrict uniform writeonly image2D outputImage; //radiance, tonemapped by the post processing
 layout(set = 0, binding = 1, r32f) restrict uniform writeonly image2D depthBuffer;
 
 layout(std430, set = 0, binding = 2) restrict buffer Params {
@@ -105,6 +134,12 @@ layout(std430, set = 0, binding = 2) restrict buffer Params {
     float fov;
     uint triangleCount;
     uint blas_count;
+    uint samples_per_frame;
+    ivec2 tile_offset; //origin of the dispatched tile in tiled rendering, a multiple of the workgroup size
+    vec2 gaze; //centre of the radial sample density, in uv
+    float fovea_radius; //radial density is 1 within this distance of the gaze, in screen heights
+    float periphery_radius; //and falls to min_density at this distance
+    float min_density; //lower bound of the sample density, every pixel is traced now and then
 } params;
 
 layout(std430, set = 0, binding = 3) restrict buffer Camera {
@@ -114,8 +149,51 @@ layout(std430, set = 0, binding = 3) restrict buffer Camera {
     uint frame_index;
     float near;
     float far;
+    uint use_sample_mask; //0 on frames where the mask is stale, e.g. right after the camera moved
+    mat4 previous_vp; //view projection of the previous dispatch, for temporal reuse
+    vec2 jitter; //subpixel position of the primary rays in hybrid mode, shared with the rasterized visibility
+    uint primary_cache_generation; //cached primary hits of other generations are stale, 0 disables the cache
+    uint sample_frame; //frames since the accumulation restarted, such that every accumulation starts the sequences at 0
 } camera;
 
+layout(std430, set = 0, binding = 4) restrict buffer Statistics {
+    uint rays_traced;
+    uint sorted_rays[2]; //0: direction sort, 1: material sort
+    uint coherent_before[2]; //neighbouring lanes sharing a sort key, before sorting
+    uint coherent_after[2]; //idem, after sorting
+    uint paths_traced; //camera samples, one per traced pixel and sample per frame
+    uint candidate_pixels; //pixels the dispatch covered, traced or skipped
+} statistics;
+
+//written by progressive rendering: 0 once a pixel has converged
+layout(set = 0, binding = 5, r8) restrict uniform readonly image2D sampleMask;
+
+//tileable blue-noise mask, values are the normalized ranks
+layout(set = 0, binding = 6, r32f) restrict uniform readonly image2D blueNoise;
+
+//ReSTIR DI reservoirs, twice the screen width: the half at x + (frame_index & 1) * width is written this frame,
+//the other half holds the previous frame. Reservoir: emitter | M << 24, barycentrics, W. Surface: normal, distance.
+layout(set = 0, binding = 7, rgba32f) restrict uniform image2D reservoirs;
+layout(set = 0, binding = 8, rgba32f) restrict uniform image2D reservoirSurfaces;
+
+//G-buffer of the primary hit for the denoiser: world normal, albedo and distance to the camera
+layout(set = 0, binding = 9, rgba16f) restrict uniform writeonly image2D gNormal;
+layout(set = 0, binding = 10, rgba8) restrict uniform writeonly image2D gAlbedo;
+layout(set = 0, binding = 11, r32f) restrict uniform writeonly image2D gDepth;
+
+//screen space motion of the primary hit since the previous frame in pixels, for temporal reprojection
+layout(set = 0, binding = 12, rg16f) restrict uniform writeonly image2D motionVectors;
+
+//rasterized primary visibility for hybrid mode: instance + 1 (0 where the sky is visible) and triangle
+layout(set = 0, binding = 13, rg32ui) restrict uniform readonly uimage2D visibilityBuffer;
+
+//per pixel sample density for SAMPLE_DENSITY_TEXTURE, the user texture resized to the screen
+layout(set = 0, binding = 15, r8) restrict uniform readonly image2D sampleDensity;
+
+//primary hits of a static camera, PRIMARY_CACHE screens stacked vertically, one per jitter position:
+//(instance + 1) | generation << 16 (instance 0 where the sky is visible) and triangle
+layout(set = 0, binding = 14, rg32ui) restrict uniform uimage2D primaryCache;
+
 
 // ----------------------------------- STORAGE BUFFERS -----------------------------------
 
@@ -150,55 +228,147 @@ layout(set = 1, binding = 5, std430) restrict buffer TLASInstances
     TLASNode tlas_nodes[];
 };
 
+//parent links for stackless traversal: (parent << 2) | split axis, roots link to themselves
+layout(set = 1, binding = 6, std430) restrict readonly buffer BVHLinks
+{
+    uint bvh_links[];
+};
+
+layout(set = 1, binding = 7, std430) restrict readonly buffer TLASLinks
+{
+    uint tlas_links[];
+};
+
+//built by EnvironmentMap on the cpu, weights are luminance * sin(theta) per texel
+layout(set = 1, binding = 8, std430) restrict readonly buffer EnvironmentDistribution
+{
+    uint width;
+    uint height;
+    float integral; //sum of all weights
+    float intensity;
+    float cdf[]; //marginal cdf over the rows, followed by the conditional cdf of every row
+} environment;
+
+//emissive triangles with an alias table over their power, built by GeometryGroup3D
+struct Emitter {
+    uint blas;
+    uint triangle;
+    float probability; //of picking this emitter
+    uint alias;
+    float threshold; //probability of keeping this entry rather than its alias
+    float padding[3];
+};
+
+layout(set = 1, binding = 9, std430) restrict readonly buffer Emitters
+{
+    uint emitter_count;
+    float emitter_power;
+    uint emitter_padding[2];
+    Emitter emitters[];
+};
+
 // ----------------------------------- TEXTURES -----------------------------------
 
 layout(set = 2, binding = 0) uniform sampler2DArray textureArray;
 
+//equirectangular panorama, read per texel such that it matches the piecewise constant sampling distribution
+layout(set = 2, binding = 1, rgba32f) restrict uniform readonly image2D environmentMap;
+
 // ----------------------------------- FUNCTIONS -----------------------------------
 
+uint invocation_rays_traced = 0;
+
 //brdfs
 #include "brdfs.glsl"
+#include "sampling.glsl"
 
+// ----------------------------------- ENVIRONMENT -----------------------------------
 
-vec2 pcg2d(inout uvec2 seed) {
-	// PCG2D, as described here: https://jcgt.org/published/0009/03/02/
-	seed = 1664525u * seed + 1013904223u;
-	seed.x += 1664525u * seed.y;
-	seed.y += 1664525u * seed.x;
-	seed ^= (seed >> 16u);
-	seed.x += 1664525u * seed.y;
-	seed.y += 1664525u * seed.x;
-	seed ^= (seed >> 16u);
-	// Multiply by 2^-32 to get floats
-	return vec2(seed) * 2.32830643654e-10; 
+float luminance(const vec3 color) {
+    return dot(color, vec3(0.2126, 0.7152, 0.0722));
 }
 
-uvec2 prng_seed(vec2 pos, uint frame) {
-    uvec2 seed = uvec2(pos.xy);
-    seed = seed * 0x9e3779b9u + uvec2(frame);
-    seed ^= seed >> 16u;
-    return seed * 0x9e3779b9u;
+vec2 environment_uv(const vec3 d) {
+    return vec2(atan(d.x, -d.z) * (0.5 / M_PI) + 0.5, acos(clamp(d.y, -1.0, 1.0)) / M_PI);
 }
 
-vec2 box_muller(vec2 rands) {
-    float R = sqrt(-2.0f * log(rands.x));
-    float theta = 6.2831853f * rands.y;
-    return vec2(cos(theta), sin(theta));
+vec3 environment_direction(const vec2 uv) {
+    float phi = (uv.x - 0.5) * 2.0 * M_PI;
+    float theta = uv.y * M_PI;
+    return vec3(sin(theta) * sin(phi), cos(theta), -sin(theta) * cos(phi));
+}
+
+ivec2 environment_texel(const vec2 uv) {
+    ivec2 size = ivec2(environment.width, environment.height);
+    return clamp(ivec2(uv * vec2(size)), ivec2(0), size - 1);
 }
 
 vec3 sampleSky(const vec3 direction) {
+#ifdef ENVIRONMENT_MAP
+    return imageLoad(environmentMap, environment_texel(environment_uv(direction))).rgb * environment.intensity;
+#else
     float t = 0.5 * (direction.y + 1.0);
     return mix(vec3(0.95), vec3(0.9, 0.94, 1.0), t) * 1.0f;
+#endif
+}
+
+#ifdef ENVIRONMENT_MAP
+//solid angle density of sample_environment
+float environment_pdf(const vec3 d) {
+    vec2 uv = environment_uv(d);
+    ivec2 texel = environment_texel(uv);
+    float sin_theta = sin(uv.y * M_PI);
+    if (environment.integral <= 0.0 || sin_theta <= 0.0)
+        return 0.0;
+    float weight = luminance(imageLoad(environmentMap, texel).rgb) * sin((texel.y + 0.5) / environment.height * M_PI);
+    return weight * environment.width * environment.height / (environment.integral * 2.0 * M_PI * M_PI * sin_theta);
+}
+
+//first entry of cdf[begin, begin + count) above value
+uint find_interval(const uint begin, const uint count, const float value) {
+    uint low = 0;
+    uint high = count - 1;
+    while (low < high) {
+        uint mid = (low + high) / 2;
+        if (environment.cdf[begin + mid] > value)
+            high = mid;
+        else
+            low = mid + 1;
+    }
+    return low;
+}
+
+//picks a texel through the marginal and conditional cdf, then a uniform position within it
+vec3 sample_environment(const vec2 random_sample, out float pdf) {
+    uint y = find_interval(0, environment.height, random_sample.y);
+    uint row = environment.height + y * environment.width;
+    uint x = find_interval(row, environment.width, random_sample.x);
+
+    float y_begin = y > 0 ? environment.cdf[y - 1] : 0.0;
+    float x_begin = x > 0 ? environment.cdf[row + x - 1] : 0.0;
+    vec2 offset = vec2((random_sample.x - x_begin) / max(environment.cdf[row + x] - x_begin, 1e-8),
+                       (random_sample.y - y_begin) / max(environment.cdf[y] - y_begin, 1e-8));
+    vec2 uv = (vec2(x, y) + clamp(offset, 0.0, 0.999)) / vec2(environment.width, environment.height);
+
+    vec3 d = environment_direction(uv);
+    pdf = environment_pdf(d);
+    return d;
 }
 
+float power_heuristic(const float a, const float b) {
+    return a * a / max(a * a + b * b, 1e-20);
+}
+#endif
+
 ShadingInfo get_shading_data(const HitInfo h) {
     ShadingInfo s;
     TriangleData tri = triangles_data[h.triangle];
     BLASInstance b = blas_instances[h.blas];
     Material material = materials[b.materials[tri.materialIndex]];
 
-    s.position = (b.transform * vec4(h.position, 1.0)).xyz;//transform position to global space
-    s.out_dir = normalize((b.transform * vec4(h.out_dir, 0.0)).xyz);
+    s.position = h.position;
+    s.blas = h.blas;
+    s.out_dir = h.out_dir;
     float u = h.barycentrics.x;
     float v = h.barycentrics.y;
 
@@ -210,8 +380,10 @@ ShadingInfo get_shading_data(const HitInfo h) {
     s.lambert_out = dot(s.normal, s.out_dir);
     s.emission = material.emission.xyz * max(0, material.emission.w);
     vec3 albedo = material.diffuse_albedo.rgb;
+#ifdef TEXTURE_SAMPLING
     if(material.albedo_texture_id >= 0)
         albedo *= texture(textureArray, vec3(uv, material.albedo_texture_id)).rgb;
+#endif
 
     float metalicity = material.metallic;
     s.fresnel_0 = mix(vec3(0.02), albedo, metalicity);
@@ -224,12 +396,9 @@ ShadingInfo get_shading_data(const HitInfo h) {
 bool intersectTriangle(const Ray ray, const uint tri_index, in out HitInfo hitInfo) {
     hitInfo.steps++;
     TriangleGeometry tri = triangles_geometry[tri_index];
-    vec3 v0 = tri.vertices[0].xyz;
-    vec3 v1 = tri.vertices[1].xyz;
-    vec3 v2 = tri.vertices[2].xyz;
-
-    vec3 edge1 = v1 - v0;
-    vec3 edge2 = v2 - v0;
+    vec3 v0 = tri.v0.xyz;
+    vec3 edge1 = tri.edge1.xyz;
+    vec3 edge2 = tri.edge2.xyz;
 
     vec3 pvec = cross(ray.d, edge2);
     float det = dot(edge1, pvec);
@@ -246,16 +415,22 @@ bool intersectTriangle(const Ray ray, const uint tri_index, in out HitInfo hitIn
     float t = dot(edge2, qvec) * invDet;
     if(t < 0.0 || t > hitInfo.t) return false;
 
-    hitInfo.position = ray.o + t * ray.d;
     hitInfo.t = t;
     hitInfo.triangle = tri_index;
     hitInfo.barycentrics = vec2(u, v);
-    hitInfo.out_dir = -ray.d;
-    vec3 geometricNormal = cross(edge1, edge2);
-    hitInfo.front = (dot(geometricNormal, ray.d) > 0.0);
     return true;
 }
 
+//derives the remaining hit data of the closest hit, ray is the global space ray that was traced.
+void finalize_hit(const Ray ray, inout HitInfo hitInfo) {
+    TriangleGeometry tri = triangles_geometry[hitInfo.triangle];
+    vec3 local_d = mat3(blas_instances[hitInfo.blas].inverse_transform) * ray.d;
+    vec3 geometricNormal = cross(tri.edge1.xyz, tri.edge2.xyz);
+    hitInfo.position = ray.o + hitInfo.t * ray.d;
+    hitInfo.out_dir = -normalize(ray.d);
+    hitInfo.front = (dot(geometricNormal, local_d) > 0.0);
+}
+
 float intersectAABB(const in Ray ray, const vec3 bmin, const vec3 bmax )
 {
     float tx1 = (bmin.x - ray.o.x) * ray.rD.x, tx2 = (bmax.x - ray.o.x) * ray.rD.x;
@@ -267,6 +442,140 @@ float intersectAABB(const in Ray ray, const vec3 bmin, const vec3 bmax )
     if (tmax >= tmin && tmax > 0) return tmin; else return 1e30f;//&& tmin < ray.t
 }
 
+#ifdef TRAVERSAL_STACKLESS
+// Stackless traversal (Hapala et al. 2011): instead of a stack, every node knows its parent and the children of an
+// interior node are visited in a fixed order along its split axis, so the way back up can be reconstructed.
+#define FROM_PARENT 0
+#define FROM_SIBLING 1
+#define FROM_CHILD 2
+
+uint bvh_near_child(const uint index, const BVHNode node, const Ray ray) {
+    return ray.d[bvh_links[index] & 3] < 0.0 ? node.right_child : node.left_child;
+}
+
+uint bvh_sibling(const uint index) {
+    BVHNode parent = bvhTree[bvh_links[index] >> 2];
+    return parent.left_child == index ? parent.right_child : parent.left_child;
+}
+
+void intersect_leaf(const BVHNode node, const Ray ray, in out HitInfo hitInfo) {
+    for (uint i = 0; i < node.tri_count; i++) {
+        intersectTriangle(ray, node.first_tri_index + i, hitInfo);
+    }
+}
+
+bool ray_trace_blas(const uint root, const Ray ray, in out HitInfo hitInfo)
+{
+    BVHNode node = bvhTree[root];
+    if (node.tri_count > 0) {
+        intersect_leaf(node, ray, hitInfo);
+        return hitInfo.t < 1e9;
+    }
+    uint current = bvh_near_child(root, node, ray);
+    uint state = FROM_PARENT;
+
+    while (true) {
+        if (state == FROM_CHILD) {
+            if (current == root) break;
+            uint parent = bvh_links[current] >> 2;
+            if (current == bvh_near_child(parent, bvhTree[parent], ray)) {
+                current = bvh_sibling(current);
+                state = FROM_SIBLING;
+            } else {
+                current = parent;
+            }
+            continue;
+        }
+
+        node = bvhTree[current];
+        if (intersectAABB(ray, node.aabbMin.xyz, node.aabbMax.xyz) < hitInfo.t) {
+            if (node.tri_count == 0) {
+                current = bvh_near_child(current, node, ray);
+                state = FROM_PARENT;
+                continue;
+            }
+            intersect_leaf(node, ray, hitInfo);
+        }
+        // missed, or done with a leaf
+        if (state == FROM_PARENT) {
+            current = bvh_sibling(current);
+            state = FROM_SIBLING;
+        } else {
+            current = bvh_links[current] >> 2;
+            state = FROM_CHILD;
+        }
+    }
+
+    return hitInfo.t < 1e9;
+}
+
+uint tlas_near_child(const uint index, const TLASNode node, const Ray ray) {
+    return ray.d[tlas_links[index] & 3] < 0.0 ? node.leftRight >> 16 : node.leftRight & 0xFFFF;
+}
+
+uint tlas_sibling(const uint index) {
+    TLASNode parent = tlas_nodes[tlas_links[index] >> 2];
+    uint left = parent.leftRight & 0xFFFF;
+    return left == index ? parent.leftRight >> 16 : left;
+}
+
+void trace_instance(const uint blas, const Ray ray, inout HitInfo hitInfo) {
+    BLASInstance b = blas_instances[blas];
+    Ray b_ray;
+    b_ray.o = (b.inverse_transform * vec4(ray.o, 1.0)).xyz;
+    b_ray.d = (b.inverse_transform * vec4(ray.d, 0.0)).xyz;
+    b_ray.rD = 1.0 / b_ray.d;
+    float previousT = hitInfo.t;
+    ray_trace_blas(b.root, b_ray, hitInfo);
+    if (hitInfo.t < previousT)
+        hitInfo.blas = blas;
+}
+
+bool ray_trace_tlas(const Ray ray, inout HitInfo hitInfo)
+{
+    invocation_rays_traced++;
+    TLASNode node = tlas_nodes[0];
+    if (node.leftRight == 0) {
+        trace_instance(node.blas, ray, hitInfo);
+        return hitInfo.t < 1e9;
+    }
+    uint current = tlas_near_child(0, node, ray);
+    uint state = FROM_PARENT;
+
+    while (true) {
+        if (state == FROM_CHILD) {
+            if (current == 0) break;
+            uint parent = tlas_links[current] >> 2;
+            if (current == tlas_near_child(parent, tlas_nodes[parent], ray)) {
+                current = tlas_sibling(current);
+                state = FROM_SIBLING;
+            } else {
+                current = parent;
+            }
+            continue;
+        }
+
+        node = tlas_nodes[current];
+        if (intersectAABB(ray, node.aabbMin.xyz, node.aabbMax.xyz) < hitInfo.t) {
+            if (node.leftRight != 0) {
+                current = tlas_near_child(current, node, ray);
+                state = FROM_PARENT;
+                continue;
+            }
+            trace_instance(node.blas, ray, hitInfo);
+        }
+        if (state == FROM_PARENT) {
+            current = tlas_sibling(current);
+            state = FROM_SIBLING;
+        } else {
+            current = tlas_links[current] >> 2;
+            state = FROM_CHILD;
+        }
+    }
+
+    return hitInfo.t < 1e9;
+}
+#else
 bool ray_trace_blas(const uint root, const Ray ray, in out HitInfo hitInfo)
 {
     uint stack[64];
@@ -308,6 +617,7 @@ bool ray_trace_tlas(const Ray ray, inout HitInfo hitInfo)
     int stackPtr = 0;
     stack[stackPtr++] = 0;
     float minT = 1e9; //todo remove?
+    invocation_rays_traced++;
 
     while (stackPtr > 0) {
         TLASNode node = tlas_nodes[stack[--stackPtr]];
@@ -348,6 +658,8 @@ bool ray_trace_tlas(const Ray ray, inout HitInfo hitInfo)
 
     return hitInfo.t < 1e9;
 }
+#endif
+
 //traces scene, and returns shading data. true if scene hit, false if missed (i.e. hit the sky instead)
 bool ray_trace(const Ray ray, out ShadingInfo s) {
     HitInfo hitInfo;
@@ -361,6 +673,7 @@ bool ray_trace(const Ray ray, out ShadingInfo s) {
 #endif
     if(hit)
     {
+        finalize_hit(ray, hitInfo);
         s = get_shading_data(hitInfo);
         return true;
     } else {
@@ -369,24 +682,363 @@ bool ray_trace(const Ray ray, out ShadingInfo s) {
     }
 }
 
-vec3 path_trace(Ray ray, inout uvec2 seed, out float depth) {
+#ifdef ENVIRONMENT_MAP
+//next event estimation towards the environment, weighted against hitting it through brdf sampling
+vec3 sample_environment_light(const ShadingInfo s, const uvec2 seed, const int bounce) {
+    float light_pdf;
+    vec3 dir = sample_environment(sample_2d(seed, bounce_dimension(bounce, DIMENSION_LIGHT)), light_pdf);
+    float lambert_in = dot(s.normal, dir);
+    if (light_pdf <= 0.0 || lambert_in <= 0.0)
+        return vec3(0.0);
+
+    Ray shadow;
+    shadow.o = s.position + s.normal * 0.001;
+    shadow.d = dir;
+    shadow.rD = 1.0 / dir;
+    HitInfo hitInfo;
+    hitInfo.t = 1e9;
+    hitInfo.steps = 0;
+    if (ray_trace_tlas(shadow, hitInfo))
+        return vec3(0.0);
+
+    //the brdf ray of the last bounce is never traced, so light sampling is the only strategy left there
+    float weight = bounce == MAX_BOUNCES - 1 ? 1.0 : power_heuristic(light_pdf, get_brdf_density(s, dir));
+    return brdf(s, dir) * lambert_in * sampleSky(dir) * weight / light_pdf;
+}
+
+//weight of an environment hit by a brdf sampled ray, brdf_pdf is 0 for camera rays
+float environment_hit_weight(const vec3 dir, const float brdf_pdf) {
+    return brdf_pdf > 0.0 ? power_heuristic(brdf_pdf, environment_pdf(dir)) : 1.0;
+}
+#endif
+
+#ifdef GBUFFER_OUTPUT
+//written at the primary hit, the pixel comes from the sampler state since sorted paths move between invocations
+void write_gbuffer(const uvec2 seed, const bool hit, const ShadingInfo s) {
+    ivec2 pos = ivec2(seed.x & 0xFFFFu, seed.x >> 16);
+    imageStore(gNormal, pos, vec4(hit ? s.normal : vec3(0.0), 0.0));
+    imageStore(gAlbedo, pos, vec4(hit ? min(s.diffuse_albedo + s.fresnel_0, vec3(1.0)) : vec3(1.0), 1.0));
+    imageStore(gDepth, pos, vec4(hit ? length(s.position - camera.position.xyz) : camera.far));
+}
+#endif
+
+#ifdef MOTION_VECTORS
+vec2 clip_to_pixel(const vec4 clip) {
+    vec2 ndc = clip.xy / clip.w;
+    return vec2(ndc.x + 1.0, 1.0 - ndc.y) * 0.5 * vec2(params.width, params.height);
+}
+
+//hits move along with their instance, misses only with the camera rotation. Both positions are projected,
+//such that the pixel jitter cancels out.
+void write_motion_vector(const uvec2 seed, const bool hit, const ShadingInfo s, const vec3 dir) {
+    ivec2 pos = ivec2(seed.x & 0xFFFFu, seed.x >> 16);
+    vec4 current = hit ? vec4(s.position, 1.0) : vec4(dir, 0.0);
+    vec4 previous = current;
+    if (hit) {
+        BLASInstance b = blas_instances[s.blas];
+        previous = b.previous_transform * (b.inverse_transform * current);
+    }
+    vec2 motion = clip_to_pixel(camera.previous_vp * previous) - clip_to_pixel(camera.vp * current);
+    imageStore(motionVectors, pos, vec4(motion, 0.0, 0.0));
+}
+#endif
+
+#ifdef RESTIR_DI
+// ----------------------------------- RESTIR DI -----------------------------------
+// Direct light from emissive triangles at the primary hit through reservoir resampling (Bitterli et al. 2020).
+// RIS picks one of RESTIR_CANDIDATES emitter samples, which is merged with the reprojected reservoir of the previous
+// frame and a few of its neighbours. Neighbours are read from the previous frame as well ("fused" spatiotemporal
+// reuse), such that a single dispatch suffices. Reuse is biased: surfaces are matched by normal and distance only.
+// With several samples per frame every sample reuses the previous frame, but only the first one stores its reservoir.
+
+#define RESTIR_CANDIDATES 8
+#define RESTIR_NEIGHBOURS 3
+#define RESTIR_RADIUS 16.0
+#define RESTIR_HISTORY 20 //M of a reused reservoir is capped at this multiple of the candidate count
+#define DIMENSION_RESTIR bounce_dimension(MAX_BOUNCES, 0)
+
+struct Reservoir {
+    uint emitter;
+    vec2 barycentrics;
+    float w_sum; //sum of weights while resampling, W = w_sum / (M * target) afterwards
+    float M;
+    float target; //target function of the chosen sample
+};
+
+struct LightPoint {
+    vec3 position;
+    vec3 normal;
+    vec3 emission;
+    float area;
+};
+
+LightPoint emitter_point(const uint index, const vec2 barycentrics) {
+    Emitter e = emitters[index];
+    BLASInstance b = blas_instances[e.blas];
+    TriangleGeometry tri = triangles_geometry[e.triangle];
+    Material material = materials[b.materials[triangles_data[e.triangle].materialIndex]];
+
+    LightPoint l;
+    vec3 local = tri.v0.xyz + barycentrics.x * tri.edge1.xyz + barycentrics.y * tri.edge2.xyz;
+    l.position = (b.transform * vec4(local, 1.0)).xyz;
+    vec3 n = cross(mat3(b.transform) * tri.edge1.xyz, mat3(b.transform) * tri.edge2.xyz);
+    l.area = 0.5 * length(n);
+    l.normal = n / max(2.0 * l.area, 1e-12);
+    l.emission = material.emission.xyz * max(0, material.emission.w);
+    return l;
+}
+
+//unshadowed contribution of a light point, emitters are two sided like emissive hits in path_trace
+vec3 light_contribution(const ShadingInfo s, const LightPoint l, out vec3 dir, out float dist) {
+    vec3 to_light = l.position - s.position;
+    dist = length(to_light);
+    dir = to_light / max(dist, 1e-6);
+    float lambert_in = dot(s.normal, dir);
+    if (lambert_in <= 0.0 || dist < 1e-4)
+        return vec3(0.0);
+    float lambert_light = abs(dot(l.normal, dir));
+    return brdf(s, dir) * l.emission * lambert_in * lambert_light / (dist * dist);
+}
+
+float restir_target(const ShadingInfo s, const uint emitter, const vec2 barycentrics) {
+    vec3 dir;
+    float dist;
+    return luminance(light_contribution(s, emitter_point(emitter, barycentrics), dir, dist));
+}
+
+bool restir_update(inout Reservoir r, const uint emitter, const vec2 barycentrics, const float target, const float weight,
+                   const float M, const float random) {
+    r.w_sum += weight;
+    r.M += M;
+    if (weight <= 0.0 || random * r.w_sum > weight)
+        return false;
+    r.emitter = emitter;
+    r.barycentrics = barycentrics;
+    r.target = target;
+    return true;
+}
+
+bool is_visible(const vec3 origin, const vec3 normal, const vec3 dir, const float dist) {
+    Ray shadow;
+    shadow.o = origin + normal * 0.001;
+    shadow.d = dir;
+    shadow.rD = 1.0 / dir;
+    HitInfo hitInfo;
+    hitInfo.t = dist - 0.002;
+    hitInfo.steps = 0;
+    return !ray_trace_tlas(shadow, hitInfo);
+}
+
+//merges the stored reservoir at pixel of the previous frame, if it was computed for a similar surface
+void restir_reuse(inout Reservoir r, const ShadingInfo s, const float distance_to_camera, const ivec2 pixel,
+                  const float random) {
+    if (pixel.x < 0 || pixel.y < 0 || pixel.x >= params.width || pixel.y >= params.height)
+        return;
+    ivec2 previous = ivec2(uint(pixel.x) + (1u - (camera.frame_index & 1u)) * uint(params.width), pixel.y);
+    vec4 surface = imageLoad(reservoirSurfaces, previous);
+    if (dot(surface.xyz, s.normal) < 0.9 || abs(surface.w - distance_to_camera) > 0.1 * distance_to_camera)
+        return;
+
+    vec4 stored = imageLoad(reservoirs, previous);
+    uint packed = floatBitsToUint(stored.x);
+    uint emitter = packed & 0xFFFFFFu;
+    float M = min(float(packed >> 24), float(RESTIR_HISTORY * RESTIR_CANDIDATES));
+    if (M <= 0.0 || emitter >= emitter_count || stored.w <= 0.0)
+        return;
+    float target = restir_target(s, emitter, stored.yz);
+    restir_update(r, emitter, stored.yz, target, target * stored.w * M, M, random);
+}
+
+ivec2 restir_current_pixel(const uvec2 seed) {
+    return ivec2((seed.x & 0xFFFFu) + (camera.frame_index & 1u) * uint(params.width), seed.x >> 16);
+}
+
+//the sample of a pixel that stores its reservoir for the next frame, the sample index is in seed.y
+bool restir_stores(const uvec2 seed) {
+    return seed.y % params.samples_per_frame == 0u;
+}
+
+//primary ray missed, such that nothing is reused from this pixel next frame
+void restir_clear(const uvec2 seed) {
+    if (!restir_stores(seed))
+        return;
+    imageStore(reservoirs, restir_current_pixel(seed), vec4(0.0));
+    imageStore(reservoirSurfaces, restir_current_pixel(seed), vec4(0.0));
+}
+
+//direct light at the primary hit s of the pixel in seed, also stores the reservoir for the next frame
+vec3 restir_direct_light(const ShadingInfo s, const uvec2 seed) {
+    ivec2 current = restir_current_pixel(seed);
+    float distance_to_camera = length(s.position - camera.position.xyz);
+    uvec2 rng = seed ^ uvec2(0x2545f491u, 0x9e3779b9u); //stream for the resampling decisions
+    Reservoir r = Reservoir(0u, vec2(0.0), 0.0, 0.0, 0.0);
+
+    // initial candidates, emitters picked by power through the alias table and a uniform point on the triangle
+    for (uint i = 0; i < RESTIR_CANDIDATES && emitter_count > 0; i++) {
+        vec2 pick = sample_2d(seed, DIMENSION_RESTIR + 2 * i);
+        vec2 point = sample_2d(seed, DIMENSION_RESTIR + 2 * i + 1);
+        uint index = min(uint(pick.x * emitter_count), emitter_count - 1);
+        uint emitter = fract(pick.x * emitter_count) < emitters[index].threshold ? index : emitters[index].alias;
+        float su = sqrt(point.x);
+        vec2 barycentrics = vec2(su * (1.0 - point.y), su * point.y);
+
+        LightPoint l = emitter_point(emitter, barycentrics);
+        float source_pdf = emitters[emitter].probability / max(l.area, 1e-12);
+        vec3 dir;
+        float dist;
+        float target = luminance(light_contribution(s, l, dir, dist));
+        restir_update(r, emitter, barycentrics, target, target / max(source_pdf, 1e-12), 1.0, pcg2d(rng).x);
+    }
+
+    // drop an occluded initial sample before it is reused
+    if (r.target > 0.0) {
+        vec3 dir;
+        float dist;
+        light_contribution(s, emitter_point(r.emitter, r.barycentrics), dir, dist);
+        if (!is_visible(s.position, s.normal, dir, dist)) {
+            r.w_sum = 0.0;
+            r.target = 0.0;
+        }
+    }
+
+    // temporal and spatial reuse from the previous frame
+    vec4 previous_clip = camera.previous_vp * vec4(s.position, 1.0);
+    if (previous_clip.w > 0.0) {
+        vec2 previous_uv = (previous_clip.xy / previous_clip.w) * vec2(0.5, -0.5) + 0.5;
+        vec2 previous_pixel = previous_uv * vec2(params.width, params.height);
+        restir_reuse(r, s, distance_to_camera, ivec2(previous_pixel), pcg2d(rng).x);
+        for (uint i = 0; i < RESTIR_NEIGHBOURS; i++) {
+            vec2 offset = (pcg2d(rng) * 2.0 - 1.0) * RESTIR_RADIUS;
+            restir_reuse(r, s, distance_to_camera, ivec2(previous_pixel + offset), pcg2d(rng).x);
+        }
+    }
+
+    float W = r.target > 0.0 && r.M > 0.0 ? r.w_sum / (r.M * r.target) : 0.0;
+    if (restir_stores(seed)) {
+        imageStore(reservoirs, current, vec4(uintBitsToFloat(r.emitter | (uint(min(r.M, 255.0)) << 24)), r.barycentrics, W));
+        imageStore(reservoirSurfaces, current, vec4(s.normal, distance_to_camera));
+    }
+    if (W <= 0.0)
+        return vec3(0.0);
+
+    vec3 dir;
+    float dist;
+    vec3 contribution = light_contribution(s, emitter_point(r.emitter, r.barycentrics), dir, dist);
+    return is_visible(s.position, s.normal, dir, dist) ? contribution * W : vec3(0.0);
+}
+#endif
+
+#if defined(HYBRID_PRIMARY) || defined(PRIMARY_CACHE)
+//primary hit on a known triangle, only that triangle is intersected. A ray grazing the edge of the triangle
+//can miss it by rounding, those fall back to a full traversal.
+bool intersect_visible(const Ray ray, const uint blas, const uint triangle, inout HitInfo hitInfo) {
+    hitInfo.blas = blas;
+    BLASInstance b = blas_instances[blas];
+    Ray b_ray;
+    b_ray.o = (b.inverse_transform * vec4(ray.o, 1.0)).xyz;
+    b_ray.d = (b.inverse_transform * vec4(ray.d, 0.0)).xyz;
+    b_ray.rD = 1.0 / b_ray.d;
+    if (intersectTriangle(b_ray, triangle, hitInfo))
+        return true;
+    return ray_trace_tlas(ray, hitInfo);
+}
+
+#ifdef HYBRID_PRIMARY
+//the primary hit of the pixel in seed from the rasterized visibility buffer
+bool primary_hit(const Ray ray, const uvec2 seed, inout HitInfo hitInfo) {
+    uvec2 visibility = imageLoad(visibilityBuffer, ivec2(seed.x & 0xFFFFu, seed.x >> 16)).xy;
+    if (visibility.x == 0)
+        return false;
+    return intersect_visible(ray, visibility.x - 1, visibility.y, hitInfo);
+}
+#else
+ivec2 primary_cache_texel(const uvec2 seed) {
+    uint slot = seed.y % PRIMARY_CACHE;
+    return ivec2(seed.x & 0xFFFFu, (seed.x >> 16) + slot * uint(params.height));
+}
+
+//the primary hit of the sample in seed, looked up in the cache if this jitter position was traced since the
+//camera or scene last changed, traced and stored otherwise
+bool primary_hit(const Ray ray, const uvec2 seed, inout HitInfo hitInfo) {
+    ivec2 texel = primary_cache_texel(seed);
+    uint generation = camera.primary_cache_generation;
+    uvec2 cached = imageLoad(primaryCache, texel).xy;
+    if (generation != 0 && (cached.x >> 16) == generation) {
+        uint instance = cached.x & 0xFFFFu;
+        return instance != 0 && intersect_visible(ray, instance - 1, cached.y, hitInfo);
+    }
+    bool hit = ray_trace_tlas(ray, hitInfo);
+    if (generation != 0)
+        imageStore(primaryCache, texel, uvec4((hit ? hitInfo.blas + 1 : 0) | (generation << 16), hitInfo.triangle, 0, 0));
+    return hit;
+}
+#endif
+
+bool trace_primary(const Ray ray, const uvec2 seed, out ShadingInfo s) {
+    HitInfo hitInfo;
+    hitInfo.t = 1e9;
+    hitInfo.steps = 0;
+    if (primary_hit(ray, seed, hitInfo)) {
+        finalize_hit(ray, hitInfo);
+        s = get_shading_data(hitInfo);
+        return true;
+    }
+    s.emission = sampleSky(ray.d);
+    return false;
+}
+#endif
+
+vec3 path_trace(Ray ray, const uvec2 seed, out float depth) {
     depth = camera.far;
     vec3 radiance = vec3(0.0);
     vec3 throughput = vec3(1.0f);
+    float brdf_pdf = 0.0; //density of the last brdf sample
     // [[unroll]]
-    for (int i = 0; i < 5; i++) {
+    for (int i = 0; i < MAX_BOUNCES; i++) {
         ShadingInfo s;
+#if defined(HYBRID_PRIMARY) || defined(PRIMARY_CACHE)
+        bool hit = i == 0 ? trace_primary(ray, seed, s) : ray_trace(ray, s);
+#else
         bool hit = ray_trace(ray, s);
+#endif
+#ifdef ENVIRONMENT_MAP
+        if (!hit)
+            s.emission *= environment_hit_weight(ray.d, brdf_pdf);
+#endif
+#ifdef RESTIR_DI
+        if (hit && i == 1)
+            s.emission = vec3(0.0); //direct light of the primary hit comes from the reservoirs
+        if (!hit && i == 0)
+            restir_clear(seed);
+#endif
         radiance += throughput * s.emission;
+#ifdef GBUFFER_OUTPUT
+        if (i == 0)
+            write_gbuffer(seed, hit, s);
+#endif
+#ifdef MOTION_VECTORS
+        if (i == 0)
+            write_motion_vector(seed, hit, s, ray.d);
+#endif
         if(hit) {
             if(i == 0)
                 depth = length(s.position - ray.o);
 
+#ifdef ENVIRONMENT_MAP
+            radiance += throughput * sample_environment_light(s, seed, i);
+#endif
+#ifdef RESTIR_DI
+            if (i == 0)
+                radiance += restir_direct_light(s, seed);
+#endif
+
 			ray.o = s.position + s.normal * 0.001;
-			ray.d = sample_brdf(s, pcg2d(seed));
+			ray.d = sample_brdf(s, sample_1d(seed, bounce_dimension(i, DIMENSION_LOBE)),
+			                    sample_2d(seed, bounce_dimension(i, DIMENSION_DIRECTION)));
             ray.rD = 1.0 / ray.d;
 
 			float density = get_brdf_density(s, ray.d);
+			brdf_pdf = density;
 			float lambert_in = dot(s.normal, ray.d);
 			if (lambert_in <= 0.0)
 				break;
@@ -401,36 +1053,496 @@ vec3 path_trace(Ray ray, inout uvec2 seed, out float depth) {
 }
 
 
-layout(local_size_x = 32, local_size_y = 32, local_size_z = 1) in;
-void main() {
-    ivec2 pos = ivec2(gl_GlobalInvocationID.xy);
-    if (pos.x >= params.width || pos.y >= params.height) return;
-    // uvec2 seed = uvec2(gl_GlobalInvocationID.xy) ^ uvec2(camera.frame_index << 16, (camera.frame_index + 2378756348) << 16);
-    uvec2 seed = prng_seed(gl_GlobalInvocationID.xy, camera.frame_index);
+#ifdef RAY_SORTING
+// ----------------------------------- RAY SORTING -----------------------------------
+// After every traversal the hits of a workgroup are grouped by material, and after every shading step the
+// continuation rays are grouped by direction octant and origin morton code. Paths are exchanged between invocations
+// through shared memory, terminated paths sort to the back such that the active ones are compacted as well.
+
+#define SORT_GROUP_SIZE (LOCAL_SIZE_X * LOCAL_SIZE_Y)
+#define SORT_BINS SORT_GROUP_SIZE //one bin per invocation during the prefix sum
+#define SORT_KEY_MISS (SORT_BINS - 2)
+#define SORT_KEY_TERMINATED (SORT_BINS - 1)
+#if SORT_GROUP_SIZE < 32
+#error ray sorting needs at least 32 invocations per workgroup, see PathTracingCamera::clamp_workgroup_size
+#endif
+#define SORT_DIRECTION 0
+#define SORT_MATERIAL 1
+
+#define PATH_TERMINATED 0x80000000u
+#define PATH_INVALID 0xFFFFFFFFu
+
+struct PathState {
+    Ray ray;
+    vec3 throughput;
+    vec3 radiance;
+    uvec2 seed;
+    uint pixel; // x | y << 16, PATH_TERMINATED is set once the path stops bouncing
+    float depth;
+    float brdf_pdf; // density of the last brdf sample, 0 for camera rays
+};
+
+shared uint sort_bins[SORT_BINS];
+shared uint sort_keys[SORT_GROUP_SIZE];
+shared uint sort_order[SORT_GROUP_SIZE];
+shared vec4 sort_exchange[SORT_GROUP_SIZE];
+shared uint sort_statistics[6]; //sorted rays, coherent before, coherent after; for both sort kinds
+
+uint direction_sort_key(const Ray ray) {
+    uint octant = (ray.d.x < 0.0 ? 1u : 0u) | (ray.d.y < 0.0 ? 2u : 0u) | (ray.d.z < 0.0 ? 4u : 0u);
+    TLASNode root = tlas_nodes[0];
+    vec3 extent = max(root.aabbMax - root.aabbMin, vec3(1e-6));
+    uvec3 cell = uvec3(clamp((ray.o - root.aabbMin) / extent, 0.0, 0.999) * 4.0);
+    uint morton = (cell.x & 1u) | ((cell.y & 1u) << 1) | ((cell.z & 1u) << 2)
+                | ((cell.x & 2u) << 2) | ((cell.y & 2u) << 3) | ((cell.z & 2u) << 4);
+    // small workgroups have fewer bins, drop the finest morton bits first
+    uint shift = 0;
+    while ((512u >> shift) > SORT_KEY_MISS)
+        shift++;
+    return ((octant << 6) | morton) >> shift;
+}
+
+uint material_sort_key(const HitInfo h) {
+    uint material = blas_instances[h.blas].materials[triangles_data[h.triangle].materialIndex];
+    return min(material, SORT_KEY_MISS - 1);
+}
+
+//lanes of the same subgroup with the same key, the last lane of a subgroup has no neighbour
+bool is_coherent(const uint lane, const uint key, const uint neighbour_key) {
+    return lane % gl_SubgroupSize != gl_SubgroupSize - 1u && key < SORT_KEY_MISS && key == neighbour_key;
+}
+
+//counting sort of the workgroup on key. Returns the invocation whose path this invocation continues with.
+uint sort_group(const uint key, const uint kind) {
+    uint lane = gl_LocalInvocationIndex;
+    sort_bins[lane] = 0;
+    sort_keys[lane] = key;
+    barrier();
+    uint rank = atomicAdd(sort_bins[key], 1);
+    if (key < SORT_KEY_MISS) atomicAdd(sort_statistics[kind], 1);
+    if (is_coherent(lane, key, sort_keys[min(lane + 1, SORT_GROUP_SIZE - 1)])) atomicAdd(sort_statistics[2 + kind], 1);
+    barrier();
+
+    // inclusive prefix sum over the bins
+    for (uint offset = 1; offset < SORT_BINS; offset <<= 1) {
+        uint value = lane >= offset ? sort_bins[lane - offset] : 0;
+        barrier();
+        sort_bins[lane] += value;
+        barrier();
+    }
+    sort_order[sort_bins[key] - 1 - rank] = lane;
+    barrier();
+
+    uint source = sort_order[lane];
+    uint neighbour = sort_order[min(lane + 1, SORT_GROUP_SIZE - 1)];
+    if (is_coherent(lane, sort_keys[source], sort_keys[neighbour])) atomicAdd(sort_statistics[4 + kind], 1);
+    return source;
+}
+
+vec4 exchange(const vec4 value, const uint source) {
+    sort_exchange[gl_LocalInvocationIndex] = value;
+    barrier();
+    vec4 result = sort_exchange[source];
+    barrier();
+    return result;
+}
+
+PathState exchange_path(const PathState p, const uint source) {
+    vec4 a = exchange(vec4(p.ray.o, p.depth), source);
+    vec4 b = exchange(vec4(p.ray.d, uintBitsToFloat(p.pixel)), source);
+    vec4 c = exchange(vec4(p.throughput, uintBitsToFloat(p.seed.x)), source);
+    vec4 d = exchange(vec4(p.radiance, uintBitsToFloat(p.seed.y)), source);
+    PathState result;
+#ifdef ENVIRONMENT_MAP
+    result.brdf_pdf = exchange(vec4(p.brdf_pdf), source).x;
+#else
+    result.brdf_pdf = 0.0;
+#endif
+    result.ray.o = a.xyz;
+    result.ray.d = b.xyz;
+    result.ray.rD = 1.0 / b.xyz;
+    result.depth = a.w;
+    result.pixel = floatBitsToUint(b.w);
+    result.throughput = c.xyz;
+    result.radiance = d.xyz;
+    result.seed = uvec2(floatBitsToUint(c.w), floatBitsToUint(d.w));
+    return result;
+}
+
+//only the traversal output is exchanged, the rest is derived by finalize_hit afterwards
+HitInfo exchange_hit(const HitInfo h, const uint source) {
+    vec4 a = exchange(vec4(uintBitsToFloat(h.blas), uintBitsToFloat(h.triangle), h.barycentrics), source);
+    vec4 b = exchange(vec4(h.t), source);
+    HitInfo result;
+    result.blas = floatBitsToUint(a.x);
+    result.triangle = floatBitsToUint(a.y);
+    result.barycentrics = a.zw;
+    result.t = b.x;
+    result.steps = 0;
+    return result;
+}
+
+//same as path_trace, but every invocation of the workgroup runs all bounces such that paths can be exchanged.
+void path_trace_sorted(inout PathState p) {
+    for (int i = 0; i < MAX_BOUNCES; i++) {
+        bool active = (p.pixel & PATH_TERMINATED) == 0;
+        HitInfo hitInfo;
+        hitInfo.t = 1e9;
+        hitInfo.steps = 0;
+#if defined(HYBRID_PRIMARY) || defined(PRIMARY_CACHE)
+        bool hit = active && (i == 0 ? primary_hit(p.ray, p.seed, hitInfo) : ray_trace_tlas(p.ray, hitInfo));
+#else
+        bool hit = active && ray_trace_tlas(p.ray, hitInfo);
+#endif
+
+        // group hits by material
+        uint source = sort_group(!active ? SORT_KEY_TERMINATED : hit ? material_sort_key(hitInfo) : SORT_KEY_MISS, SORT_MATERIAL);
+        uint key = sort_keys[source];
+        p = exchange_path(p, source);
+        hitInfo = exchange_hit(hitInfo, source);
+
+        if (key == SORT_KEY_MISS) {
+#ifdef ENVIRONMENT_MAP
+            p.radiance += p.throughput * sampleSky(p.ray.d) * environment_hit_weight(p.ray.d, p.brdf_pdf);
+#else
+            p.radiance += p.throughput * sampleSky(p.ray.d);
+#endif
+#ifdef RESTIR_DI
+            if (i == 0)
+                restir_clear(p.seed);
+#endif
+#ifdef GBUFFER_OUTPUT
+            if (i == 0) {
+                ShadingInfo none;
+                write_gbuffer(p.seed, false, none);
+            }
+#endif
+#ifdef MOTION_VECTORS
+            if (i == 0) {
+                ShadingInfo none;
+                write_motion_vector(p.seed, false, none, p.ray.d);
+            }
+#endif
+            p.pixel |= PATH_TERMINATED;
+        } else if (key < SORT_KEY_MISS) {
+            finalize_hit(p.ray, hitInfo);
+            ShadingInfo s = get_shading_data(hitInfo);
+#ifdef RESTIR_DI
+            if (i == 1)
+                s.emission = vec3(0.0); //direct light of the primary hit comes from the reservoirs
+#endif
+            p.radiance += p.throughput * s.emission;
+            if(i == 0)
+                p.depth = length(s.position - p.ray.o);
+#ifdef GBUFFER_OUTPUT
+            if (i == 0)
+                write_gbuffer(p.seed, true, s);
+#endif
+#ifdef MOTION_VECTORS
+            if (i == 0)
+                write_motion_vector(p.seed, true, s, p.ray.d);
+#endif
+#ifdef ENVIRONMENT_MAP
+            p.radiance += p.throughput * sample_environment_light(s, p.seed, i);
+#endif
+#ifdef RESTIR_DI
+            if (i == 0)
+                p.radiance += restir_direct_light(s, p.seed);
+#endif
+
+            p.ray.o = s.position + s.normal * 0.001;
+            p.ray.d = sample_brdf(s, sample_1d(p.seed, bounce_dimension(i, DIMENSION_LOBE)),
+                                  sample_2d(p.seed, bounce_dimension(i, DIMENSION_DIRECTION)));
+            p.ray.rD = 1.0 / p.ray.d;
+
+            float density = get_brdf_density(s, p.ray.d);
+            p.brdf_pdf = density;
+            float lambert_in = dot(s.normal, p.ray.d);
+            if (lambert_in <= 0.0)
+                p.pixel |= PATH_TERMINATED;
+            else
+                p.throughput *= brdf(s, p.ray.d) * lambert_in / density;
+        }
+        if (i == MAX_BOUNCES - 1)
+            break;
+
+        // group continuation rays by direction and origin
+        active = (p.pixel & PATH_TERMINATED) == 0;
+        source = sort_group(active ? direction_sort_key(p.ray) : SORT_KEY_TERMINATED, SORT_DIRECTION);
+        p = exchange_path(p, source);
+    }
+}
+#endif
+
+void write_statistics(const uint invocation_paths_traced) {
+    uint rays = subgroupAdd(invocation_rays_traced);
+    uint paths = subgroupAdd(invocation_paths_traced);
+    if (subgroupElect()) {
+        atomicAdd(statistics.rays_traced, rays);
+        atomicAdd(statistics.paths_traced, paths);
+    }
+}
+
+//the traced fraction of the candidates is the sample density the frame actually got
+void count_candidate(const bool candidate) {
+    uint candidates = subgroupAdd(candidate ? 1u : 0u);
+    if (subgroupElect())
+        atomicAdd(statistics.candidate_pixels, candidates);
+}
+
+layout(local_size_x = LOCAL_SIZE_X, local_size_y = LOCAL_SIZE_Y, local_size_z = 1) in;
+
+#ifdef INTERLEAVE
+// Only one pixel of every cell of INTERLEAVE pixels is traced per frame, alternating over the frames. The dispatch
+// covers the traced pixels only, the others get alpha 0 for InterleaveReconstruction and the accumulation.
+#if INTERLEAVE == 2
+#define CELL_SIZE ivec2(2, 1)
+#else
+#define CELL_SIZE ivec2(2, 2)
+#endif
+
+ivec2 interleave_offset() {
+#if INTERLEAVE == 2
+    return ivec2(camera.frame_index & 1u, 0);
+#else
+    const ivec2 offsets[4] = ivec2[](ivec2(0, 0), ivec2(1, 1), ivec2(1, 0), ivec2(0, 1));
+    return offsets[camera.frame_index & 3u];
+#endif
+}
+
+ivec2 invocation_pixel() {
+    ivec2 id = ivec2(gl_GlobalInvocationID.xy);
+    ivec2 offset = interleave_offset();
+#if INTERLEAVE == 2
+    offset.x ^= id.y & 1; //alternate the columns between rows
+#endif
+    return id * CELL_SIZE + offset;
+}
+
+//invocation that traces the pixel this frame
+ivec2 pixel_invocation(const ivec2 pos) {
+    return pos / CELL_SIZE;
+}
+
+//marks the pixels of the cell that are not traced this frame, pos itself may lie outside the screen
+void skip_interleaved(const ivec2 pos) {
+    ivec2 cell = pixel_invocation(pos) * CELL_SIZE;
+    for (int i = 0; i < CELL_SIZE.x * CELL_SIZE.y; i++) {
+        ivec2 p = cell + ivec2(i % CELL_SIZE.x, i / CELL_SIZE.x);
+        if (p != pos && p.x < params.width && p.y < params.height)
+            imageStore(outputImage, p, vec4(0.0));
+    }
+}
+#else
+ivec2 invocation_pixel() {
+    return ivec2(gl_GlobalInvocationID.xy) + params.tile_offset;
+}
 
-    vec2 screenPos = vec2(pos + box_muller(pcg2d(seed) * 0.25)) / vec2(params.width, params.height) * 2.0 - 1.0;
+ivec2 pixel_invocation(const ivec2 pos) {
+    return pos;
+}
+#endif
+
+Ray camera_ray(const ivec2 pos, const uvec2 seed) {
+    //box filtered jitter within the pixel, in hybrid mode one position per frame that the rasterizer shares,
+    //with the primary cache one of a fixed set of positions along the R2 sequence
+#if defined(HYBRID_PRIMARY)
+    vec2 jitter = camera.jitter;
+#elif defined(PRIMARY_CACHE)
+    vec2 jitter = fract(0.5 + float(seed.y % PRIMARY_CACHE) * vec2(0.7548776662, 0.5698402910));
+#else
+    vec2 jitter = sample_2d(seed, DIMENSION_CAMERA);
+#endif
+    vec2 screenPos = (vec2(pos) + jitter) / vec2(params.width, params.height) * 2.0 - 1.0;
     vec4 ndcPos = vec4(screenPos.x, -screenPos.y, 1.0, 1.0);
     vec4 worldPos = camera.ivp * ndcPos;
     worldPos /= worldPos.w;
 
-    // Light light = {vec4(0.0, 4.0, 0.0, 1.0), vec4(1.0, 1.0, 1.0, 1.0);
     Ray ray;
     ray.o = camera.position.xyz;
-
     ray.d = normalize(worldPos.xyz - camera.position.xyz);
     ray.rD = 1.0 / ray.d;
-    float depth = camera.far;
-#ifdef DEBUG_STEPS
-    ShadingInfo s;
-    ray_trace(ray, s);
-    vec3 radiance = s.emission;
+    return ray;
+}
+
+//true if this pixel can be skipped this frame. Converged pixels are still sampled every 16th frame,
+//such that falsely converged pixels recover.
+#if defined(SAMPLE_DENSITY_RADIAL) || defined(SAMPLE_DENSITY_TEXTURE)
+float sample_density(const ivec2 pos) {
+#ifdef SAMPLE_DENSITY_RADIAL
+    vec2 offset = (vec2(pos) + 0.5) / vec2(params.width, params.height) - params.gaze;
+    offset.x *= float(params.width) / float(params.height);
+    return mix(1.0, params.min_density, smoothstep(params.fovea_radius, params.periphery_radius, length(offset)));
+#else
+    return max(imageLoad(sampleDensity, pos).r, params.min_density);
 #endif
-#ifndef DEBUG_STEPS
-    vec3 radiance = path_trace(ray, seed, depth);
+}
+
+//a pixel is traced with the probability of its density. The blue-noise rank of the pixel advances along the golden
+//ratio every frame, such that the traced pixels are spread evenly in space and over the frames.
+bool density_skip(const ivec2 pos) {
+    float rank = imageLoad(blueNoise, pos % imageSize(blueNoise)).r;
+    return fract(rank + to_unit_float(uvec2(camera.frame_index * 2654435769u)).x) >= sample_density(pos);
+}
+#endif
+
+bool skip_pixel(const ivec2 pos) {
+#if defined(SAMPLE_DENSITY_RADIAL) || defined(SAMPLE_DENSITY_TEXTURE)
+    if (density_skip(pos))
+        return true;
+#endif
+#ifdef ADAPTIVE_SAMPLING
+    return camera.use_sample_mask != 0 && (camera.frame_index & 15u) != 0 && imageLoad(sampleMask, pos).r < 0.5;
+#else
+    return false;
 #endif
+}
+
+void write_pixel(const ivec2 pos, const vec3 radiance, float depth) {
     //non-linear reversed-Z depth buffer
     depth = camera.far / (camera.far - camera.near) * (1.0 - camera.near / depth);
     // depth = (depth - camera.near) / (camera.far - camera.near) * 2.0f - 1.0f;
     imageStore(outputImage, pos, vec4(radiance, 1.0));
     imageStore(depthBuffer, pos, vec4(depth, 0.0, 0.0, 0.0));
 }
+
+//sampler state of one of the samples_per_frame samples of a pixel, every sample of a pixel has its own index
+uvec2 sample_seed(const ivec2 pos, const uint sample_index) {
+    return sampler_init(pos, camera.sample_frame * params.samples_per_frame + sample_index);
+}
+
+#if defined(RAY_SORTING) && !defined(DEBUG_STEPS)
+//sorting moved the path to another invocation, return its result to the invocation that owns the pixel.
+vec4 gather_result(const PathState p) {
+    if (p.pixel != PATH_INVALID) {
+        uint pixel = p.pixel & ~PATH_TERMINATED;
+        ivec2 invocation = pixel_invocation(ivec2(pixel & 0xFFFF, pixel >> 16));
+        uint lane = (invocation.y % LOCAL_SIZE_Y) * LOCAL_SIZE_X + invocation.x % LOCAL_SIZE_X;
+        sort_exchange[lane] = vec4(p.radiance, p.depth);
+    }
+    barrier();
+    vec4 result = sort_exchange[gl_LocalInvocationIndex];
+    barrier();
+    return result;
+}
+
+void main() {
+    // no early out here, every invocation has to take part in the sorting barriers
+    ivec2 pos = invocation_pixel();
+#ifdef INTERLEAVE
+    skip_interleaved(pos);
+#endif
+    if (gl_LocalInvocationIndex < 6)
+        sort_statistics[gl_LocalInvocationIndex] = 0;
+
+    bool valid = pos.x < params.width && pos.y < params.height;
+    count_candidate(valid);
+    //skipped paths are sorted out of the way with the terminated ones, such that they do not hold up the bounces
+    if (valid && skip_pixel(pos)) {
+        imageStore(outputImage, pos, vec4(0.0)); //alpha 0: no new sample
+        valid = false;
+    }
+    barrier();
+
+    vec3 radiance = vec3(0.0);
+    float depth = camera.far;
+    for (uint i = 0; i < params.samples_per_frame; i++) {
+        PathState p;
+        p.seed = sample_seed(pos, i);
+        p.ray = camera_ray(pos, p.seed);
+        p.throughput = vec3(1.0f);
+        p.radiance = vec3(0.0);
+        p.depth = camera.far;
+        p.brdf_pdf = 0.0;
+        p.pixel = valid ? uint(pos.x) | (uint(pos.y) << 16) : PATH_INVALID;
+
+        path_trace_sorted(p);
+
+        vec4 result = gather_result(p);
+        radiance += result.rgb;
+        if (i == 0)
+            depth = result.w;
+    }
+
+    if (valid)
+        write_pixel(pos, radiance / params.samples_per_frame, depth);
+    write_statistics(valid ? params.samples_per_frame : 0u);
+
+    barrier();
+    if (gl_LocalInvocationIndex < 2) {
+        uint kind = gl_LocalInvocationIndex;
+        atomicAdd(statistics.sorted_rays[kind], sort_statistics[kind]);
+        atomicAdd(statistics.coherent_before[kind], sort_statistics[2 + kind]);
+        atomicAdd(statistics.coherent_after[kind], sort_statistics[4 + kind]);
+    }
+}
+#else
+#if defined(SAMPLE_DENSITY_RADIAL) || defined(SAMPLE_DENSITY_TEXTURE) || defined(ADAPTIVE_SAMPLING)
+#define COMPACT_PIXELS
+//the pixels of the workgroup that are traced this frame, packed to the first invocations. At a low sample density
+//whole subgroups retire right away instead of each tracing a few scattered pixels, such that the cost of a
+//workgroup scales with the number of pixels it traces.
+shared uint traced_pixels[LOCAL_SIZE_X * LOCAL_SIZE_Y];
+shared uint traced_count;
+#endif
+
+void trace_pixel(const ivec2 pos) {
+    // several camera samples per dispatch, accumulated in registers before a single store
+    vec3 radiance = vec3(0.0);
+    float depth = camera.far;
+    for (uint i = 0; i < params.samples_per_frame; i++) {
+        uvec2 seed = sample_seed(pos, i);
+
+        // Light light = {vec4(0.0, 4.0, 0.0, 1.0), vec4(1.0, 1.0, 1.0, 1.0);
+        Ray ray = camera_ray(pos, seed);
+        float sample_depth = camera.far;
+#ifdef DEBUG_STEPS
+        ShadingInfo s;
+        ray_trace(ray, s);
+        radiance += s.emission;
+#endif
+#ifndef DEBUG_STEPS
+        radiance += path_trace(ray, seed, sample_depth);
+#endif
+        if (i == 0)
+            depth = sample_depth;
+    }
+    write_pixel(pos, radiance / params.samples_per_frame, depth);
+    write_statistics(params.samples_per_frame);
+}
+
+void main() {
+    ivec2 pos = invocation_pixel();
+#ifdef INTERLEAVE
+    skip_interleaved(pos);
+#endif
+    bool traced = pos.x < params.width && pos.y < params.height;
+    count_candidate(traced);
+    if (traced && skip_pixel(pos)) {
+        imageStore(outputImage, pos, vec4(0.0)); //alpha 0: no new sample
+        traced = false;
+    }
+#ifdef COMPACT_PIXELS
+    if (gl_LocalInvocationIndex == 0)
+        traced_count = 0;
+    barrier();
+    //neighbouring pixels stay next to each other within a subgroup, for coherent primary rays
+    uint rank = subgroupExclusiveAdd(traced ? 1u : 0u);
+    uint subgroup_count = subgroupAdd(traced ? 1u : 0u);
+    uint first = 0;
+    if (subgroupElect())
+        first = atomicAdd(traced_count, subgroup_count);
+    first = subgroupBroadcastFirst(first);
+    if (traced)
+        traced_pixels[first + rank] = uint(pos.x) | (uint(pos.y) << 16);
+    barrier();
+    if (gl_LocalInvocationIndex >= traced_count)
+        return;
+    uint pixel = traced_pixels[gl_LocalInvocationIndex];
+    trace_pixel(ivec2(pixel & 0xFFFFu, pixel >> 16));
+#else
+    if (traced)
+        trace_pixel(pos);
+#endif
+}
+#endif
@@ -1,46 +1,116 @@
 #[compute]
 #version 460
+#extension GL_KHR_shader_subgroup_basic : enable
+#extension GL_KHR_shader_subgroup_arithmetic : enable
 
-//in/out image
-layout(set = 0, binding = 1, rgba8) restrict uniform image2D screenTexture;
+#ifndef LOCAL_SIZE_X
+#define LOCAL_SIZE_X 32
+#define LOCAL_SIZE_Y 32
+#endif
+
+//in/out image, receives the linear average. Tonemapping is a later stage.
+layout(set = 0, binding = 1, rgba32f) restrict uniform image2D screenTexture;
 // layout(set = 0, binding = 1) restrict buffer ScreenTexture{
 //     float screenTexture[];
 // };
 
-layout(set = 0, binding = 2, rgba32f) restrict uniform image2D frameBuffer;
+#ifdef ACCUMULATION_HALF
+//half precision keeps running means instead of sums, with Kahan compensation of the mean update such that updates
+//below the precision of the mean are not lost in long runs
+layout(set = 0, binding = 2, rgba16f) restrict uniform image2D frameBuffer; //rgb: mean radiance, a: sample count
+layout(set = 0, binding = 3, rgba16f) restrict uniform image2D momentBuffer; //rgb: compensation of the mean, a: mean squared luminance
+//largest count fp16 increments exactly. Beyond it the mean becomes a moving average over the last 2048 samples, such
+//that the noise stops falling: use full precision accumulation for longer renders.
+#define MAX_HALF_COUNT 2048.0
+#define MAX_HALF 65504.0
+
+//the value an rgba16f image stores
+vec3 round_half(const vec3 v) {
+    return vec3(unpackHalf2x16(packHalf2x16(v.xy)), unpackHalf2x16(packHalf2x16(vec2(v.z, 0.0))).x);
+}
+#else
+layout(set = 0, binding = 2, rgba32f) restrict uniform image2D frameBuffer; //rgb: radiance sum, a: sample count
+layout(set = 0, binding = 3, r32f) restrict uniform image2D momentBuffer; //sum of squared luminance
+#endif
+layout(set = 0, binding = 4, r8) restrict uniform writeonly image2D sampleMask;
 
 layout(std430, set = 0, binding = 0) restrict buffer Params {
     uint width;
     uint height;
     uint frame_count;
+    float threshold; //relative error below which a pixel is converged, 0 disables adaptive sampling
+    uint min_samples;
+    uint active_pixels; //pixels that still need samples, reset by the cpu every frame
 };
 
-// ACES approximation from https://knarkowicz.wordpress.com/2016/01/06/aces-filmic-tone-mapping-curve/
-vec3 acesFilm(vec3 x) {
-    const float a = 2.51;
-    const float b = 0.03;
-    const float c = 2.43;
-    const float d = 0.59;
-    const float e = 0.14;
-    return clamp((x * (a * x + b)) / (x * (c * x + d) + e), 0.0, 1.0);
+float luminance(vec3 color) {
+    return dot(color, vec3(0.2126, 0.7152, 0.0722));
 }
 
-layout(local_size_x = 32, local_size_y = 32, local_size_z = 1) in;
+layout(local_size_x = LOCAL_SIZE_X, local_size_y = LOCAL_SIZE_Y, local_size_z = 1) in;
 void main() {
     ivec2 pos = ivec2(gl_GlobalInvocationID.xy);
     if (pos.x >= width || pos.y >= height) return;
 
-    vec3 radiance = imageLoad(screenTexture, pos).rgb;
+    vec4 current = imageLoad(screenTexture, pos);
+#ifdef ACCUMULATION_HALF
+    vec4 accumulated = vec4(0.0); //mean, count
+    vec4 compensation = vec4(0.0); //compensation, mean squared luminance
     if(frame_count > 1) {
-        radiance += imageLoad(frameBuffer, pos).rgb;
+        accumulated = imageLoad(frameBuffer, pos);
+        compensation = imageLoad(momentBuffer, pos);
+    }
+    if(current.a > 0.5) { //alpha 0 means the pixel was skipped this frame
+        float n = min(accumulated.a + 1.0, MAX_HALF_COUNT);
+        float l = luminance(current.rgb);
+        vec3 y = (current.rgb - accumulated.rgb) / n - compensation.rgb;
+        vec3 t = round_half(accumulated.rgb + y);
+        //what was lost rounding the mean to half precision, subtracted from the next update
+        compensation.rgb = (t - accumulated.rgb) - y;
+        accumulated = vec4(t, n);
+        compensation.a = min(compensation.a + (l * l - compensation.a) / n, MAX_HALF);
+    }
+    //a restart also clears skipped pixels, such that the previous accumulation is not picked up later
+    if(current.a > 0.5 || frame_count <= 1) {
+        imageStore(frameBuffer, pos, accumulated);
+        imageStore(momentBuffer, pos, compensation);
     }
-    imageStore(frameBuffer, pos, vec4(radiance, 1.0));
 
-    vec3 avgRadiance = radiance / frame_count;
+    vec3 avgRadiance = accumulated.a > 0.0 ? accumulated.rgb : current.rgb;
+    float moment = compensation.a * accumulated.a;
+#else
+    vec4 accumulated = vec4(0.0);
+    float moment = 0.0;
+    if(frame_count > 1) {
+        accumulated = imageLoad(frameBuffer, pos);
+        moment = imageLoad(momentBuffer, pos).r;
+    }
+    if(current.a > 0.5) { //alpha 0 means the pixel was skipped this frame
+        float l = luminance(current.rgb);
+        accumulated += vec4(current.rgb, 1.0);
+        moment += l * l;
+    }
+    //a restart also clears skipped pixels, such that the previous accumulation is not picked up later
+    if(current.a > 0.5 || frame_count <= 1) {
+        imageStore(frameBuffer, pos, accumulated);
+        imageStore(momentBuffer, pos, vec4(moment));
+    }
 
-    float exposure = 1.0f;
+    vec3 avgRadiance = accumulated.a > 0.0 ? accumulated.rgb / accumulated.a : current.rgb;
+#endif
 
-    vec3 color = acesFilm(avgRadiance * exposure);
+    // a pixel is converged once the standard error of its mean luminance is small relative to the mean
+    bool converged = false;
+    if(threshold > 0.0 && accumulated.a >= min_samples) {
+        float mean = luminance(avgRadiance);
+        float variance = max(moment / accumulated.a - mean * mean, 0.0);
+        converged = sqrt(variance / accumulated.a) <= threshold * (mean + 0.05);
+    }
+    imageStore(sampleMask, pos, vec4(converged ? 0.0 : 1.0));
+    uint active = subgroupAdd(converged ? 0u : 1u);
+    if(subgroupElect())
+        atomicAdd(active_pixels, active);
 
-    imageStore(screenTexture, pos, vec4(color, 1.0));
+    //pixels without samples keep what an earlier stage filled in, e.g. InterleaveReconstruction
+    imageStore(screenTexture, pos, vec4(avgRadiance, 1.0));
 }
\ No newline at end of file
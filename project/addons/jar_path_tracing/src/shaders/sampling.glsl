@@ -0,0 +1,111 @@
+// ----------------------------------- SAMPLING -----------------------------------
+// Every random decision of a path reads its own dimension, such that a low-discrepancy sampler stratifies each
+// decision on its own. The sampler state is the pixel (x | y << 16) and the sample index. Variants:
+// SAMPLER_SOBOL: Owen-scrambled Sobol, shuffled per pixel and dimension (Burley 2020, https://jcgt.org/published/0009/04/01/)
+// SAMPLER_BLUE_NOISE: tiled blue-noise mask offset per dimension, rotated along the R2 sequence over the samples
+// otherwise: white noise from pcg2d
+
+#define DIMENSION_CAMERA 0 //pixel jitter
+#define DIMENSION_BOUNCE 1 //first dimension of the first bounce
+#define DIMENSIONS_PER_BOUNCE 3
+//decisions within a bounce
+#define DIMENSION_LOBE 0
+#define DIMENSION_DIRECTION 1
+#define DIMENSION_LIGHT 2
+
+uint bounce_dimension(const int bounce, const uint decision) {
+    return DIMENSION_BOUNCE + uint(bounce) * DIMENSIONS_PER_BOUNCE + decision;
+}
+
+uvec2 sampler_init(const ivec2 pos, const uint sample_index) {
+    return uvec2(uint(pos.x) | (uint(pos.y) << 16), sample_index);
+}
+
+// lowbias32 from https://nullprogram.com/blog/2018/07/31/
+uint hash_uint(uint x) {
+    x ^= x >> 16;
+    x *= 0x7feb352du;
+    x ^= x >> 15;
+    x *= 0x846ca68bu;
+    x ^= x >> 16;
+    return x;
+}
+
+vec2 pcg2d(inout uvec2 seed) {
+	// PCG2D, as described here: https://jcgt.org/published/0009/03/02/
+	seed = 1664525u * seed + 1013904223u;
+	seed.x += 1664525u * seed.y;
+	seed.y += 1664525u * seed.x;
+	seed ^= (seed >> 16u);
+	seed.x += 1664525u * seed.y;
+	seed.y += 1664525u * seed.x;
+	seed ^= (seed >> 16u);
+	// Multiply by 2^-32 to get floats
+	return vec2(seed) * 2.32830643654e-10;
+}
+
+//24 bits of mantissa, such that the result stays below 1
+vec2 to_unit_float(const uvec2 bits) {
+    return vec2(bits >> 8) * (1.0 / 16777216.0);
+}
+
+#if defined(SAMPLER_SOBOL)
+//second Sobol dimension, the first one is the bit reversed index
+uint sobol_dimension1(uint index) {
+    uint result = 0u;
+    for (uint v = 1u << 31; index != 0u; index >>= 1, v ^= v >> 1)
+        if ((index & 1u) != 0u)
+            result ^= v;
+    return result;
+}
+
+uint laine_karras_permutation(uint x, const uint seed) {
+    x += seed;
+    x ^= x * 0x6c50b47cu;
+    x ^= x * 0xb82f1e52u;
+    x ^= x * 0xc7afe638u;
+    x ^= x * 0x8d22f6e6u;
+    return x;
+}
+
+uint nested_uniform_scramble(const uint x, const uint seed) {
+    return bitfieldReverse(laine_karras_permutation(bitfieldReverse(x), seed));
+}
+
+vec2 sobol_owen_2d(uint index, const uint seed) {
+    index = nested_uniform_scramble(index, seed); //shuffle, decorrelates the dimensions
+    uvec2 p = uvec2(bitfieldReverse(index), sobol_dimension1(index));
+    p.x = nested_uniform_scramble(p.x, hash_uint(seed ^ 0xa511e9b3u));
+    p.y = nested_uniform_scramble(p.y, hash_uint(seed ^ 0x63d83595u));
+    return to_unit_float(p);
+}
+#endif
+
+#if defined(SAMPLER_BLUE_NOISE)
+vec2 blue_noise_2d(const uvec2 state, const uint dimension) {
+    ivec2 size = imageSize(blueNoise);
+    ivec2 pos = ivec2(state.x & 0xFFFFu, state.x >> 16);
+    uint h = hash_uint(dimension + 0x9e3779b9u);
+    ivec2 offset = ivec2(h & 0xFFFFu, h >> 16);
+    float a = imageLoad(blueNoise, (pos + offset) % size).r;
+    float b = imageLoad(blueNoise, (pos + offset + size / 2) % size).r;
+    //R2 sequence in fixed point, 0.7548776662 and 0.5698402910 times 2^32
+    vec2 rotation = to_unit_float(state.y * uvec2(3242174889u, 2447445413u));
+    return fract(vec2(a, b) + rotation);
+}
+#endif
+
+vec2 sample_2d(const uvec2 state, const uint dimension) {
+#if defined(SAMPLER_SOBOL)
+    return sobol_owen_2d(state.y, hash_uint(state.x ^ hash_uint(dimension)));
+#elif defined(SAMPLER_BLUE_NOISE)
+    return blue_noise_2d(state, dimension);
+#else
+    uvec2 seed = state ^ uvec2(hash_uint(dimension));
+    return pcg2d(seed);
+#endif
+}
+
+float sample_1d(const uvec2 state, const uint dimension) {
+    return sample_2d(state, dimension).x;
+}
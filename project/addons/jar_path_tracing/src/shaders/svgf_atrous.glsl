@@ -0,0 +1,76 @@
+#[compute]
+#version 460
+
+#include "svgf_common.glsl"
+
+// One edge-aware a-trous wavelet pass of SVGF with a step of 2^iteration, reading filterPing on even and filterPong
+// on odd passes. The first pass becomes the history of the next frame, the last one is remodulated.
+
+vec4 load_source(const ivec2 pos) {
+    return (iteration & 1) == 0 ? imageLoad(filterPing, pos) : imageLoad(filterPong, pos);
+}
+
+//variance blurred with a 3x3 gaussian, such that the luminance edge stopping is less noisy
+float filtered_variance(const ivec2 pos) {
+    const float kernel[2] = float[2](0.25, 0.125);
+    float sum = 0.0;
+    float weight_sum = 0.0;
+    for (int y = -1; y <= 1; y++)
+        for (int x = -1; x <= 1; x++) {
+            ivec2 tap = pos + ivec2(x, y);
+            if (!inside(tap))
+                continue;
+            float w = kernel[abs(x)] * kernel[abs(y)];
+            sum += load_source(tap).a * w;
+            weight_sum += w;
+        }
+    return sum / weight_sum;
+}
+
+layout(local_size_x = LOCAL_SIZE_X, local_size_y = LOCAL_SIZE_Y, local_size_z = 1) in;
+void main() {
+    ivec2 pos = ivec2(gl_GlobalInvocationID.xy);
+    if (!inside(pos)) return;
+
+    vec4 center = load_source(pos);
+    vec3 normal = imageLoad(gNormal, pos).xyz;
+    float depth = imageLoad(gDepth, pos).r;
+    float l = luminance(center.rgb);
+    float sigma_l = phi_color * sqrt(max(filtered_variance(pos), 0.0)) + 1e-6;
+    int step_size = 1 << iteration;
+
+    const float kernel[3] = float[3](3.0 / 8.0, 1.0 / 4.0, 1.0 / 16.0);
+    vec4 sum = center * vec4(vec3(kernel[0] * kernel[0]), kernel[0] * kernel[0] * kernel[0] * kernel[0]);
+    float weight_sum = kernel[0] * kernel[0];
+    for (int y = -2; y <= 2; y++)
+        for (int x = -2; x <= 2; x++) {
+            ivec2 tap = pos + ivec2(x, y) * step_size;
+            if ((x == 0 && y == 0) || !inside(tap))
+                continue;
+            vec4 sample_value = load_source(tap);
+            float w_normal = pow(max(dot(normal, imageLoad(gNormal, tap).xyz), 0.0), phi_normal);
+            float w_depth = exp(-abs(depth - imageLoad(gDepth, tap).r) / (phi_depth * depth * length(vec2(x, y) * step_size) + 1e-6));
+            float w_color = exp(-abs(l - luminance(sample_value.rgb)) / sigma_l);
+            float w = kernel[abs(x)] * kernel[abs(y)] * w_normal * w_depth * w_color;
+            sum += sample_value * vec4(vec3(w), w * w); //variance is filtered with the squared weights
+            weight_sum += w;
+        }
+    vec4 filtered = sum / vec4(vec3(weight_sum), weight_sum * weight_sum);
+
+    if ((iteration & 1) == 0)
+        imageStore(filterPong, pos, filtered);
+    else
+        imageStore(filterPing, pos, filtered);
+
+    if (iteration == 0) {
+        // history for the next frame, the temporal pass has finished reading the previous one
+        vec4 moments = imageLoad(currentMoments, pos);
+        imageStore(historyColor, pos, vec4(filtered.rgb, moments.z));
+        imageStore(historyMoments, pos, moments);
+        imageStore(previousGBuffer, pos, vec4(normal, depth));
+    }
+    if (iteration == iterations - 1) {
+        vec3 color = filtered.rgb * max(imageLoad(gAlbedo, pos).rgb, vec3(0.01));
+        imageStore(screenTexture, pos, vec4(color, 1.0));
+    }
+}
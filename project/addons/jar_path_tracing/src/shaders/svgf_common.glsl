@@ -0,0 +1,45 @@
+// shared by the svgf passes, see SVGFDenoiser
+
+#ifndef LOCAL_SIZE_X
+#define LOCAL_SIZE_X 32
+#define LOCAL_SIZE_Y 32
+#endif
+
+layout(std430, set = 0, binding = 0) restrict buffer Params {
+    mat4 inverse_vp;
+    mat4 previous_vp;
+    vec4 camera_position;
+    int width;
+    int height;
+    int iteration; //current a-trous pass
+    int iterations;
+    float phi_color;
+    float phi_normal;
+    float phi_depth;
+    float alpha; //minimum weight of the current frame in the temporal accumulation
+};
+
+//path traced color and the G-buffer written by main.glsl
+layout(set = 0, binding = 1, rgba32f) restrict uniform image2D screenTexture;
+layout(set = 0, binding = 2, rgba16f) restrict uniform readonly image2D gNormal;
+layout(set = 0, binding = 3, rgba8) restrict uniform readonly image2D gAlbedo;
+layout(set = 0, binding = 4, r32f) restrict uniform readonly image2D gDepth;
+
+//history of the previous frame: filtered illumination and history length, moments, normal and depth
+#ifndef HISTORY_FORMAT
+#define HISTORY_FORMAT rgba32f //or rgba16f, the history length is kept in alpha
+#endif
+layout(set = 0, binding = 5, HISTORY_FORMAT) restrict uniform image2D historyColor;
+layout(set = 0, binding = 6, rgba32f) restrict uniform image2D historyMoments;
+layout(set = 0, binding = 7, rgba32f) restrict uniform image2D currentMoments; //moments, history length
+layout(set = 0, binding = 8, rgba32f) restrict uniform image2D filterPing; //illumination, variance
+layout(set = 0, binding = 9, rgba32f) restrict uniform image2D filterPong;
+layout(set = 0, binding = 10, rgba32f) restrict uniform image2D previousGBuffer; //normal, depth
+
+float luminance(const vec3 color) {
+    return dot(color, vec3(0.2126, 0.7152, 0.0722));
+}
+
+bool inside(const ivec2 pos) {
+    return pos.x >= 0 && pos.y >= 0 && pos.x < width && pos.y < height;
+}
@@ -0,0 +1,82 @@
+#[compute]
+#version 460
+
+#include "svgf_common.glsl"
+
+// Temporal pass of SVGF (Schied et al. 2017): the demodulated illumination and its first two luminance moments are
+// accumulated over the reprojected history, which gives a per pixel variance estimate for the a-trous passes.
+
+layout(local_size_x = LOCAL_SIZE_X, local_size_y = LOCAL_SIZE_Y, local_size_z = 1) in;
+void main() {
+    ivec2 pos = ivec2(gl_GlobalInvocationID.xy);
+    if (!inside(pos)) return;
+
+    vec3 albedo = imageLoad(gAlbedo, pos).rgb;
+    vec3 normal = imageLoad(gNormal, pos).xyz;
+    float depth = imageLoad(gDepth, pos).r;
+    vec3 illumination = imageLoad(screenTexture, pos).rgb / max(albedo, vec3(0.01));
+    float l = luminance(illumination);
+    vec2 moments = vec2(l, l * l);
+
+    // world position of the pixel centre, projected into the previous frame
+    vec2 ndc = (vec2(pos) + 0.5) / vec2(width, height) * 2.0 - 1.0;
+    vec4 target = inverse_vp * vec4(ndc.x, -ndc.y, 1.0, 1.0);
+    vec3 world = camera_position.xyz + normalize(target.xyz / target.w - camera_position.xyz) * depth;
+    vec4 previous_clip = previous_vp * vec4(world, 1.0);
+    vec2 previous_pixel = (previous_clip.xy / previous_clip.w * vec2(0.5, -0.5) + 0.5) * vec2(width, height) - 0.5;
+
+    // bilinear history, taps whose surface does not match are dropped
+    vec3 history = vec3(0.0);
+    vec2 history_moments = vec2(0.0);
+    float history_length = 0.0;
+    float weight_sum = 0.0;
+    ivec2 base = ivec2(floor(previous_pixel));
+    vec2 f = fract(previous_pixel);
+    bool has_normal = dot(normal, normal) > 0.0;
+    for (int i = 0; i < 4 && previous_clip.w > 0.0 && has_normal; i++) {
+        ivec2 tap = base + ivec2(i & 1, i >> 1);
+        if (!inside(tap))
+            continue;
+        vec4 previous = imageLoad(previousGBuffer, tap);
+        if (dot(previous.xyz, normal) < 0.9 || abs(previous.w - depth) > 0.1 * depth)
+            continue;
+        float w = ((i & 1) == 1 ? f.x : 1.0 - f.x) * ((i >> 1) == 1 ? f.y : 1.0 - f.y);
+        vec4 color = imageLoad(historyColor, tap);
+        history += color.rgb * w;
+        history_length += color.a * w;
+        history_moments += imageLoad(historyMoments, tap).xy * w;
+        weight_sum += w;
+    }
+
+    if (weight_sum > 0.01) {
+        history /= weight_sum;
+        history_moments /= weight_sum;
+        history_length = floor(history_length / weight_sum + 0.5) + 1.0;
+        float a = max(alpha, 1.0 / history_length);
+        illumination = mix(history, illumination, a);
+        moments = mix(history_moments, moments, a);
+    } else {
+        history_length = 1.0;
+    }
+
+    float variance = max(moments.y - moments.x * moments.x, 0.0);
+    if (history_length < 4.0) {
+        // too little history, estimate the variance from the 7x7 neighbourhood instead
+        vec2 spatial = vec2(0.0);
+        float count = 0.0;
+        for (int y = -3; y <= 3; y++)
+            for (int x = -3; x <= 3; x++) {
+                ivec2 tap = pos + ivec2(x, y);
+                if (!inside(tap))
+                    continue;
+                float tap_l = luminance(imageLoad(screenTexture, tap).rgb / max(imageLoad(gAlbedo, tap).rgb, vec3(0.01)));
+                spatial += vec2(tap_l, tap_l * tap_l);
+                count += 1.0;
+            }
+        spatial /= count;
+        variance = max(spatial.y - spatial.x * spatial.x, 0.0) * 4.0 / history_length;
+    }
+
+    imageStore(currentMoments, pos, vec4(moments, history_length, 0.0));
+    imageStore(filterPing, pos, vec4(illumination, variance));
+}
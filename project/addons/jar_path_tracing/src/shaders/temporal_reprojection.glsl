@@ -1,71 +1,95 @@
 #[compute]
 #version 460
 
+#ifndef LOCAL_SIZE_X
+#define LOCAL_SIZE_X 32
+#define LOCAL_SIZE_Y 32
+#endif
+
 layout(std430, set = 0, binding = 0) restrict buffer Params {
-    mat4 reprojectionMatrix;
     uint width;
     uint height;
     uint frameCount;
-    float blendFactor;
+    float blendFactor; //weight of the history
     float nearPlane;
     float farPlane;
+    uint pass; //0: blend into the history, 1: copy the history to the screen
 };
 
-layout(set = 0, binding = 1, rgba8) uniform image2D screenTexture;
-layout(set = 0, binding = 2, r32f) uniform readonly image2D depthTexture;
-layout(set = 0, binding = 3, rgba32f) uniform image2D frameBuffer1;
-layout(set = 0, binding = 4, rgba32f) uniform image2D frameBuffer2;
+layout(set = 0, binding = 1, rgba32f) uniform image2D screenTexture;
+layout(set = 0, binding = 2, rg16f) uniform readonly image2D motionVectors; //previous minus current position in pixels, written by main.glsl
+#ifndef HISTORY_FORMAT
+#define HISTORY_FORMAT rgba32f //rgba16f or r11f_g11f_b10f, see PostProcessContext::history_format
+#endif
+layout(set = 0, binding = 3, HISTORY_FORMAT) uniform image2D frameBuffer1;
+layout(set = 0, binding = 4, HISTORY_FORMAT) uniform image2D frameBuffer2;
+
+vec3 loadHistory(const ivec2 pos, const bool useFirstBuffer) {
+    return useFirstBuffer ? imageLoad(frameBuffer1, pos).rgb : imageLoad(frameBuffer2, pos).rgb;
+}
 
+// bilinear fetch of the history, taps outside the screen are left out
+vec3 sampleHistory(const vec2 position, const bool useFirstBuffer) {
+    vec2 p = position - 0.5;
+    ivec2 base = ivec2(floor(p));
+    vec2 f = fract(p);
+    vec3 sum = vec3(0.0);
+    float weightSum = 0.0;
+    for (int i = 0; i < 4; i++) {
+        ivec2 tap = base + ivec2(i & 1, i >> 1);
+        float w = ((i & 1) != 0 ? f.x : 1.0 - f.x) * ((i >> 1) != 0 ? f.y : 1.0 - f.y);
+        if (tap.x < 0 || tap.y < 0 || tap.x >= width || tap.y >= height || w <= 0.0)
+            continue;
+        sum += w * loadHistory(tap, useFirstBuffer);
+        weightSum += w;
+    }
+    return sum / weightSum;
+}
 
+vec3 rgbToYCoCg(const vec3 c) {
+    return vec3(dot(c, vec3(0.25, 0.5, 0.25)), dot(c, vec3(0.5, 0.0, -0.5)), dot(c, vec3(-0.25, 0.5, -0.25)));
+}
 
-// ACES tone mapping function
-vec3 acesFilm(vec3 x) {
-    const float a = 2.51;
-    const float b = 0.03;
-    const float c = 2.43;
-    const float d = 0.59;
-    const float e = 0.14;
-    return clamp((x * (a * x + b)) / (x * (c * x + d) + e), 0.0, 1.0);
+vec3 yCoCgToRgb(const vec3 c) {
+    return vec3(c.x + c.y - c.z, c.x + c.z, c.x - c.y - c.z);
 }
 
-layout(local_size_x = 32, local_size_y = 32) in;
+layout(local_size_x = LOCAL_SIZE_X, local_size_y = LOCAL_SIZE_Y, local_size_z = 1) in;
 void main() {
     ivec2 pos = ivec2(gl_GlobalInvocationID.xy);
     if (pos.x >= width || pos.y >= height) return;
 
-    vec3 currentColor = imageLoad(screenTexture, pos).rgb;
-    float depth = imageLoad(depthTexture, pos).r;
-
-    vec4 ndc = vec4(
-        (pos.x + 0.5) / width * 2.0 - 1.0, 
-        (pos.y + 0.5) / height * -2.0 + 1.0, 
-        depth, 
-        1.0
-    );
-
     bool useFirstBuffer = (frameCount % 2) == 0;
+    if (pass == 1) {
+        // separate dispatch, the blend reads the unblended neighbourhood of every pixel
+        imageStore(screenTexture, pos, vec4(loadHistory(pos, !useFirstBuffer), 1.0));
+        return;
+    }
 
-    vec3 reprojectedColor = currentColor;
-    if (frameCount > 0) {
-        vec4 prevClipPos = reprojectionMatrix * ndc;
-        prevClipPos.xyz /= prevClipPos.w;
-
-        vec2 prevUV = vec2(
-            (prevClipPos.x + 1.0) * 0.5,
-            (1.0 - prevClipPos.y) * 0.5 // Flip Y
-        );
-        ivec2 prevPos = ivec2(prevUV * vec2(width, height));
+    vec3 currentColor = imageLoad(screenTexture, pos).rgb;
 
-        if(prevPos.x >= 0 && prevPos.x < width && prevPos.y >= 0 && prevPos.y < height && abs(imageLoad(depthTexture, prevPos).r - prevClipPos.z) < 0.1f) {
-            reprojectedColor = useFirstBuffer ? imageLoad(frameBuffer1, prevPos).rgb : imageLoad(frameBuffer2, prevPos).rgb;
-        }           
+    vec3 blendedColor = currentColor;
+    vec2 prevPosition = vec2(pos) + 0.5 + imageLoad(motionVectors, pos).xy;
+    if (frameCount > 0 && all(greaterThanEqual(prevPosition, vec2(0.0))) && all(lessThan(prevPosition, vec2(width, height)))) {
+        // clamp the history to the colour box of the current 3x3 neighbourhood, in YCoCg to reduce hue shifts.
+        // Disoccluded or changed history falls outside the box, so no depth test is needed.
+        vec3 m1 = vec3(0.0);
+        vec3 m2 = vec3(0.0);
+        for (int y = -1; y <= 1; y++) {
+            for (int x = -1; x <= 1; x++) {
+                ivec2 tap = clamp(pos + ivec2(x, y), ivec2(0), ivec2(width - 1, height - 1));
+                vec3 c = rgbToYCoCg(imageLoad(screenTexture, tap).rgb);
+                m1 += c;
+                m2 += c * c;
+            }
+        }
+        vec3 mean = m1 / 9.0;
+        vec3 sigma = sqrt(max(m2 / 9.0 - mean * mean, 0.0));
+        vec3 history = rgbToYCoCg(sampleHistory(prevPosition, useFirstBuffer));
+        vec3 clampedHistory = yCoCgToRgb(clamp(history, mean - 1.25 * sigma, mean + 1.25 * sigma));
+
+        blendedColor = mix(currentColor, clampedHistory, blendFactor);
     }
 
-    vec3 blendedColor = mix(currentColor, reprojectedColor, 0.75);
-
     useFirstBuffer ? imageStore(frameBuffer2, pos, vec4(blendedColor, 1.0)) : imageStore(frameBuffer1, pos, vec4(blendedColor, 1.0));
-
-    vec3 finalColor = acesFilm(blendedColor);
-
-    imageStore(screenTexture, pos, vec4(finalColor, 1.0));
-}
\ No newline at end of file
+}
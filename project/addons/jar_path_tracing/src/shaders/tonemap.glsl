@@ -0,0 +1,114 @@
+#[compute]
+#version 460
+
+#ifndef LOCAL_SIZE_X
+#define LOCAL_SIZE_X 32
+#define LOCAL_SIZE_Y 32
+#endif
+
+// Auto exposure and tonemapping in three dispatches, the exposure never leaves the gpu:
+// pass 0 bins the log luminance of every pixel, pass 1 (a single workgroup) averages the histogram and adapts the
+// exposure, pass 2 applies it and writes the tonemapped display image.
+
+#define HISTOGRAM_BINS 256
+#define LOCAL_SIZE (LOCAL_SIZE_X * LOCAL_SIZE_Y)
+
+layout(std430, set = 0, binding = 0) restrict buffer Params {
+    uint width;
+    uint height;
+    uint pass;
+    uint auto_exposure; //0: only the exposure compensation is applied
+    float min_log_luminance;
+    float log_luminance_range;
+    float adaptation; //fraction of the way to the target luminance covered this frame
+    float exposure_compensation; //in stops
+};
+
+layout(std430, set = 0, binding = 1) restrict buffer Histogram {
+    uint bins[HISTOGRAM_BINS]; //bin 0 holds the (nearly) black pixels, cleared again by pass 1
+    float average_luminance; //adapted over the frames, 0 until the first average
+};
+
+layout(set = 0, binding = 2, rgba32f) restrict uniform readonly image2D screenTexture;
+layout(set = 0, binding = 3, rgba8) restrict uniform writeonly image2D displayTexture;
+
+shared uint local_bins[HISTOGRAM_BINS];
+shared float weighted_bins[HISTOGRAM_BINS];
+
+float luminance(const vec3 color) {
+    return dot(color, vec3(0.2126, 0.7152, 0.0722));
+}
+
+// ACES approximation from https://knarkowicz.wordpress.com/2016/01/06/aces-filmic-tone-mapping-curve/
+vec3 acesFilm(vec3 x) {
+    const float a = 2.51;
+    const float b = 0.03;
+    const float c = 2.43;
+    const float d = 0.59;
+    const float e = 0.14;
+    return clamp((x * (a * x + b)) / (x * (c * x + d) + e), 0.0, 1.0);
+}
+
+uint luminance_bin(const float l) {
+    if (l < 1e-5)
+        return 0;
+    float t = clamp((log2(l) - min_log_luminance) / log_luminance_range, 0.0, 1.0);
+    return uint(t * (HISTOGRAM_BINS - 2) + 1.0);
+}
+
+void build_histogram(const ivec2 pos) {
+    for (uint i = gl_LocalInvocationIndex; i < HISTOGRAM_BINS; i += LOCAL_SIZE)
+        local_bins[i] = 0;
+    barrier();
+
+    if (pos.x < width && pos.y < height)
+        atomicAdd(local_bins[luminance_bin(luminance(imageLoad(screenTexture, pos).rgb))], 1);
+    barrier();
+
+    for (uint i = gl_LocalInvocationIndex; i < HISTOGRAM_BINS; i += LOCAL_SIZE)
+        if (local_bins[i] > 0)
+            atomicAdd(bins[i], local_bins[i]);
+}
+
+void average_histogram() {
+    for (uint i = gl_LocalInvocationIndex; i < HISTOGRAM_BINS; i += LOCAL_SIZE) {
+        weighted_bins[i] = float(bins[i]) * float(i);
+        local_bins[i] = bins[i];
+        bins[i] = 0; //ready for the next frame
+    }
+    barrier();
+
+    if (gl_LocalInvocationIndex == 0) {
+        float weighted = 0.0;
+        for (uint i = 1; i < HISTOGRAM_BINS; i++)
+            weighted += weighted_bins[i];
+        if (weighted <= 0.0)
+            return; //black frame, keep the exposure
+        float black = float(local_bins[0]);
+        float lit = max(float(width * height) - black, 1.0);
+        //mean bin of the lit pixels back to a luminance
+        float mean_bin = weighted / lit - 1.0;
+        float target = exp2(mean_bin / (HISTOGRAM_BINS - 2) * log_luminance_range + min_log_luminance);
+        average_luminance = average_luminance > 0.0 ? mix(average_luminance, target, adaptation) : target;
+    }
+}
+
+layout(local_size_x = LOCAL_SIZE_X, local_size_y = LOCAL_SIZE_Y, local_size_z = 1) in;
+void main() {
+    ivec2 pos = ivec2(gl_GlobalInvocationID.xy);
+    if (pass == 0) {
+        build_histogram(pos);
+        return;
+    }
+    if (pass == 1) {
+        average_histogram();
+        return;
+    }
+
+    if (pos.x >= width || pos.y >= height) return;
+    float exposure = exp2(exposure_compensation);
+    if (auto_exposure != 0)
+        exposure *= 0.18 / max(average_luminance, 1e-4); //middle grey
+    vec3 color = imageLoad(screenTexture, pos).rgb * exposure;
+    imageStore(displayTexture, pos, vec4(acesFilm(color), 1.0));
+}
@@ -0,0 +1,64 @@
+#[vertex]
+#version 460
+
+// Rasterized primary visibility for hybrid rendering: every pixel stores the instance (+1, 0 where the sky is
+// visible) and the triangle it sees. Vertices are pulled from the scene buffers of main.glsl, one draw per instance.
+
+struct TriangleGeometry {
+    vec4 v0;
+    vec4 edge1;
+    vec4 edge2;
+};
+
+struct BLASInstance
+{
+    mat4 transform;
+    mat4 inverse_transform;
+    mat4 previous_transform;
+    vec4 aabbMin;
+    vec4 aabbMax;
+    uint root;
+    uint materials[3];
+};
+
+layout(set = 0, binding = 0, std430) restrict readonly buffer TrianglesGeometry
+{
+    TriangleGeometry triangles_geometry[];
+};
+
+layout(set = 0, binding = 1, std430) restrict readonly buffer BLASInstances
+{
+    BLASInstance blas_instances[];
+};
+
+layout(push_constant, std430) uniform Params {
+    mat4 vp; //same view projection as main.glsl
+    uint instance;
+    uint first_triangle;
+    vec2 jitter; //subpixel offset in ndc, such that the pixel centres land on the primary ray positions
+} params;
+
+layout(location = 0) flat out uvec2 visibility;
+
+void main() {
+    uint triangle = params.first_triangle + uint(gl_VertexIndex) / 3;
+    uint corner = uint(gl_VertexIndex) % 3;
+    TriangleGeometry tri = triangles_geometry[triangle];
+    vec3 p = tri.v0.xyz + (corner == 1 ? tri.edge1.xyz : corner == 2 ? tri.edge2.xyz : vec3(0.0));
+
+    vec4 clip = params.vp * (blas_instances[params.instance].transform * vec4(p, 1.0));
+    clip.xy += params.jitter * clip.w;
+    //the view projection has y up and z in [-w, w]
+    gl_Position = vec4(clip.x, -clip.y, (clip.z + clip.w) * 0.5, clip.w);
+    visibility = uvec2(params.instance + 1, triangle);
+}
+
+#[fragment]
+#version 460
+
+layout(location = 0) flat in uvec2 visibility;
+layout(location = 0) out uvec2 outVisibility;
+
+void main() {
+    outVisibility = visibility;
+}
@@ -1,12 +1,43 @@
 #include "bvh.h"
+#include <cstdio>
+#include <limits>
 
 namespace BVH
 {
 
+namespace
+{
+void print_stdout(const std::string &message)
+{
+    std::puts(message.c_str());
+}
+
+PrintFunction print_function = print_stdout;
+
+// half the surface area of a box, as BoundingBox::area
+float half_area(const vec3 &min, const vec3 &max)
+{
+    const vec3 d = max - min;
+    return d.x * d.y + d.y * d.z + d.z * d.x;
+}
+} // namespace
+
+void set_print_function(PrintFunction function)
+{
+    print_function = function != nullptr ? function : print_stdout;
+}
+
+void print(const std::string &message)
+{
+    print_function(message);
+}
+
 BoundingBox::BoundingBox()
 {
-    min = vec4(std::numeric_limits<float>::max());
-    max = vec4(std::numeric_limits<float>::min());
+    // empty, every extend makes it contain the point
+    const float inf = std::numeric_limits<float>::max();
+    min = vec4(inf, inf, inf, 1.0f);
+    max = vec4(-inf, -inf, -inf, 1.0f);
 }
 
 void BoundingBox::extend(const vec4 &point)
@@ -78,8 +109,11 @@ float BVHBuilder::EvaluateSAH(const std::vector<Triangle> &triangles, const BVHN
     int countLeft = 0;
     for (int i = 0; i < BINS - 1; i++)
     {
-        leftBox.extend(bins[i].bounds.min);
-        leftBox.extend(bins[i].bounds.max);
+        if (bins[i].count > 0)
+        {
+            leftBox.extend(bins[i].bounds.min);
+            leftBox.extend(bins[i].bounds.max);
+        }
         countLeft += bins[i].count;
         leftAccum[i] = leftBox;
         leftCount[i] = countLeft;
@@ -90,9 +124,14 @@ float BVHBuilder::EvaluateSAH(const std::vector<Triangle> &triangles, const BVHN
     int countRight = 0;
     for (int i = BINS - 1; i > 0; i--)
     {
-        rightBox.extend(bins[i].bounds.min);
-        rightBox.extend(bins[i].bounds.max);
+        if (bins[i].count > 0)
+        {
+            rightBox.extend(bins[i].bounds.min);
+            rightBox.extend(bins[i].bounds.max);
+        }
         countRight += bins[i].count;
+        if (leftCount[i - 1] == 0 || countRight == 0)
+            continue; // an empty side splits nothing
         float cost = leftAccum[i - 1].area() * leftCount[i - 1] + rightBox.area() * countRight;
 
         if (cost < bestCost)
@@ -105,14 +144,15 @@ float BVHBuilder::EvaluateSAH(const std::vector<Triangle> &triangles, const BVHN
     return bestCost;
 }
 
-unsigned int BVHBuilder::build_recursive(std::vector<BVHNode> &nodes, std::vector<Triangle> &triangles, int start,
-                                         int end)
+unsigned int BVHBuilder::build_recursive(std::vector<BVHNode> &nodes, std::vector<unsigned int> &links,
+                                         std::vector<Triangle> &triangles, int start, int end)
 {
     if (start >= end)
         return 0;
 
     int node_index = nodes.size();
     nodes.push_back(BVHNode());
+    links.push_back(make_link(node_index, 3)); // parent is set by the caller
     BVHNode &node = nodes[node_index];
 
     BoundingBox bbox = compute_bounding_box(triangles, start, end);
@@ -142,11 +182,17 @@ unsigned int BVHBuilder::build_recursive(std::vector<BVHNode> &nodes, std::vecto
         }
     }
 
-    // Dont split if cost would be greater
     vec4 e = node.aabbMax - node.aabbMin;
+    if (bestAxis < 0)
+    {
+        // the centroids share a single bin on every axis, split at the median of the longest axis below
+        bestAxis = e.x > e.y && e.x > e.z ? 0 : (e.y > e.z ? 1 : 2);
+        bestSplit = -std::numeric_limits<float>::max();
+    }
+    // Dont split if cost would be greater
     float parentArea = e.x * e.y + e.y * e.z + e.z * e.x;
     float parentCost = node.tri_count * parentArea;
-    if (bestCost * 0.8f >= parentCost) // allow slightly worse splits
+    if (bestCost * 0.8f >= parentCost && bestCost < 1e30f) // allow slightly worse splits
         return node_index;
 
     // Partition the triangles around the split position
@@ -177,34 +223,53 @@ unsigned int BVHBuilder::build_recursive(std::vector<BVHNode> &nodes, std::vecto
     }
 
     // UtilityFunctions::print(node_index);
-    nodes[node_index].left_child = build_recursive(nodes, triangles, start, i);
-    nodes[node_index].right_child = build_recursive(nodes, triangles, i, end);
+    unsigned int left_child = build_recursive(nodes, links, triangles, start, i);
+    unsigned int right_child = build_recursive(nodes, links, triangles, i, end);
+    nodes[node_index].left_child = left_child;
+    nodes[node_index].right_child = right_child;
     nodes[node_index].tri_count = 0;
 
+    // the left side holds the centroids below the split
+    links[node_index] = make_link(node_index, bestAxis);
+    links[left_child] = make_link(node_index, links[left_child] & 3);
+    links[right_child] = make_link(node_index, links[right_child] & 3);
+
     return node_index;
 }
 
-unsigned int BVHBuilder::BuildBVH(std::vector<BVHNode> &nodes, std::vector<Triangle> &triangles,
-                                  const Ref<ArrayMesh> &arrayMesh)
+unsigned int BVHBuilder::BuildBVH(std::vector<BVHNode> &nodes, std::vector<unsigned int> &links,
+                                  std::vector<Triangle> &triangles, const std::vector<MeshSurface> &surfaces)
 {
     int start = triangles.size();
 
-    for (int l = 0; l < arrayMesh->get_surface_count(); l++)
+    for (size_t l = 0; l < surfaces.size(); l++)
     {
-        auto array = arrayMesh->surface_get_arrays(l);
-        PackedInt32Array indices = array[Mesh::ARRAY_INDEX]; // we might not always have an index array
-        PackedVector3Array vertices = array[Mesh::ARRAY_VERTEX];
-        PackedVector3Array normals = array[Mesh::ARRAY_NORMAL];
-        PackedVector2Array uvs = array[Mesh::ARRAY_TEX_UV];
-        for (int i = 0; i < indices.size(); i += 3)
+        const MeshSurface &surface = surfaces[l];
+        for (int i = 0; i + 2 < surface.index_count; i += 3)
         {
             Triangle tri;
             for (int j = 0; j < 3; j++)
             {
-                tri.vertices[j] =
-                    vec4(vertices[indices[i + j]].x, vertices[indices[i + j]].y, vertices[indices[i + j]].z);
-                tri.normals[j] = vec4(normals[indices[i + j]].x, normals[indices[i + j]].y, normals[indices[i + j]].z);
-                tri.uvs[j] = vec2(uvs[indices[i + j]].x, uvs[indices[i + j]].y);
+                const int index = surface.indices[i + j];
+                const float *v = surface.vertices + index * 3;
+                tri.vertices[j] = vec4(v[0], v[1], v[2]);
+                tri.uvs[j] = surface.uvs != nullptr ? vec2(surface.uvs[index * 2], surface.uvs[index * 2 + 1]) : vec2();
+            }
+            for (int j = 0; j < 3; j++)
+            {
+                if (surface.normals != nullptr)
+                {
+                    const float *n = surface.normals + surface.indices[i + j] * 3;
+                    tri.normals[j] = vec4(n[0], n[1], n[2]);
+                    continue;
+                }
+                // flat shading, the normal of the triangle's plane
+                const vec4 e1 = tri.vertices[1] - tri.vertices[0];
+                const vec4 e2 = tri.vertices[2] - tri.vertices[0];
+                vec4 n(e1.y * e2.z - e1.z * e2.y, e1.z * e2.x - e1.x * e2.z, e1.x * e2.y - e1.y * e2.x);
+                const float length = std::sqrt(n.x * n.x + n.y * n.y + n.z * n.z);
+                tri.normals[j] = length > 0.0f ? n * (1.0f / length) : vec4(0.0f, 1.0f, 0.0f);
+                tri.normals[j].w = 1.0f;
             }
             tri.materialIndex = l;
             tri.centroid = (tri.vertices[0] + tri.vertices[1] + tri.vertices[2]) * 0.33333333f;
@@ -214,12 +279,39 @@ unsigned int BVHBuilder::BuildBVH(std::vector<BVHNode> &nodes, std::vector<Trian
     int end = triangles.size();
 
 #ifdef VERBOSE_BVH_BUILDING
-    UtilityFunctions::print("Build recursive using: start: " + godot::String(std::to_string(start).c_str()) +
-                            ", end: " + godot::String(std::to_string(end).c_str()));
+    print("Build recursive using: start: " + std::to_string(start) + ", end: " + std::to_string(end));
 #endif
 
     // Step 2: Build the BVH using the added triangles
-    return build_recursive(nodes, triangles, start, end);
+    return build_recursive(nodes, links, triangles, start, end);
+}
+
+float BVHBuilder::sah_cost(const std::vector<BVHNode> &nodes, unsigned int root) const
+{
+    if (root >= nodes.size())
+        return 0.0f;
+    const float root_area = half_area(nodes[root].aabbMin, nodes[root].aabbMax);
+    if (root_area <= 0.0f)
+        return 0.0f;
+
+    float cost = 0.0f;
+    std::vector<unsigned int> stack;
+    stack.push_back(root);
+    while (!stack.empty())
+    {
+        const BVHNode &node = nodes[stack.back()];
+        stack.pop_back();
+        const float area = half_area(node.aabbMin, node.aabbMax) / root_area;
+        if (node.tri_count > 0)
+        {
+            cost += area * node.tri_count;
+            continue;
+        }
+        cost += area;
+        stack.push_back(node.left_child);
+        stack.push_back(node.right_child);
+    }
+    return cost;
 }
 
 #define print_as_tree
@@ -244,10 +336,8 @@ void BVHBuilder::print_tree(const std::vector<BVHNode> &nodes)
         unsigned int first_tri_index = nodes[i].first_tri_index;
         unsigned int tri_count = nodes[i].tri_count;
 
-        UtilityFunctions::print("{Node: l: " + godot::String(std::to_string(left_child).c_str()) +
-                                ", r: " + godot::String(std::to_string(right_child).c_str()) +
-                                ", t: " + godot::String(std::to_string(first_tri_index).c_str()) +
-                                ", c: " + godot::String(std::to_string(tri_count).c_str()) + "}");
+        print("{Node: l: " + std::to_string(left_child) + ", r: " + std::to_string(right_child) +
+              ", t: " + std::to_string(first_tri_index) + ", c: " + std::to_string(tri_count) + "}");
 #ifdef print_as_tree
         if (left_child != 0)
         {
@@ -316,6 +406,66 @@ void TLAS::build(std::vector<TLASNode> &tlasNodes, const std::vector<BLASInstanc
     tlasNodes[0] = tlasNodes[nodeIdx[A]];
 }
 
+void TLAS::build_links(std::vector<TLASNode> &nodes, std::vector<unsigned int> &links)
+{
+    links.assign(nodes.size(), make_link(0, 3));
+    // the root is a copy of the last merged node, so walk the tree from the root instead of iterating the array
+    std::vector<unsigned int> stack;
+    stack.push_back(0);
+    while (!stack.empty())
+    {
+        unsigned int index = stack.back();
+        stack.pop_back();
+        TLASNode &node = nodes[index];
+        if (node.leftRight == 0)
+            continue;
+
+        unsigned int left = node.leftRight & 0xFFFF;
+        unsigned int right = node.leftRight >> 16;
+        // split axis: the axis along which the child centers are furthest apart
+        vec3 delta = (nodes[right].aabbMin + nodes[right].aabbMax) - (nodes[left].aabbMin + nodes[left].aabbMax);
+        unsigned int axis = 0;
+        for (unsigned int i = 1; i < 3; i++)
+            if (std::abs(delta[i]) > std::abs(delta[axis]))
+                axis = i;
+        if (delta[axis] < 0.0f)
+        {
+            std::swap(left, right);
+            node.leftRight = left + (right << 16);
+        }
+
+        links[index] = make_link(links[index] >> 2, axis);
+        links[left] = make_link(index, 3);
+        links[right] = make_link(index, 3);
+        stack.push_back(left);
+        stack.push_back(right);
+    }
+}
+
+float TLAS::sah_cost(const std::vector<TLASNode> &nodes) const
+{
+    if (nodes.empty())
+        return 0.0f;
+    const float root_area = half_area(nodes[0].aabbMin, nodes[0].aabbMax);
+    if (root_area <= 0.0f)
+        return 0.0f;
+
+    float cost = 0.0f;
+    std::vector<unsigned int> stack;
+    stack.push_back(0);
+    while (!stack.empty())
+    {
+        const TLASNode &node = nodes[stack.back()];
+        stack.pop_back();
+        cost += half_area(node.aabbMin, node.aabbMax) / root_area;
+        if (node.leftRight == 0)
+            continue;
+        stack.push_back(node.leftRight & 0xFFFF);
+        stack.push_back(node.leftRight >> 16);
+    }
+    return cost;
+}
+
 inline int TLAS::FindBestMatch(const std::vector<TLASNode> &tlasNodes, const std::vector<int> &list, const int N,
                                const int A) const
 {
@@ -358,10 +508,9 @@ void TLAS::print_tree(const std::vector<TLASNode> &nodes)
         unsigned int left_child = nodes[i].leftRight & 0xFFFF;
         unsigned int right_child = nodes[i].leftRight >> 16;
         unsigned int blas = nodes[i].blas;
-        UtilityFunctions::print("{Node: l: " + godot::String(std::to_string(left_child).c_str()) +
-                                ", r: " + godot::String(std::to_string(right_child).c_str()) +
-                                ", b: " + godot::String(std::to_string(blas).c_str()) + ", m" +
-                                nodes[i].aabbMin.toString() + ", M" + nodes[i].aabbMax.toString() + "}");
+        print("{Node: l: " + std::to_string(left_child) + ", r: " + std::to_string(right_child) +
+              ", b: " + std::to_string(blas) + ", m" + nodes[i].aabbMin.toString() + ", M" +
+              nodes[i].aabbMax.toString() + "}");
 #ifdef print_as_tree
         if (left_child != 0)
         {
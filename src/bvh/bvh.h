@@ -2,23 +2,34 @@
 #define BHV_H
 
 #include "vec.h"
-#include "../utils.h"
 #include <algorithm>
-#include <godot_cpp/classes/array_mesh.hpp>
-#include <godot_cpp/variant/array.hpp>
-#include <godot_cpp/variant/utility_functions.hpp>
-#include <godot_cpp/variant/vector2.hpp>
-#include <godot_cpp/variant/vector3.hpp>
+#include <cmath>
+#include <cstring>
+#include <string>
 #include <vector>
 
 //uncomment to print some info about bvh
 // #define VERBOSE_BVH_BUILDING
 
-using namespace godot;
-
+// The builder does not depend on the engine, bvh_godot.h adapts Godot meshes and transforms to it.
 namespace BVH
 {
 
+// destination of the builder's output, stdout unless the engine installs its console
+using PrintFunction = void (*)(const std::string &message);
+void set_print_function(PrintFunction function);
+void print(const std::string &message);
+
+// one surface of an indexed triangle mesh, the surface index becomes the material slot of its triangles
+struct MeshSurface
+{
+    const float *vertices = nullptr; // xyz per vertex
+    const float *normals = nullptr;  // xyz per vertex, null for flat shading
+    const float *uvs = nullptr;      // uv per vertex, may be null
+    const int *indices = nullptr;    // three per triangle
+    int index_count = 0;
+};
+
 struct Triangle
 {
     vec4 vertices[3];
@@ -53,6 +64,22 @@ struct BVHNode
     unsigned int tri_count;
 };
 
+// Parent link of a BVH or TLAS node, used by stackless traversal: (parent index << 2) | split axis.
+// Interior nodes are ordered such that the left child lies on the lower side of the split axis, leaves use axis 3.
+// A root links to itself.
+inline unsigned int make_link(const unsigned int parent, const unsigned int axis)
+{
+    return (parent << 2) | axis;
+}
+
+// intersection record, stored in BVH leaf order
+struct GpuTriangleGeometry
+{
+    vec4 v0;
+    vec4 edge1;
+    vec4 edge2;
+};
+
 struct TLASNode
 {
     vec3 aabbMin;
@@ -65,6 +92,7 @@ struct BLASInstance
 {
     float transform[16];
     float inverse_transform[16];
+    float previous_transform[16]; // transform of the previous frame, for motion vectors
     vec4 aabbMin;
     vec4 aabbMax;
     unsigned int blas_index; // index to the right BLAS BVH node
@@ -79,15 +107,28 @@ struct BLASInstance
     }
 
     // have an array of material ids? say up to 4/8/16 or something
-    void set_transform(const godot::Transform3D &t, const std::vector<BVHNode> &nodes)
+    // the current transform becomes the previous one, call reset_previous_transform for an instance at rest
+    // both matrices are column major, inverse is the affine inverse of t
+    void set_transform(const float t[16], const float inverse[16], const std::vector<BVHNode> &nodes)
+    {
+        std::memcpy(previous_transform, transform, sizeof(transform));
+        std::memcpy(transform, t, sizeof(transform));
+        std::memcpy(inverse_transform, inverse, sizeof(inverse_transform));
+        update_aabb(nodes[blas_index]);
+    }
+
+    void reset_previous_transform()
+    {
+        std::memcpy(previous_transform, transform, sizeof(transform));
+    }
+
+    bool is_moving() const
     {
-        Utils::transform_to_float(transform, t);  
-        Utils::transform_to_float(inverse_transform, t.affine_inverse());  
-        update_aabb(t, nodes[blas_index]);
+        return std::memcmp(previous_transform, transform, sizeof(transform)) != 0;
     }
 
   private:
-    void update_aabb(const godot::Transform3D &t, const BVHNode &node)
+    void update_aabb(const BVHNode &node)
     {
         // Update the AABB
         aabbMin = vec4(1e34f, 1e34f, 1e34f, 1.0f);
@@ -118,23 +159,30 @@ struct BLASInstance
 class BVHBuilder
 {
   public:
-    unsigned int BuildBVH(std::vector<BVHNode> &nodes, std::vector<Triangle> &triangles,
-                          const Ref<ArrayMesh> &arrayMesh);
+    unsigned int BuildBVH(std::vector<BVHNode> &nodes, std::vector<unsigned int> &links,
+                          std::vector<Triangle> &triangles, const std::vector<MeshSurface> &surfaces);
     void print_tree(const std::vector<BVHNode> &nodes);
-    // float EvaluateSAH()
+    // expected cost of a ray against the tree below root relative to its surface area, one per node visited and
+    // one per triangle tested
+    float sah_cost(const std::vector<BVHNode> &nodes, unsigned int root) const;
 
   private:
     BoundingBox compute_bounding_box(const std::vector<Triangle> &triangles, const int start, const int end) const;
     float EvaluateSAH(const std::vector<Triangle> &triangles, const BVHNode &node, const int axis,
                       float& bestSplit) const;
-    unsigned int build_recursive(std::vector<BVHNode> &nodes, std::vector<Triangle> &triangles, int start, int end);
+    unsigned int build_recursive(std::vector<BVHNode> &nodes, std::vector<unsigned int> &links,
+                                 std::vector<Triangle> &triangles, int start, int end);
 };
 
 class TLAS
 {
   public:
     void build(std::vector<TLASNode> &nodes, const std::vector<BLASInstance> &blasInstances);
+    // orders the children of every interior node along a split axis and emits the parent links
+    void build_links(std::vector<TLASNode> &nodes, std::vector<unsigned int> &links);
     void print_tree(const std::vector<TLASNode> &nodes);
+    // sah_cost of BVHBuilder for the tree from the root in slot 0, one per node visited, leaves included
+    float sah_cost(const std::vector<TLASNode> &nodes) const;
 
   private:
     int FindBestMatch(const std::vector<TLASNode> &tlasNodes, const std::vector<int> &list, const int N,
@@ -0,0 +1,57 @@
+#include "bvh_godot.h"
+#include "../utils.h"
+#include <godot_cpp/variant/packed_int32_array.hpp>
+#include <godot_cpp/variant/packed_vector2_array.hpp>
+#include <godot_cpp/variant/packed_vector3_array.hpp>
+#include <godot_cpp/variant/utility_functions.hpp>
+
+// the builder reads the packed arrays in place
+static_assert(sizeof(Vector3) == 3 * sizeof(float) && sizeof(Vector2) == 2 * sizeof(float),
+              "BVH building needs single precision vectors");
+
+namespace BVH
+{
+
+unsigned int build_mesh_bvh(BVHBuilder &builder, std::vector<BVHNode> &nodes, std::vector<unsigned int> &links,
+                            std::vector<Triangle> &triangles, const Ref<ArrayMesh> &mesh)
+{
+    const int surface_count = mesh->get_surface_count();
+    // the arrays have to outlive the build
+    std::vector<PackedInt32Array> indices(surface_count);
+    std::vector<PackedVector3Array> vertices(surface_count);
+    std::vector<PackedVector3Array> normals(surface_count);
+    std::vector<PackedVector2Array> uvs(surface_count);
+    std::vector<MeshSurface> surfaces(surface_count);
+    for (int l = 0; l < surface_count; l++)
+    {
+        auto array = mesh->surface_get_arrays(l);
+        indices[l] = array[Mesh::ARRAY_INDEX]; // we might not always have an index array
+        vertices[l] = array[Mesh::ARRAY_VERTEX];
+        normals[l] = array[Mesh::ARRAY_NORMAL];
+        uvs[l] = array[Mesh::ARRAY_TEX_UV];
+
+        MeshSurface &surface = surfaces[l];
+        surface.vertices = reinterpret_cast<const float *>(vertices[l].ptr());
+        surface.normals = normals[l].size() == vertices[l].size() ? reinterpret_cast<const float *>(normals[l].ptr()) : nullptr;
+        surface.uvs = uvs[l].size() == vertices[l].size() ? reinterpret_cast<const float *>(uvs[l].ptr()) : nullptr;
+        surface.indices = indices[l].ptr();
+        surface.index_count = indices[l].size();
+    }
+    return builder.BuildBVH(nodes, links, triangles, surfaces);
+}
+
+void set_instance_transform(BLASInstance &instance, const Transform3D &t, const std::vector<BVHNode> &nodes)
+{
+    float transform[16];
+    float inverse[16];
+    Utils::transform_to_float(transform, t);
+    Utils::transform_to_float(inverse, t.affine_inverse());
+    instance.set_transform(transform, inverse, nodes);
+}
+
+void print_to_godot_console()
+{
+    set_print_function([](const std::string &message) { UtilityFunctions::print(message.c_str()); });
+}
+
+} // namespace BVH
@@ -0,0 +1,26 @@
+#ifndef BVH_GODOT_H
+#define BVH_GODOT_H
+
+#include "bvh.h"
+#include <godot_cpp/classes/array_mesh.hpp>
+#include <godot_cpp/variant/transform3d.hpp>
+
+using namespace godot;
+
+// Adapts Godot types to the engine independent builder of bvh.h.
+namespace BVH
+{
+
+// BuildBVH over the surfaces of a mesh, the surface index becomes the material slot
+unsigned int build_mesh_bvh(BVHBuilder &builder, std::vector<BVHNode> &nodes, std::vector<unsigned int> &links,
+                            std::vector<Triangle> &triangles, const Ref<ArrayMesh> &mesh);
+
+// the current transform becomes the previous one, like BLASInstance::set_transform
+void set_instance_transform(BLASInstance &instance, const Transform3D &t, const std::vector<BVHNode> &nodes);
+
+// routes print_tree and the verbose build output to the Godot console
+void print_to_godot_console();
+
+} // namespace BVH
+
+#endif // BVH_GODOT_H
@@ -2,7 +2,6 @@
 #define BHV_VEC_H
 
 #include <algorithm>
-#include <godot_cpp/variant/string.hpp>
 #include <string>
 
 namespace BVH
@@ -85,10 +84,10 @@ struct alignas(16) vec4
         return vec4(std::min(x, other.x), std::min(y, other.y), std::min(z, other.z), std::min(w, other.w));
     }
 
-    inline godot::String toString() const
+    inline std::string toString() const
     {
-        return "{" + godot::String(std::to_string(x).c_str()) + ", " + godot::String(std::to_string(y).c_str()) + ", " +
-               godot::String(std::to_string(z).c_str()) + ", " + godot::String(std::to_string(w).c_str()) + "}";
+        return "{" + std::to_string(x) + ", " + std::to_string(y) + ", " + std::to_string(z) + ", " + std::to_string(w) +
+               "}";
     }
 
     inline float &operator[](int index)
@@ -177,10 +176,9 @@ struct vec3
         return vec3(std::min(x, other.x), std::min(y, other.y), std::min(z, other.z));
     }
 
-    inline godot::String toString() const
+    inline std::string toString() const
     {
-        return "{" + godot::String(std::to_string(x).c_str()) + ", " + godot::String(std::to_string(y).c_str()) + ", " +
-               godot::String(std::to_string(z).c_str()) + "}";
+        return "{" + std::to_string(x) + ", " + std::to_string(y) + ", " + std::to_string(z) + "}";
     }
 
     inline float &operator[](int index)
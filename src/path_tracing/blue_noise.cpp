@@ -0,0 +1,113 @@
+#include "blue_noise.h"
+#include <cmath>
+#include <random>
+
+Ref<Image> BlueNoise::get_mask(int size)
+{
+    const String path = "user://blue_noise_" + String::num_int64(size) + ".res";
+    if (FileAccess::file_exists(path))
+    {
+        Ref<Image> mask = ResourceLoader::get_singleton()->load(path);
+        if (mask.is_valid() && mask->get_width() == size && mask->get_format() == Image::FORMAT_RF)
+            return mask;
+    }
+
+    Ref<Image> mask = generate(size);
+    if (ResourceSaver::get_singleton()->save(mask, path) != OK)
+        UtilityFunctions::printerr("Failed to store blue noise mask: ", path);
+    return mask;
+}
+
+Ref<Image> BlueNoise::generate(int size)
+{
+    const int n = size * size;
+    const float sigma = 1.5f;
+
+    // toroidal gaussian indexed by the offset between two pixels
+    std::vector<float> kernel(n);
+    for (int y = 0; y < size; y++)
+        for (int x = 0; x < size; x++)
+        {
+            int dx = std::min(x, size - x);
+            int dy = std::min(y, size - y);
+            kernel[y * size + x] = std::exp(-(dx * dx + dy * dy) / (2.0f * sigma * sigma));
+        }
+
+    std::vector<uint8_t> pattern(n, 0);
+    std::vector<float> energy(n, 0.0f);
+    auto splat = [&](int p, float sign) {
+        const int px = p % size, py = p / size;
+        for (int y = 0; y < size; y++)
+        {
+            const int ky = (y - py + size) % size;
+            for (int x = 0; x < size; x++)
+                energy[y * size + x] += sign * kernel[ky * size + (x - px + size) % size];
+        }
+    };
+    auto tightest_cluster = [&]() {
+        int best = -1;
+        for (int p = 0; p < n; p++)
+            if (pattern[p] && (best < 0 || energy[p] > energy[best]))
+                best = p;
+        return best;
+    };
+    auto largest_void = [&]() {
+        int best = -1;
+        for (int p = 0; p < n; p++)
+            if (!pattern[p] && (best < 0 || energy[p] < energy[best]))
+                best = p;
+        return best;
+    };
+
+    // initial binary pattern: random points, relaxed by moving the tightest cluster into the largest void
+    std::mt19937 rng(1993);
+    const int initial = std::max(1, n / 10);
+    for (int ones = 0; ones < initial;)
+    {
+        int p = rng() % n;
+        if (pattern[p])
+            continue;
+        pattern[p] = 1;
+        splat(p, 1.0f);
+        ones++;
+    }
+    for (int i = 0; i < n; i++)
+    {
+        int cluster = tightest_cluster();
+        pattern[cluster] = 0;
+        splat(cluster, -1.0f);
+        int void_ = largest_void();
+        pattern[void_] = 1;
+        splat(void_, 1.0f);
+        if (void_ == cluster)
+            break;
+    }
+    const std::vector<uint8_t> prototype = pattern;
+    const std::vector<float> prototype_energy = energy;
+
+    // rank the initial points by removing the tightest cluster first
+    std::vector<int> rank(n, 0);
+    for (int r = initial - 1; r >= 0; r--)
+    {
+        int cluster = tightest_cluster();
+        pattern[cluster] = 0;
+        splat(cluster, -1.0f);
+        rank[cluster] = r;
+    }
+
+    // rank the remaining pixels by filling the largest void
+    pattern = prototype;
+    energy = prototype_energy;
+    for (int r = initial; r < n; r++)
+    {
+        int void_ = largest_void();
+        pattern[void_] = 1;
+        splat(void_, 1.0f);
+        rank[void_] = r;
+    }
+
+    Ref<Image> mask = Image::create(size, size, false, Image::FORMAT_RF);
+    for (int p = 0; p < n; p++)
+        mask->set_pixel(p % size, p / size, Color((rank[p] + 0.5f) / n, 0.0f, 0.0f, 1.0f));
+    return mask;
+}
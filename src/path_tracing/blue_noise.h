@@ -0,0 +1,26 @@
+#ifndef BLUE_NOISE_H
+#define BLUE_NOISE_H
+
+#include <godot_cpp/classes/file_access.hpp>
+#include <godot_cpp/classes/image.hpp>
+#include <godot_cpp/classes/resource_loader.hpp>
+#include <godot_cpp/classes/resource_saver.hpp>
+#include <godot_cpp/variant/utility_functions.hpp>
+#include <vector>
+
+using namespace godot;
+
+// Tileable blue-noise mask for the blue-noise sampler of main.glsl, generated with void-and-cluster (Ulichney 1993).
+// Every pixel holds its normalized rank, such that thresholding the mask at any level gives a blue-noise pattern.
+// Generation takes a moment, so the mask is stored in user:// after the first run.
+class BlueNoise
+{
+  public:
+    // FORMAT_RF image of size x size
+    static Ref<Image> get_mask(int size = 64);
+
+  private:
+    static Ref<Image> generate(int size);
+};
+
+#endif // BLUE_NOISE_H
@@ -0,0 +1,388 @@
+#include "cpu_path_tracer.h"
+#include "parallel_for.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+
+namespace
+{
+const float PI = 3.141592653589793f;
+
+// sample dimensions of sampling.glsl
+const unsigned int DIMENSION_CAMERA = 0;
+const unsigned int DIMENSION_BOUNCE = 1;
+const unsigned int DIMENSIONS_PER_BOUNCE = 3;
+const unsigned int DIMENSION_LOBE = 0;
+const unsigned int DIMENSION_DIRECTION = 1;
+
+unsigned int bounce_dimension(const int bounce, const unsigned int decision)
+{
+    return DIMENSION_BOUNCE + bounce * DIMENSIONS_PER_BOUNCE + decision;
+}
+
+// lowbias32, as hash_uint in sampling.glsl
+uint32_t hash_uint(uint32_t x)
+{
+    x ^= x >> 16;
+    x *= 0x7feb352du;
+    x ^= x >> 15;
+    x *= 0x846ca68bu;
+    x ^= x >> 16;
+    return x;
+}
+
+// the white noise sampler of sampling.glsl, pcg2d of the pixel and sample index hashed with the dimension
+Vector2 sample_2d(const uint32_t pixel, const uint32_t sample, const unsigned int dimension)
+{
+    const uint32_t h = hash_uint(dimension);
+    uint32_t x = pixel ^ h;
+    uint32_t y = sample ^ h;
+    x = 1664525u * x + 1013904223u;
+    y = 1664525u * y + 1013904223u;
+    x += 1664525u * y;
+    y += 1664525u * x;
+    x ^= x >> 16;
+    y ^= y >> 16;
+    x += 1664525u * y;
+    y += 1664525u * x;
+    x ^= x >> 16;
+    y ^= y >> 16;
+    return Vector2(x * 2.32830643654e-10f, y * 2.32830643654e-10f);
+}
+
+Vector3 lerp(const Vector3 &a, const Vector3 &b, const float t)
+{
+    return a + (b - a) * t;
+}
+
+//--------- BRDF, as brdfs.glsl ---------
+
+Vector3 fresnel_schlick(const Vector3 &f0, const Vector3 &f90, const float cosine_theta)
+{
+    const float factor = 1.0f - cosine_theta;
+    const float factor_squared = factor * factor;
+    return lerp(f0, f90, factor_squared * factor_squared * factor);
+}
+
+template <typename Shading> Vector3 brdf(const Shading &shading, const Vector3 &light_dir)
+{
+    const float n_dot_light = shading.normal.dot(light_dir);
+    const float n_dot_view = shading.lambert_out;
+    if (std::min(n_dot_light, n_dot_view) < 0.0f)
+        return Vector3();
+
+    const Vector3 half_vector = (light_dir + shading.out_dir).normalized();
+    const float half_dot_view = half_vector.dot(shading.out_dir);
+
+    const float f90 = (half_dot_view * half_dot_view) * (2.0f * shading.roughness) + 0.5f;
+    const float diffuse_fresnel = fresnel_schlick(Vector3(1, 1, 1), Vector3(f90, f90, f90), n_dot_view).x *
+                                  fresnel_schlick(Vector3(1, 1, 1), Vector3(f90, f90, f90), n_dot_light).x;
+    Vector3 result = shading.diffuse_albedo * diffuse_fresnel;
+
+    const float half_dot_normal = half_vector.dot(shading.normal);
+    const float roughness_sq = shading.roughness * shading.roughness;
+    const float denominator = half_dot_normal * (roughness_sq - 1.0f) + 1.0f;
+    const float distribution = roughness_sq / (denominator * denominator);
+
+    const float masking = n_dot_light * std::sqrt((n_dot_view - roughness_sq * n_dot_view) * n_dot_view + roughness_sq);
+    const float shadowing = n_dot_view * std::sqrt((n_dot_light - roughness_sq * n_dot_light) * n_dot_light + roughness_sq);
+    const float geometry = 0.5f / (masking + shadowing);
+
+    const Vector3 specular_fresnel = fresnel_schlick(shading.fresnel_0, Vector3(1, 1, 1), std::max(0.0f, half_dot_view));
+    result += specular_fresnel * (distribution * geometry);
+    return result / PI;
+}
+
+Vector3 sample_ggx_vndf(const Vector3 &view_dir, const float roughness, const Vector2 &random_sample)
+{
+    const Vector3 transformed_view = Vector3(view_dir.x * roughness, view_dir.y * roughness, view_dir.z).normalized();
+    const float phi = 2.0f * PI * random_sample.x;
+    const float z = 1.0f - random_sample.y * (1.0f + transformed_view.z);
+
+    const float sin_theta = std::sqrt(std::max(0.0f, 1.0f - z * z));
+    const Vector3 hemisphere_sample(sin_theta * std::cos(phi), sin_theta * std::sin(phi), z);
+    const Vector3 sum = hemisphere_sample + transformed_view;
+    return Vector3(sum.x * roughness, sum.y * roughness, sum.z).normalized();
+}
+
+float get_ggx_vndf_density(const float n_dot_view, const float half_dot_normal, const float half_dot_view,
+                           const float roughness)
+{
+    if (half_dot_normal < 0.0f)
+        return 0.0f;
+
+    const float roughness_sq = roughness * roughness;
+    const float inv_roughness_sq = 1.0f - roughness_sq;
+    const float denominator = n_dot_view + std::sqrt(roughness_sq + inv_roughness_sq * n_dot_view * n_dot_view);
+
+    const float d_vis = std::max(0.0f, half_dot_view) * (2.0f / PI) / denominator;
+    const float m_sq_term = 1.0f - inv_roughness_sq * half_dot_normal * half_dot_normal;
+    return d_vis * roughness_sq / (m_sq_term * m_sq_term);
+}
+
+float get_ggx_in_dir_density(const float n_dot_view, const Vector3 &view_dir, const Vector3 &light_dir,
+                             const Vector3 &normal, const float roughness)
+{
+    const Vector3 half_vector = (light_dir + view_dir).normalized();
+    const float half_dot_view = half_vector.dot(view_dir);
+    const float half_dot_normal = half_vector.dot(normal);
+    return get_ggx_vndf_density(n_dot_view, half_dot_normal, half_dot_view, roughness) / (4.0f * half_dot_view);
+}
+
+// columns of the tangent to world rotation around normal
+void get_shading_space(const Vector3 &normal, Vector3 basis[3])
+{
+    const float sign = normal.z > 0.0f ? 1.0f : -1.0f;
+    const float a = -1.0f / (sign + normal.z);
+    const float b = normal.x * normal.y * a;
+    basis[0] = Vector3(1.0f + sign * normal.x * normal.x * a, sign * b, -sign * normal.x);
+    basis[1] = Vector3(b, sign + normal.y * normal.y * a, -normal.y);
+    basis[2] = normal;
+}
+
+template <typename Shading> float get_diffuse_sampling_probability(const Shading &shading)
+{
+    return std::min(0.5f, shading.diffuse_albedo.dot(Vector3(0.2126f, 0.7152f, 0.0722f)));
+}
+
+template <typename Shading>
+Vector3 sample_brdf(const Shading &shading, const float lobe_sample, const Vector2 &random_sample)
+{
+    Vector3 basis[3];
+    get_shading_space(shading.normal, basis);
+    Vector3 local;
+    if (lobe_sample < get_diffuse_sampling_probability(shading))
+    { // cosine weighted hemisphere
+        const float phi = 2.0f * PI * random_sample.x;
+        const float radius = std::sqrt(random_sample.y);
+        local = Vector3(radius * std::cos(phi), radius * std::sin(phi), std::sqrt(1.0f - radius * radius));
+    }
+    else
+    {
+        const Vector3 view(basis[0].dot(shading.out_dir), basis[1].dot(shading.out_dir), basis[2].dot(shading.out_dir));
+        const Vector3 half_vector = sample_ggx_vndf(view, shading.roughness, random_sample);
+        local = half_vector * (2.0f * half_vector.dot(view)) - view; // -reflect(view, half_vector)
+    }
+    return basis[0] * local.x + basis[1] * local.y + basis[2] * local.z;
+}
+
+template <typename Shading> float get_brdf_density(const Shading &shading, const Vector3 &sampled_dir)
+{
+    const float diffuse_prob = get_diffuse_sampling_probability(shading);
+    const float specular_density = get_ggx_in_dir_density(shading.lambert_out, shading.out_dir, sampled_dir,
+                                                           shading.normal, shading.roughness);
+    const float diffuse_density = std::max(0.0f, shading.normal.dot(sampled_dir)) / PI;
+    return specular_density + (diffuse_density - specular_density) * diffuse_prob;
+}
+
+Vector3 to_vector3(const BVH::vec4 &v)
+{
+    return Vector3(v.x, v.y, v.z);
+}
+} // namespace
+
+CpuPathTracer::CpuPathTracer(GeometryGroup3D &scene, bool texture_sampling)
+    : scene(scene), texture_sampling(texture_sampling)
+{
+    for (const Ref<Image> &image : scene.get_textures_buffer())
+    {
+        Texture texture;
+        if (image.is_valid() && !image->is_empty())
+        {
+            Ref<Image> rgba = image->duplicate();
+            if (rgba->is_compressed())
+                rgba->decompress();
+            rgba->convert(Image::FORMAT_RGBA8);
+            texture.width = rgba->get_width();
+            texture.height = rgba->get_height();
+            texture.data = rgba->get_data();
+        }
+        textures.push_back(texture);
+    }
+    if (scene.has_environment())
+    {
+        Ref<Image> image = scene.get_environment_image();
+        environment.width = image->get_width();
+        environment.height = image->get_height();
+        environment.data = image->get_data(); // RGBAF
+        environment_intensity = scene.get_environment_intensity();
+    }
+}
+
+uint64_t CpuPathTracer::get_rays_traced() const
+{
+    return rays_traced;
+}
+
+Vector3 CpuPathTracer::sample_sky(const Vector3 &direction) const
+{
+    if (environment.width > 0)
+    { // texel of the equirectangular panorama, as sampleSky with ENVIRONMENT_MAP
+        const float u = std::atan2(direction.x, -direction.z) * (0.5f / PI) + 0.5f;
+        const float v = std::acos(std::clamp(direction.y, -1.0f, 1.0f)) / PI;
+        const int x = std::clamp(static_cast<int>(u * environment.width), 0, environment.width - 1);
+        const int y = std::clamp(static_cast<int>(v * environment.height), 0, environment.height - 1);
+        const float *texel = reinterpret_cast<const float *>(environment.data.ptr()) + (y * environment.width + x) * 4;
+        return Vector3(texel[0], texel[1], texel[2]) * environment_intensity;
+    }
+    const float t = 0.5f * (direction.y + 1.0f);
+    return lerp(Vector3(0.95f, 0.95f, 0.95f), Vector3(0.9f, 0.94f, 1.0f), t);
+}
+
+Vector3 CpuPathTracer::sample_albedo(const int index, const Vector2 &uv) const
+{
+    // nearest texel with repeat wrapping
+    const Texture &texture = textures[index];
+    if (texture.width == 0)
+        return Vector3(1, 1, 1);
+    const int x = static_cast<int>(std::floor((uv.x - std::floor(uv.x)) * texture.width)) % texture.width;
+    const int y = static_cast<int>(std::floor((uv.y - std::floor(uv.y)) * texture.height)) % texture.height;
+    const uint8_t *texel = texture.data.ptr() + (y * texture.width + x) * 4;
+    return Vector3(texel[0], texel[1], texel[2]) / 255.0f;
+}
+
+// finalize_hit and get_shading_data of main.glsl
+CpuPathTracer::Shading CpuPathTracer::get_shading(const RayHit &hit, const Vector3 &origin,
+                                                  const Vector3 &direction) const
+{
+    const GpuTriangleGeometry &geometry = scene.get_triangles_geometry()[hit.triangle];
+    const GpuTriangleData &tri = scene.get_triangles_data()[hit.triangle];
+    const BLASInstance &instance = scene.get_blas_instances()[hit.instance];
+    const GpuMaterial &material = scene.get_materials()[instance.material[tri.material_index]];
+
+    Shading s;
+    s.position = origin + direction * hit.t;
+    s.out_dir = -direction.normalized();
+
+    // front faces are the ones the ray enters along their winding normal, as in finalize_hit
+    const float *inverse = instance.inverse_transform;
+    Vector3 local_d;
+    for (int r = 0; r < 3; r++)
+        local_d[r] = inverse[r] * direction.x + inverse[4 + r] * direction.y + inverse[8 + r] * direction.z;
+    const bool front = to_vector3(geometry.edge1).cross(to_vector3(geometry.edge2)).dot(local_d) > 0.0f;
+
+    const float u = hit.u;
+    const float v = hit.v;
+    const float w = 1.0f - u - v;
+    const Vector2 uv(tri.uvs[0].u * w + tri.uvs[1].u * u + tri.uvs[2].u * v,
+                     tri.uvs[0].v * w + tri.uvs[1].v * u + tri.uvs[2].v * v);
+    const Vector3 local_normal = Vector3(tri.n1.x, tri.n1.y, tri.n1.z) * w + to_vector3(tri.n2) * u + to_vector3(tri.n3) * v;
+    const float *transform = instance.transform;
+    for (int r = 0; r < 3; r++)
+        s.normal[r] = transform[r] * local_normal.x + transform[4 + r] * local_normal.y + transform[8 + r] * local_normal.z;
+    s.normal = s.normal.normalized();
+    if (!front)
+        s.normal = -s.normal;
+
+    s.lambert_out = s.normal.dot(s.out_dir);
+    s.emission = to_vector3(material.emission) * std::max(0.0f, material.emission.w);
+    Vector3 albedo = to_vector3(material.albedo);
+    if (texture_sampling && material.albedo_texture_index >= 0 && material.albedo_texture_index < static_cast<int>(textures.size()))
+        albedo *= sample_albedo(material.albedo_texture_index, uv);
+
+    s.fresnel_0 = lerp(Vector3(0.02f, 0.02f, 0.02f), albedo, material.metallic);
+    s.diffuse_albedo = albedo - albedo * material.metallic;
+    s.roughness = std::max(0.006f, material.roughness);
+    return s;
+}
+
+// path_trace of main.glsl for the pixels (x, y) to (x + lanes - 1, y), one bounce of all four paths per packet
+void CpuPathTracer::trace_paths(const RayQuery &query, const Camera &camera, const Vector2i resolution, const int x,
+                                const int y, const int lanes, const unsigned int sample, const int max_bounces,
+                                Vector3 *radiance, uint64_t &rays) const
+{
+    Vector3 origins[4];
+    Vector3 directions[4];
+    Vector3 throughput[4];
+    uint32_t pixels[4];
+    for (int i = 0; i < lanes; i++)
+    { // camera_ray, box filtered jitter within the pixel
+        pixels[i] = static_cast<uint32_t>(x + i) | (static_cast<uint32_t>(y) << 16);
+        const Vector2 jitter = sample_2d(pixels[i], sample, DIMENSION_CAMERA);
+        const float ndc[4] = {(x + i + jitter.x) / resolution.x * 2.0f - 1.0f,
+                              -((y + jitter.y) / resolution.y * 2.0f - 1.0f), 1.0f, 1.0f};
+        float world[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+        for (int r = 0; r < 4; r++)
+            for (int c = 0; c < 4; c++)
+                world[r] += camera.ivp[c * 4 + r] * ndc[c];
+        origins[i] = Vector3(camera.position.x, camera.position.y, camera.position.z);
+        directions[i] = (Vector3(world[0], world[1], world[2]) / world[3] - origins[i]).normalized();
+        throughput[i] = Vector3(1, 1, 1);
+    }
+
+    int active = (1 << lanes) - 1;
+    for (int bounce = 0; bounce < max_bounces && active != 0; bounce++)
+    {
+        vec3 ray_origins[4], ray_directions[4];
+        for (int i = 0; i < lanes; i++)
+        {
+            ray_origins[i] = Utils::to_vec3(origins[i]);
+            ray_directions[i] = Utils::to_vec3(directions[i]);
+        }
+        RayHit hits[4];
+        query.intersect_packet(ray_origins, ray_directions, active, 1e9f, hits);
+        for (int i = 0; i < lanes; i++)
+        {
+            if (!(active & (1 << i)))
+                continue;
+            rays++;
+            if (hits[i].t == INFINITY)
+            {
+                radiance[i] += throughput[i] * sample_sky(directions[i]);
+                active &= ~(1 << i);
+                continue;
+            }
+            const Shading s = get_shading(hits[i], origins[i], directions[i]);
+            radiance[i] += throughput[i] * s.emission;
+
+            origins[i] = s.position + s.normal * 0.001f;
+            directions[i] = sample_brdf(s, sample_2d(pixels[i], sample, bounce_dimension(bounce, DIMENSION_LOBE)).x,
+                                        sample_2d(pixels[i], sample, bounce_dimension(bounce, DIMENSION_DIRECTION)));
+            const float density = get_brdf_density(s, directions[i]);
+            const float lambert_in = s.normal.dot(directions[i]);
+            if (lambert_in <= 0.0f)
+            {
+                active &= ~(1 << i);
+                continue;
+            }
+            throughput[i] *= brdf(s, directions[i]) * (lambert_in / density);
+        }
+    }
+}
+
+void CpuPathTracer::render(const Camera &camera, const Vector2i resolution, int samples_per_pixel, int max_bounces,
+                           float *radiance)
+{
+    const RayQuery query = scene.get_ray_query();
+    const int tiles_x = (resolution.x + TILE_SIZE - 1) / TILE_SIZE;
+    const int tiles_y = (resolution.y + TILE_SIZE - 1) / TILE_SIZE;
+    std::atomic<uint64_t> rays(0);
+
+    parallel_for(tiles_x * tiles_y, 1, [&](const int tile) {
+        const int x0 = (tile % tiles_x) * TILE_SIZE;
+        const int y0 = (tile / tiles_x) * TILE_SIZE;
+        const int x1 = std::min(x0 + TILE_SIZE, resolution.x);
+        const int y1 = std::min(y0 + TILE_SIZE, resolution.y);
+        uint64_t tile_rays = 0;
+        for (int y = y0; y < y1; y++)
+        {
+            for (int x = x0; x < x1; x += 4)
+            {
+                const int lanes = std::min(4, x1 - x);
+                Vector3 sum[4];
+                for (int sample = 0; sample < samples_per_pixel; sample++)
+                    trace_paths(query, camera, resolution, x, y, lanes, sample, max_bounces, sum, tile_rays);
+                for (int i = 0; i < lanes; i++)
+                {
+                    float *pixel = radiance + (static_cast<int64_t>(y) * resolution.x + x + i) * 4;
+                    pixel[0] = sum[i].x / samples_per_pixel;
+                    pixel[1] = sum[i].y / samples_per_pixel;
+                    pixel[2] = sum[i].z / samples_per_pixel;
+                    pixel[3] = 1.0f;
+                }
+            }
+        }
+        rays += tile_rays;
+    });
+    rays_traced = rays;
+}
@@ -0,0 +1,73 @@
+#ifndef CPU_PATH_TRACER_H
+#define CPU_PATH_TRACER_H
+
+#include "geometry_group3d.h"
+#include "ray_query.h"
+#include "render_parameters.h"
+#include <cstdint>
+#include <godot_cpp/classes/image.hpp>
+#include <godot_cpp/variant/packed_byte_array.hpp>
+#include <godot_cpp/variant/vector2.hpp>
+#include <godot_cpp/variant/vector2i.hpp>
+#include <godot_cpp/variant/vector3.hpp>
+#include <vector>
+
+using namespace godot;
+
+// Path traces the scene of a GeometryGroup3D on the cpu like path_trace in main.glsl: the same TLAS and BVH buffers,
+// materials and BRDF (brdfs.glsl), with white noise and brdf sampled paths only. Without a GPU it renders stills,
+// with one it gives reference images to compare the shader variants against. Tiles of the image are spread over the
+// hardware threads, the paths of four neighbouring pixels are traced as one ray packet.
+// The environment map is hit by brdf sampling alone, its next event estimation only lowers the noise on the gpu.
+class CpuPathTracer
+{
+  public:
+    CpuPathTracer(GeometryGroup3D &scene, bool texture_sampling);
+
+    // rgba radiance of resolution.x * resolution.y pixels, alpha 1
+    void render(const Camera &camera, const Vector2i resolution, int samples_per_pixel, int max_bounces,
+                float *radiance);
+
+    // rays traced by the last render, primary and bounce rays
+    uint64_t get_rays_traced() const;
+
+  private:
+    // ShadingInfo of main.glsl
+    struct Shading
+    {
+        Vector3 position;
+        Vector3 normal;
+        Vector3 out_dir;
+        float lambert_out;
+        Vector3 emission;
+        Vector3 diffuse_albedo;
+        Vector3 fresnel_0;
+        float roughness;
+    };
+
+    // an image read by the tracing threads, without going through the Image api per texel
+    struct Texture
+    {
+        int width = 0;
+        int height = 0;
+        PackedByteArray data;
+    };
+
+    static const int TILE_SIZE = 16; // pixels, a multiple of the packet width
+
+    Shading get_shading(const RayHit &hit, const Vector3 &origin, const Vector3 &direction) const;
+    Vector3 sample_sky(const Vector3 &direction) const;
+    Vector3 sample_albedo(int texture, const Vector2 &uv) const;
+    void trace_paths(const RayQuery &query, const Camera &camera, const Vector2i resolution, const int x, const int y,
+                     const int lanes, const unsigned int sample, const int max_bounces, Vector3 *radiance,
+                     uint64_t &rays) const;
+
+    GeometryGroup3D &scene;
+    bool texture_sampling;
+    std::vector<Texture> textures; // rgba8
+    Texture environment;           // rgbaf, empty without a panorama
+    float environment_intensity = 1.0f;
+    uint64_t rays_traced = 0;
+};
+
+#endif // CPU_PATH_TRACER_H
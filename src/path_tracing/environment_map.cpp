@@ -0,0 +1,71 @@
+#include "environment_map.h"
+#include <cmath>
+
+void EnvironmentMap::build(const Ref<Texture2D> &panorama, float intensity)
+{
+    header = DistributionHeader();
+    header.intensity = intensity;
+    cdf.assign(2, 1.0f);
+    image = Image::create(1, 1, false, Image::FORMAT_RGBAF);
+    if (panorama.is_null() || panorama->get_image().is_null())
+        return;
+
+    image = panorama->get_image()->duplicate();
+    if (image->is_compressed())
+        image->decompress();
+    image->clear_mipmaps();
+    if (image->get_width() > MAX_WIDTH)
+        image->resize(MAX_WIDTH, MAX_WIDTH * image->get_height() / image->get_width(), Image::INTERPOLATE_BILINEAR);
+    image->convert(Image::FORMAT_RGBAF);
+
+    const int width = image->get_width();
+    const int height = image->get_height();
+    const PackedByteArray data = image->get_data();
+    const float *texels = reinterpret_cast<const float *>(data.ptr());
+
+    header.width = width;
+    header.height = height;
+    cdf.assign(height + static_cast<size_t>(width) * height, 0.0f);
+    float *marginal = cdf.data();
+    float *conditional = cdf.data() + height;
+
+    double total = 0.0;
+    for (int y = 0; y < height; y++)
+    {
+        const float sin_theta = std::sin(Math_PI * (y + 0.5f) / height);
+        float *row_cdf = conditional + static_cast<size_t>(y) * width;
+        double row = 0.0;
+        for (int x = 0; x < width; x++)
+        {
+            const float *texel = texels + (static_cast<size_t>(y) * width + x) * 4;
+            row += (0.2126f * texel[0] + 0.7152f * texel[1] + 0.0722f * texel[2]) * sin_theta;
+            row_cdf[x] = static_cast<float>(row);
+        }
+        for (int x = 0; x < width; x++) // black rows fall back to uniform, they are never picked anyway
+            row_cdf[x] = row > 0.0 ? static_cast<float>(row_cdf[x] / row) : (x + 1.0f) / width;
+        total += row;
+        marginal[y] = static_cast<float>(total);
+    }
+    for (int y = 0; y < height; y++)
+        marginal[y] = total > 0.0 ? static_cast<float>(marginal[y] / total) : (y + 1.0f) / height;
+    header.integral = static_cast<float>(total);
+}
+
+bool EnvironmentMap::is_valid() const
+{
+    return header.integral > 0.0f;
+}
+
+Ref<Image> EnvironmentMap::get_image() const
+{
+    return image.is_valid() ? image : Image::create(1, 1, false, Image::FORMAT_RGBAF);
+}
+
+PackedByteArray EnvironmentMap::get_distribution_buffer() const
+{
+    PackedByteArray byte_array;
+    byte_array.resize(sizeof(DistributionHeader) + cdf.size() * sizeof(float));
+    std::memcpy(byte_array.ptrw(), &header, sizeof(DistributionHeader));
+    std::memcpy(byte_array.ptrw() + sizeof(DistributionHeader), cdf.data(), cdf.size() * sizeof(float));
+    return byte_array;
+}
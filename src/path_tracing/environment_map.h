@@ -0,0 +1,41 @@
+#ifndef ENVIRONMENT_MAP_H
+#define ENVIRONMENT_MAP_H
+
+#include <godot_cpp/classes/image.hpp>
+#include <godot_cpp/classes/texture2d.hpp>
+#include <godot_cpp/variant/packed_byte_array.hpp>
+#include <godot_cpp/variant/utility_functions.hpp>
+#include <vector>
+
+using namespace godot;
+
+// Equirectangular environment with the distribution main.glsl importance samples it with. Every texel is weighted by
+// its luminance times sin(theta), the shader picks a row from the marginal cdf and a texel from the row's conditional
+// cdf, such that a small bright sun is found with a single sample.
+class EnvironmentMap
+{
+  public:
+    struct DistributionHeader // match the struct on the gpu, followed by the cdf values
+    {
+        unsigned int width = 1;
+        unsigned int height = 1;
+        float integral = 0.0f;
+        float intensity = 1.0f;
+    };
+
+    void build(const Ref<Texture2D> &panorama, float intensity);
+    bool is_valid() const;
+
+    // RGBAF radiance, a single black texel without a panorama
+    Ref<Image> get_image() const;
+    PackedByteArray get_distribution_buffer() const;
+
+  private:
+    static const int MAX_WIDTH = 4096;
+
+    Ref<Image> image;
+    DistributionHeader header;
+    std::vector<float> cdf; // height marginal entries, then width conditional entries per row
+};
+
+#endif // ENVIRONMENT_MAP_H
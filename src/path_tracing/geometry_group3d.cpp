@@ -67,6 +67,59 @@ PackedByteArray GeometryGroup3D::get_tlas_buffer()
     return get_buffer(tlas_nodes);
 }
 
+PackedByteArray GeometryGroup3D::get_bvh_links_buffer()
+{
+    return get_buffer(bvh_links);
+}
+
+int GeometryGroup3D::get_emitter_count()
+{
+    return emitters.size();
+}
+
+PackedByteArray GeometryGroup3D::get_emitters_buffer()
+{
+    GpuEmittersHeader header = {static_cast<unsigned int>(emitters.size()), emitter_power, {0, 0}};
+    const size_t count = std::max<size_t>(emitters.size(), 1); // storage buffers can not be empty
+    PackedByteArray byte_array;
+    byte_array.resize(sizeof(GpuEmittersHeader) + count * sizeof(GpuEmitter));
+    std::memset(byte_array.ptrw(), 0, byte_array.size());
+    std::memcpy(byte_array.ptrw(), &header, sizeof(GpuEmittersHeader));
+    if (!emitters.empty())
+        std::memcpy(byte_array.ptrw() + sizeof(GpuEmittersHeader), emitters.data(), emitters.size() * sizeof(GpuEmitter));
+    return byte_array;
+}
+
+const std::vector<Vector2i> &GeometryGroup3D::get_instance_triangles() const
+{
+    return instance_triangles;
+}
+
+const std::vector<GpuMaterial> &GeometryGroup3D::get_materials() const
+{
+    return materials;
+}
+
+const std::vector<GpuTriangleGeometry> &GeometryGroup3D::get_triangles_geometry() const
+{
+    return triangles_geometry;
+}
+
+const std::vector<GpuTriangleData> &GeometryGroup3D::get_triangles_data() const
+{
+    return triangles_data;
+}
+
+const std::vector<BLASInstance> &GeometryGroup3D::get_blas_instances() const
+{
+    return blas_instances;
+}
+
+PackedByteArray GeometryGroup3D::get_tlas_links_buffer()
+{
+    return get_buffer(tlas_links);
+}
+
 std::vector<Ref<Image>> GeometryGroup3D::get_textures_buffer()
 {
     return textures;
@@ -92,6 +145,41 @@ void GeometryGroup3D::set_texture_array_resolution(int value)
     texture_array_resolution = value;
 }
 
+Ref<Texture2D> GeometryGroup3D::get_environment() const
+{
+    return environment;
+}
+
+void GeometryGroup3D::set_environment(Ref<Texture2D> value)
+{
+    environment = value;
+}
+
+float GeometryGroup3D::get_environment_intensity() const
+{
+    return environment_intensity;
+}
+
+void GeometryGroup3D::set_environment_intensity(float value)
+{
+    environment_intensity = value;
+}
+
+bool GeometryGroup3D::has_environment() const
+{
+    return environment_map.is_valid();
+}
+
+Ref<Image> GeometryGroup3D::get_environment_image() const
+{
+    return environment_map.get_image();
+}
+
+PackedByteArray GeometryGroup3D::get_environment_distribution_buffer() const
+{
+    return environment_map.get_distribution_buffer();
+}
+
 void GeometryGroup3D::_bind_methods()
 {
     ClassDB::bind_method(D_METHOD("get_default_material"), &GeometryGroup3D::get_default_material);
@@ -102,6 +190,22 @@ void GeometryGroup3D::_bind_methods()
     ClassDB::bind_method(D_METHOD("get_texture_array_resolution"), &GeometryGroup3D::get_texture_array_resolution);
     ClassDB::bind_method(D_METHOD("set_texture_array_resolution", "value"), &GeometryGroup3D::set_texture_array_resolution);
     ADD_PROPERTY(PropertyInfo(Variant::INT, "texture_array_resolution"), "set_texture_array_resolution", "get_texture_array_resolution");
+
+    ClassDB::bind_method(D_METHOD("get_environment"), &GeometryGroup3D::get_environment);
+    ClassDB::bind_method(D_METHOD("set_environment", "value"), &GeometryGroup3D::set_environment);
+    ADD_PROPERTY(PropertyInfo(Variant::OBJECT, "environment", PROPERTY_HINT_RESOURCE_TYPE, "Texture2D"),
+                 "set_environment", "get_environment");
+
+    ClassDB::bind_method(D_METHOD("get_environment_intensity"), &GeometryGroup3D::get_environment_intensity);
+    ClassDB::bind_method(D_METHOD("set_environment_intensity", "value"), &GeometryGroup3D::set_environment_intensity);
+    ADD_PROPERTY(PropertyInfo(Variant::FLOAT, "environment_intensity", PROPERTY_HINT_RANGE, "0,100,0.01"),
+                 "set_environment_intensity", "get_environment_intensity");
+
+    ClassDB::bind_method(D_METHOD("intersect_ray", "origin", "direction", "max_distance"),
+                         &GeometryGroup3D::intersect_ray, DEFVAL(1e9f));
+    ClassDB::bind_method(D_METHOD("intersect_rays", "origins", "directions", "max_distance"),
+                         &GeometryGroup3D::intersect_rays, DEFVAL(1e9f));
+    ClassDB::bind_method(D_METHOD("is_occluded", "from", "to"), &GeometryGroup3D::is_occluded);
 }
 
 void GeometryGroup3D::_notification(int p_what)
@@ -227,14 +331,19 @@ Ref<ArrayMesh> mesh_to_array_mesh(const Ref<Mesh> mesh)
 
 void GeometryGroup3D::build()
 {
+    std::unique_lock<std::shared_mutex> lock(scene_mutex);
     initial_geometry_references.clear();
     final_geometry_references.clear();
     node_references.clear();
     material_references.clear();
     initial_material_references.clear();
     tlas_nodes.clear();
+    tlas_links.clear();
     bvh_nodes.clear();
+    bvh_links.clear();
     blas_instances.clear();
+    instance_ids.clear();
+    instance_triangles.clear();
     // ensure existence of some default material
     if (default_material.is_null())
     {
@@ -246,6 +355,8 @@ void GeometryGroup3D::build()
     initial_material_references.push_back(default_material);
     material_references.push_back(default_material);
 
+    environment_map.build(environment, environment_intensity);
+
     collect_mesh_instances();
 
     for (const auto &mesh : initial_geometry_references)
@@ -304,13 +415,16 @@ void GeometryGroup3D::build()
     }
     // build the bvh for each unique mesh
     std::vector<unsigned int> root_ids;
+    std::vector<unsigned int> mesh_first_triangle; // triangles of a mesh are contiguous after building
 
     BVHBuilder builder;
     for (size_t i = 0; i < final_geometry_references.size(); i++)
     {
-        unsigned int root = builder.BuildBVH(bvh_nodes, triangles, final_geometry_references[i]);
+        mesh_first_triangle.push_back(triangles.size());
+        unsigned int root = build_mesh_bvh(builder, bvh_nodes, bvh_links, triangles, final_geometry_references[i]);
         root_ids.push_back(root);
     }
+    mesh_first_triangle.push_back(triangles.size());
 #ifdef VERBOSE_BVH_BUILDING
     UtilityFunctions::print("nodes, triangles, materials:");
     UtilityFunctions::print(bvh_nodes.size());
@@ -328,9 +442,13 @@ void GeometryGroup3D::build()
         BLASInstance blas_instance;
         blas_instance.blas_index = root_ids[node_references[i].mesh_id];
         blas_instance.set_materials(node_references[i].material_ids);
-        blas_instance.set_transform(node_references[i].node->get_global_transform(), bvh_nodes);
+        set_instance_transform(blas_instance, node_references[i].node->get_global_transform(), bvh_nodes);
+        blas_instance.reset_previous_transform();
 
         blas_instances.push_back(blas_instance);
+        instance_ids.push_back(node_references[i].node->get_instance_id());
+        const int mesh = node_references[i].mesh_id;
+        instance_triangles.push_back(Vector2i(mesh_first_triangle[mesh], mesh_first_triangle[mesh + 1] - mesh_first_triangle[mesh]));
 #ifdef VERBOSE_BVH_BUILDING
         UtilityFunctions::print("root:");
         UtilityFunctions::print(blas_instance.blas_index);
@@ -349,18 +467,211 @@ void GeometryGroup3D::build()
     // create tlas tree; https://jacco.ompf2.com/2022/05/13/how-to-build-a-bvh-part-6-all-together-now/
     TLAS tlas;
     tlas.build(tlas_nodes, blas_instances);
+    tlas.build_links(tlas_nodes, tlas_links);
 #ifdef VERBOSE_BVH_BUILDING
     tlas.print_tree(tlas_nodes);
 #endif
 
     triangles_geometry.clear();
     triangles_data.clear();
-    // once done building, populate the GPU triangle arrays
+    // once done building, populate the GPU triangle arrays. The builder sorted triangles into leaf order already.
     for (size_t i = 0; i < triangles.size(); i++)
     {
         Triangle tri = triangles[i];
-        triangles_geometry.push_back(GpuTriangleGeometry{tri.vertices[0], tri.vertices[1], tri.vertices[2]});
+        triangles_geometry.push_back(
+            GpuTriangleGeometry{tri.vertices[0], tri.vertices[1] - tri.vertices[0], tri.vertices[2] - tri.vertices[0]});
         triangles_data.push_back(GpuTriangleData{tri.normals[0], tri.materialIndex, tri.normals[1], tri.normals[2],
                                                  tri.uvs[0], tri.uvs[1], tri.uvs[2]});
     }
+
+    build_emitters(mesh_first_triangle);
+}
+
+// Follows the mesh instances after build, the transform of the last update is kept for motion vectors.
+// Returns true if the blas and tlas buffers changed and have to be uploaded again.
+bool GeometryGroup3D::update_transforms()
+{
+    std::unique_lock<std::shared_mutex> lock(scene_mutex);
+    bool changed = false;
+    bool moved = false;
+    for (size_t i = 0; i < blas_instances.size(); i++)
+    {
+        Node3D *node = Object::cast_to<Node3D>(ObjectDB::get_instance(instance_ids[i]));
+        if (node == nullptr)
+            continue;
+        BLASInstance &instance = blas_instances[i];
+        float transform[16];
+        Utils::transform_to_float(transform, node->get_global_transform());
+        if (std::memcmp(transform, instance.transform, sizeof(transform)) != 0)
+        {
+            set_instance_transform(instance, node->get_global_transform(), bvh_nodes);
+            moved = true;
+            changed = true;
+        }
+        else if (instance.is_moving())
+        { // came to rest, the motion of the last frame is over
+            instance.reset_previous_transform();
+            changed = true;
+        }
+    }
+
+    if (moved)
+    { // the instance count is unchanged, so the rebuilt tlas keeps its size
+        tlas_nodes.clear();
+        tlas_links.clear();
+        TLAS tlas;
+        tlas.build(tlas_nodes, blas_instances);
+        tlas.build_links(tlas_nodes, tlas_links);
+    }
+    return changed;
+}
+
+void GeometryGroup3D::build_emitters(const std::vector<unsigned int> &mesh_first_triangle)
+{
+    emitters.clear();
+    emitter_power = 0.0f;
+
+    // every emissive triangle of every instance, weighted by its world space area times emitted luminance
+    std::vector<float> power;
+    unsigned int blas = 0;
+    for (size_t i = 0; i < node_references.size(); i++)
+    {
+        if (node_references[i].node == nullptr)
+            continue;
+        const BLASInstance &instance = blas_instances[blas];
+        const Transform3D transform = node_references[i].node->get_global_transform();
+        const int mesh = node_references[i].mesh_id;
+        for (unsigned int t = mesh_first_triangle[mesh]; t < mesh_first_triangle[mesh + 1]; t++)
+        {
+            const Triangle &tri = triangles[t];
+            const unsigned int material = instance.material[std::min(tri.materialIndex, 2u)];
+            if (material >= materials.size())
+                continue;
+            const BVH::vec4 e = materials[material].emission;
+            const float luminance = (0.2126f * e.x + 0.7152f * e.y + 0.0722f * e.z) * std::max(0.0f, e.w);
+            if (luminance <= 0.0f)
+                continue;
+
+            Vector3 v[3];
+            for (int k = 0; k < 3; k++)
+                v[k] = transform.xform(Vector3(tri.vertices[k].x, tri.vertices[k].y, tri.vertices[k].z));
+            const float area = 0.5f * (v[1] - v[0]).cross(v[2] - v[0]).length();
+            if (area <= 0.0f)
+                continue;
+
+            GpuEmitter emitter = {};
+            emitter.blas = blas;
+            emitter.triangle = t;
+            emitters.push_back(emitter);
+            power.push_back(luminance * area);
+            emitter_power += luminance * area;
+        }
+        blas++;
+    }
+
+    // alias table (Vose), such that the gpu picks an emitter proportional to its power in constant time
+    const size_t n = emitters.size();
+    std::vector<float> scaled(n);
+    std::vector<size_t> small, large;
+    for (size_t i = 0; i < n; i++)
+    {
+        emitters[i].probability = power[i] / emitter_power;
+        scaled[i] = emitters[i].probability * n;
+        (scaled[i] < 1.0f ? small : large).push_back(i);
+    }
+    while (!small.empty() && !large.empty())
+    {
+        size_t less = small.back();
+        small.pop_back();
+        size_t more = large.back();
+        large.pop_back();
+        emitters[less].threshold = scaled[less];
+        emitters[less].alias = more;
+        scaled[more] += scaled[less] - 1.0f;
+        (scaled[more] < 1.0f ? small : large).push_back(more);
+    }
+    // leftovers are only off from 1 by rounding
+    small.insert(small.end(), large.begin(), large.end());
+    for (size_t i : small)
+    {
+        emitters[i].threshold = 1.0f;
+        emitters[i].alias = i;
+    }
+}
+
+//--------- RAY QUERIES ---------
+
+RayQuery GeometryGroup3D::get_ray_query() const
+{
+    return RayQuery(tlas_nodes, blas_instances, bvh_nodes, triangles_geometry);
+}
+
+Dictionary GeometryGroup3D::intersect_ray(const Vector3 &origin, const Vector3 &direction, float max_distance) const
+{
+    std::shared_lock<std::shared_mutex> lock(scene_mutex);
+    Dictionary result;
+    const Vector3 dir = direction.normalized();
+    const vec3 ray_origin = Utils::to_vec3(origin);
+    const vec3 ray_direction = Utils::to_vec3(dir);
+    RayHit hit;
+    get_ray_query().intersect(&ray_origin, &ray_direction, 1, max_distance, &hit);
+    if (hit.t == INFINITY)
+        return result;
+
+    // geometric normal in world space, with the inverse transpose of the instance transform, facing the ray
+    const BLASInstance &instance = blas_instances[hit.instance];
+    const GpuTriangleGeometry &tri = triangles_geometry[hit.triangle];
+    const Vector3 local_normal = Vector3(tri.edge1.x, tri.edge1.y, tri.edge1.z).cross(Vector3(tri.edge2.x, tri.edge2.y, tri.edge2.z));
+    const float *m = instance.inverse_transform;
+    Vector3 normal;
+    for (int i = 0; i < 3; i++)
+        normal[i] = m[i * 4] * local_normal.x + m[i * 4 + 1] * local_normal.y + m[i * 4 + 2] * local_normal.z;
+    normal = normal.normalized();
+    if (normal.dot(dir) > 0.0f)
+        normal = -normal;
+
+    result["position"] = origin + dir * hit.t;
+    result["normal"] = normal;
+    result["distance"] = hit.t;
+    result["collider_id"] = instance_ids[hit.instance];
+    result["collider"] = ObjectDB::get_instance(instance_ids[hit.instance]);
+    return result;
+}
+
+PackedFloat32Array GeometryGroup3D::intersect_rays(const PackedVector3Array &origins,
+                                                   const PackedVector3Array &directions, float max_distance) const
+{
+    PackedFloat32Array result;
+    if (origins.size() != directions.size())
+    {
+        UtilityFunctions::printerr("intersect_rays: origins and directions differ in size.");
+        return result;
+    }
+    const int count = origins.size();
+    std::vector<vec3> ray_origins(count);
+    std::vector<vec3> normalized(count);
+    for (int i = 0; i < count; i++)
+    {
+        ray_origins[i] = Utils::to_vec3(origins[i]);
+        normalized[i] = Utils::to_vec3(directions[i].normalized());
+    }
+    std::vector<RayHit> hits(count);
+    std::shared_lock<std::shared_mutex> lock(scene_mutex);
+    get_ray_query().intersect(ray_origins.data(), normalized.data(), count, max_distance, hits.data());
+
+    result.resize(count);
+    float *distances = result.ptrw();
+    for (int i = 0; i < count; i++)
+        distances[i] = hits[i].t;
+    return result;
+}
+
+bool GeometryGroup3D::is_occluded(const Vector3 &from, const Vector3 &to) const
+{
+    const vec3 segment_from = Utils::to_vec3(from);
+    const vec3 segment_to = Utils::to_vec3(to);
+    uint8_t occluded = 0;
+    std::shared_lock<std::shared_mutex> lock(scene_mutex);
+    get_ray_query().occluded(&segment_from, &segment_to, 1, &occluded);
+    return occluded != 0;
 }
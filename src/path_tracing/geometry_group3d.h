@@ -12,12 +12,18 @@
 #include <godot_cpp/classes/image.hpp>
 #include <godot_cpp/classes/texture2d_array.hpp>
 #include <godot_cpp/core/class_db.hpp>
+#include <godot_cpp/variant/dictionary.hpp>
+#include <godot_cpp/variant/packed_float32_array.hpp>
+#include <godot_cpp/variant/packed_vector3_array.hpp>
 #include <godot_cpp/variant/utility_functions.hpp>
 #include <vector>
 #include <queue>
+#include <shared_mutex>
 
+#include "environment_map.h"
 #include "render_parameters.h"
-#include "bvh/bvh.h"
+#include "ray_query.h"
+#include "bvh/bvh_godot.h"
 
 using namespace godot;
 using namespace BVH;
@@ -54,23 +60,39 @@ class GeometryGroup3D : public Node3D
 
     //Actual buffers to send to the GPU
     std::vector<BVHNode> bvh_nodes;
+    std::vector<unsigned int> bvh_links; // parent links for stackless traversal
     std::vector<TLASNode> tlas_nodes;
+    std::vector<unsigned int> tlas_links;
     std::vector<Triangle> triangles;
     std::vector<GpuTriangleGeometry> triangles_geometry;
     std::vector<GpuTriangleData> triangles_data;
     std::vector<BLASInstance> blas_instances;
+    std::vector<uint64_t> instance_ids; // mesh instance of every blas instance, to follow it when it moves
+    std::vector<Vector2i> instance_triangles; // first triangle and triangle count of every blas instance
     std::vector<Ref<Image>> textures;
+    std::vector<GpuEmitter> emitters;
+    float emitter_power = 0.0f;
 
     int texture_array_resolution = 1024; // New property
 
+    Ref<Texture2D> environment; // equirectangular panorama lighting the scene, the sky gradient is used without one
+    float environment_intensity = 1.0f;
+    EnvironmentMap environment_map;
+
+    // build and update_transforms hold it exclusively, the ray queries shared, such that gameplay threads may query
+    // while the camera moves the instances
+    mutable std::shared_mutex scene_mutex;
+
     unsigned int get_material_index(const Ref<Material> &material);
     int get_texture_index(const Ref<Texture2D> &texture);
 
     void collect_mesh_instances();
+    void build_emitters(const std::vector<unsigned int> &mesh_first_triangle);
     
 
   public:
     void build();
+    bool update_transforms();
     GeometryGroup3D();
 
     int get_blas_count();
@@ -78,6 +100,7 @@ class GeometryGroup3D : public Node3D
     int get_triangle_count();
     int get_bvh_node_count();
     int get_tlas_node_count();
+    int get_emitter_count();
 
     PackedByteArray get_triangles_geometry_buffer();
     PackedByteArray get_triangles_data_buffer();
@@ -85,13 +108,43 @@ class GeometryGroup3D : public Node3D
     PackedByteArray get_bvh_buffer();
     PackedByteArray get_blas_buffer();
     PackedByteArray get_tlas_buffer();
+    PackedByteArray get_bvh_links_buffer();
+    PackedByteArray get_tlas_links_buffer();
+    PackedByteArray get_emitters_buffer();
+    const std::vector<Vector2i> &get_instance_triangles() const;
+    // the cpu side of the scene buffers, for the cpu reference renderer
+    const std::vector<GpuMaterial> &get_materials() const;
+    const std::vector<GpuTriangleGeometry> &get_triangles_geometry() const;
+    const std::vector<GpuTriangleData> &get_triangles_data() const;
+    const std::vector<BLASInstance> &get_blas_instances() const;
+    // references the scene vectors without holding scene_mutex, only use it on the thread that builds and updates
+    RayQuery get_ray_query() const;
     std::vector<Ref<Image>> get_textures_buffer();
+    bool has_environment() const;
+    Ref<Image> get_environment_image() const;
+    PackedByteArray get_environment_distribution_buffer() const;
 
     Ref<StandardMaterial3D> get_default_material() const;
     void set_default_material(Ref<StandardMaterial3D> value);
 
     int get_texture_array_resolution() const;
     void set_texture_array_resolution(int value);
+
+    Ref<Texture2D> get_environment() const;
+    void set_environment(Ref<Texture2D> value);
+
+    float get_environment_intensity() const;
+    void set_environment_intensity(float value);
+
+    // cpu ray queries against the scene as of the last build or update_transforms, for gameplay such as line of
+    // sight. Directions need not be normalized, distances are in world units. Safe to call from any thread, a query
+    // waits for a build or update_transforms in progress.
+    Dictionary intersect_ray(const Vector3 &origin, const Vector3 &direction, float max_distance = 1e9f) const;
+    // distance to the closest hit of every ray, INF where a ray hits nothing within max_distance
+    PackedFloat32Array intersect_rays(const PackedVector3Array &origins, const PackedVector3Array &directions,
+                                      float max_distance = 1e9f) const;
+    // whether anything lies between from and to, surfaces at from or to themselves do not count
+    bool is_occluded(const Vector3 &from, const Vector3 &to) const;
 };
 
 #endif // GEOMETRY_GROUP3D_H
@@ -0,0 +1,97 @@
+#include "gpu_timer.h"
+
+void GpuTimer::init(RenderingDevice *rd)
+{
+    this->rd = rd;
+}
+
+void GpuTimer::begin(const String &pass)
+{
+    rd->capture_timestamp(pass + ":begin");
+    begin_cpu(pass);
+}
+
+void GpuTimer::end(const String &pass)
+{
+    rd->capture_timestamp(pass + ":end");
+    end_cpu(pass);
+}
+
+void GpuTimer::begin_cpu(const String &pass)
+{
+    cpu_begin[pass] = Time::get_singleton()->get_ticks_usec();
+}
+
+void GpuTimer::end_cpu(const String &pass)
+{
+    cpu_time_ms[pass] += (Time::get_singleton()->get_ticks_usec() - cpu_begin[pass]) / 1000.0f;
+    pass_count[pass]++;
+}
+
+void GpuTimer::resolve()
+{
+    if (rd == nullptr)
+        return;
+
+    // pair up begin and end markers of the same pass
+    std::map<String, uint64_t> gpu_begin;
+    std::map<String, float> gpu_time_ms;
+    const uint32_t count = rd->get_captured_timestamps_count();
+    for (uint32_t i = 0; i < count; i++)
+    {
+        const String name = rd->get_captured_timestamp_name(i);
+        const uint64_t time = rd->get_captured_timestamp_gpu_time(i);
+        if (name.ends_with(":begin"))
+        {
+            gpu_begin[name.trim_suffix(":begin")] = time;
+        }
+        else if (name.ends_with(":end"))
+        {
+            const String pass = name.trim_suffix(":end");
+            auto begin = gpu_begin.find(pass);
+            if (begin != gpu_begin.end() && time >= begin->second)
+                gpu_time_ms[pass] += (time - begin->second) / 1000.0f;
+        }
+    }
+
+    // the device keeps the timestamps of its last frame, passes that did not run since are not reported again
+    resolved_time_ms = cpu_time_ms;
+    resolved_gpu.clear();
+    for (const auto &gpu : gpu_time_ms)
+    {
+        if (pass_count.count(gpu.first) > 0)
+        {
+            resolved_time_ms[gpu.first] = gpu.second;
+            resolved_gpu[gpu.first] = true;
+        }
+    }
+    resolved_count = pass_count;
+
+    cpu_time_ms.clear();
+    pass_count.clear();
+}
+
+float GpuTimer::get_time_ms(const String &pass) const
+{
+    auto time = resolved_time_ms.find(pass);
+    return time != resolved_time_ms.end() ? time->second : 0.0f;
+}
+
+int GpuTimer::get_count(const String &pass) const
+{
+    auto count = resolved_count.find(pass);
+    return count != resolved_count.end() ? count->second : 0;
+}
+
+bool GpuTimer::is_gpu_timed(const String &pass) const
+{
+    return resolved_gpu.count(pass) > 0;
+}
+
+std::vector<String> GpuTimer::get_passes() const
+{
+    std::vector<String> passes;
+    for (const auto &count : resolved_count)
+        passes.push_back(count.first);
+    return passes;
+}
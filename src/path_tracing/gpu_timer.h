@@ -0,0 +1,51 @@
+#ifndef GPU_TIMER_H
+#define GPU_TIMER_H
+
+#include <godot_cpp/classes/rendering_device.hpp>
+#include <godot_cpp/classes/time.hpp>
+#include <godot_cpp/variant/string.hpp>
+#include <map>
+#include <vector>
+
+using namespace godot;
+
+// Times passes on the RenderingDevice with timestamp queries. Timestamps of a submission can only be read once the
+// device has synced, so the results of a frame are collected by resolve() at the start of the next one.
+// A local device keeps the timestamps of its last sync only: a frame has to sync exactly once, with every pass
+// recorded before that readback, and resolve() has to run before any other readback replaces them.
+// Passes whose timestamps are not available fall back to the cpu time between begin and end.
+class GpuTimer
+{
+  public:
+    void init(RenderingDevice *rd);
+
+    void begin(const String &pass);
+    void end(const String &pass);
+    // cpu time only, for work that records no gpu commands, e.g. readbacks and buffer updates
+    void begin_cpu(const String &pass);
+    void end_cpu(const String &pass);
+
+    // collects the timings of the previous frame, call once per frame before recording new passes
+    void resolve();
+
+    // total time in ms spent in a pass during the last resolved frame, a pass may run several times per frame
+    float get_time_ms(const String &pass) const;
+    int get_count(const String &pass) const;
+    // whether the time of a pass came from timestamps rather than the cpu fallback
+    bool is_gpu_timed(const String &pass) const;
+    // passes timed in the last resolved frame
+    std::vector<String> get_passes() const;
+
+  private:
+    RenderingDevice *rd = nullptr;
+
+    std::map<String, uint64_t> cpu_begin;
+    std::map<String, float> cpu_time_ms;
+    std::map<String, int> pass_count;
+
+    std::map<String, float> resolved_time_ms;
+    std::map<String, int> resolved_count;
+    std::map<String, bool> resolved_gpu;
+};
+
+#endif // GPU_TIMER_H
@@ -0,0 +1,128 @@
+#ifndef PARALLEL_FOR_H
+#define PARALLEL_FOR_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Threads that live as long as the library, such that a batch of ray queries does not pay for starting threads.
+// One job runs at a time: a parallel_for from another thread, or from inside a job, runs on its calling thread.
+class WorkerPool
+{
+  public:
+    static WorkerPool &get()
+    {
+        static WorkerPool pool;
+        return pool;
+    }
+
+    // body(i) for every i in [0, count), in chunks of consecutive indices taken from a shared counter, such that
+    // neighbouring work items stay on one thread while uneven items still balance. The calling thread takes part.
+    void run(const int count, const int chunk, const std::function<void(int)> &body)
+    {
+        const int chunks = (count + chunk - 1) / chunk;
+        std::unique_lock<std::mutex> job_lock(job_mutex, std::try_to_lock);
+        if (chunks <= 1 || threads.empty() || !job_lock.owns_lock())
+        {
+            for (int i = 0; i < count; i++)
+                body(i);
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            job = {&body, count, chunk, chunks};
+            next = 0;
+            generation++;
+        }
+        wake.notify_all();
+        run_chunks(job);
+
+        // workers that joined this job may still be in their last chunk
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock, [&]() { return busy == 0; });
+        job = Job();
+    }
+
+  private:
+    struct Job
+    {
+        const std::function<void(int)> *body = nullptr;
+        int count = 0;
+        int chunk = 1;
+        int chunks = 0;
+    };
+
+    WorkerPool()
+    {
+        const int count = static_cast<int>(std::max(1u, std::thread::hardware_concurrency())) - 1;
+        for (int i = 0; i < count; i++)
+            threads.emplace_back([this]() { work(); });
+    }
+
+    ~WorkerPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (std::thread &thread : threads)
+            thread.join();
+    }
+
+    void run_chunks(const Job &current)
+    {
+        for (int c = next++; c < current.chunks; c = next++)
+        {
+            for (int i = c * current.chunk; i < std::min(current.count, (c + 1) * current.chunk); i++)
+                (*current.body)(i);
+        }
+    }
+
+    void work()
+    {
+        uint64_t seen = 0;
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true)
+        {
+            wake.wait(lock, [&]() { return stopping || generation != seen; });
+            if (stopping)
+                return;
+            seen = generation;
+            const Job current = job; // an idle job when its caller already finished every chunk
+            busy++;
+            lock.unlock();
+            if (current.body != nullptr)
+                run_chunks(current);
+            lock.lock();
+            if (--busy == 0)
+                done.notify_all();
+        }
+    }
+
+    std::vector<std::thread> threads;
+    std::mutex job_mutex; // held by the caller of the running job
+    std::mutex mutex;     // guards job, generation, busy and stopping
+    std::condition_variable wake;
+    std::condition_variable done;
+    Job job;
+    std::atomic<int> next{0};
+    uint64_t generation = 0;
+    int busy = 0;
+    bool stopping = false;
+};
+
+// Runs body(i) for every i in [0, count) on the worker pool and the calling thread. A single chunk runs on the
+// calling thread alone.
+template <typename Body> void parallel_for(const int count, const int chunk, const Body &body)
+{
+    WorkerPool::get().run(count, chunk, std::function<void(int)>(std::cref(body)));
+}
+
+#endif // PARALLEL_FOR_H
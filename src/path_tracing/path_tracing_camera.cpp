@@ -6,9 +6,9 @@ void PathTracingCamera::_bind_methods()
     ClassDB::bind_method(D_METHOD("set_fov", "value"), &PathTracingCamera::set_fov);
     ADD_PROPERTY(PropertyInfo(Variant::FLOAT, "fov"), "set_fov", "get_fov");
 
-    // ClassDB::bind_method(D_METHOD("get_num_bounces"), &PathTracingCamera::get_num_bounces);
-    // ClassDB::bind_method(D_METHOD("set_num_bounces", "value"), &PathTracingCamera::set_num_bounces);
-    // ADD_PROPERTY(PropertyInfo(Variant::INT, "num_bounces"), "set_num_bounces", "get_num_bounces");
+    ClassDB::bind_method(D_METHOD("get_num_bounces"), &PathTracingCamera::get_num_bounces);
+    ClassDB::bind_method(D_METHOD("set_num_bounces", "value"), &PathTracingCamera::set_num_bounces);
+    ADD_PROPERTY(PropertyInfo(Variant::INT, "num_bounces", PROPERTY_HINT_RANGE, "1,32"), "set_num_bounces", "get_num_bounces");
 
     ClassDB::bind_method(D_METHOD("get_output_texture"), &PathTracingCamera::get_output_texture);
     ClassDB::bind_method(D_METHOD("set_output_texture", "value"), &PathTracingCamera::set_output_texture);
@@ -22,12 +22,199 @@ void PathTracingCamera::_bind_methods()
 
     ClassDB::bind_method(D_METHOD("get_denoising_mode"), &PathTracingCamera::get_denoising_mode);
     ClassDB::bind_method(D_METHOD("set_denoising_mode", "mode"), &PathTracingCamera::set_denoising_mode);
-    ADD_PROPERTY(PropertyInfo(Variant::INT, "denoising_mode", PROPERTY_HINT_ENUM, "Progressive Rendering,Temporal Reprojection,None"),
+    ADD_PROPERTY(PropertyInfo(Variant::INT, "denoising_mode", PROPERTY_HINT_ENUM, "Progressive Rendering,Temporal Reprojection,None,SVGF"),
                  "set_denoising_mode", "get_denoising_mode");
 
+    ClassDB::bind_method(D_METHOD("get_svgf_iterations"), &PathTracingCamera::get_svgf_iterations);
+    ClassDB::bind_method(D_METHOD("set_svgf_iterations", "value"), &PathTracingCamera::set_svgf_iterations);
+    ADD_PROPERTY(PropertyInfo(Variant::INT, "svgf_iterations", PROPERTY_HINT_RANGE, "1,10"), "set_svgf_iterations",
+                 "get_svgf_iterations");
+
+    ClassDB::bind_method(D_METHOD("get_ray_sorting"), &PathTracingCamera::get_ray_sorting);
+    ClassDB::bind_method(D_METHOD("set_ray_sorting", "value"), &PathTracingCamera::set_ray_sorting);
+    ADD_PROPERTY(PropertyInfo(Variant::BOOL, "ray_sorting"), "set_ray_sorting", "get_ray_sorting");
+
+    ClassDB::bind_method(D_METHOD("get_samples_per_frame"), &PathTracingCamera::get_samples_per_frame);
+    ClassDB::bind_method(D_METHOD("set_samples_per_frame", "value"), &PathTracingCamera::set_samples_per_frame);
+    ADD_PROPERTY(PropertyInfo(Variant::INT, "samples_per_frame", PROPERTY_HINT_RANGE, "1,64"), "set_samples_per_frame",
+                 "get_samples_per_frame");
+
+    ClassDB::bind_method(D_METHOD("get_batch_frames"), &PathTracingCamera::get_batch_frames);
+    ClassDB::bind_method(D_METHOD("set_batch_frames", "value"), &PathTracingCamera::set_batch_frames);
+    ADD_PROPERTY(PropertyInfo(Variant::INT, "batch_frames", PROPERTY_HINT_RANGE, "1,1024"), "set_batch_frames",
+                 "get_batch_frames");
+
+    ClassDB::bind_method(D_METHOD("get_debug_steps"), &PathTracingCamera::get_debug_steps);
+    ClassDB::bind_method(D_METHOD("set_debug_steps", "value"), &PathTracingCamera::set_debug_steps);
+    ADD_PROPERTY(PropertyInfo(Variant::BOOL, "debug_steps"), "set_debug_steps", "get_debug_steps");
+
+    ClassDB::bind_method(D_METHOD("get_texture_sampling"), &PathTracingCamera::get_texture_sampling);
+    ClassDB::bind_method(D_METHOD("set_texture_sampling", "value"), &PathTracingCamera::set_texture_sampling);
+    ADD_PROPERTY(PropertyInfo(Variant::BOOL, "texture_sampling"), "set_texture_sampling", "get_texture_sampling");
+
+    ClassDB::bind_method(D_METHOD("get_use_shader_cache"), &PathTracingCamera::get_use_shader_cache);
+    ClassDB::bind_method(D_METHOD("set_use_shader_cache", "value"), &PathTracingCamera::set_use_shader_cache);
+    ADD_PROPERTY(PropertyInfo(Variant::BOOL, "use_shader_cache"), "set_use_shader_cache", "get_use_shader_cache");
+
+    ClassDB::bind_method(D_METHOD("clear_shader_cache"), &PathTracingCamera::clear_shader_cache);
+
+    ClassDB::bind_method(D_METHOD("get_adaptive_sampling"), &PathTracingCamera::get_adaptive_sampling);
+    ClassDB::bind_method(D_METHOD("set_adaptive_sampling", "value"), &PathTracingCamera::set_adaptive_sampling);
+    ADD_PROPERTY(PropertyInfo(Variant::BOOL, "adaptive_sampling"), "set_adaptive_sampling", "get_adaptive_sampling");
+
+    ClassDB::bind_method(D_METHOD("get_adaptive_threshold"), &PathTracingCamera::get_adaptive_threshold);
+    ClassDB::bind_method(D_METHOD("set_adaptive_threshold", "value"), &PathTracingCamera::set_adaptive_threshold);
+    ADD_PROPERTY(PropertyInfo(Variant::FLOAT, "adaptive_threshold", PROPERTY_HINT_RANGE, "0.001,0.5,0.001"),
+                 "set_adaptive_threshold", "get_adaptive_threshold");
+
+    ClassDB::bind_method(D_METHOD("get_adaptive_min_samples"), &PathTracingCamera::get_adaptive_min_samples);
+    ClassDB::bind_method(D_METHOD("set_adaptive_min_samples", "value"), &PathTracingCamera::set_adaptive_min_samples);
+    ADD_PROPERTY(PropertyInfo(Variant::INT, "adaptive_min_samples", PROPERTY_HINT_RANGE, "1,1024"),
+                 "set_adaptive_min_samples", "get_adaptive_min_samples");
+
+    ClassDB::bind_method(D_METHOD("get_convergence_fraction"), &PathTracingCamera::get_convergence_fraction);
+    ClassDB::bind_method(D_METHOD("set_convergence_fraction", "value"), &PathTracingCamera::set_convergence_fraction);
+    ADD_PROPERTY(PropertyInfo(Variant::FLOAT, "convergence_fraction", PROPERTY_HINT_RANGE, "0,1,0.0001"),
+                 "set_convergence_fraction", "get_convergence_fraction");
+
+    ClassDB::bind_method(D_METHOD("get_tiled_rendering"), &PathTracingCamera::get_tiled_rendering);
+    ClassDB::bind_method(D_METHOD("set_tiled_rendering", "value"), &PathTracingCamera::set_tiled_rendering);
+    ADD_PROPERTY(PropertyInfo(Variant::BOOL, "tiled_rendering"), "set_tiled_rendering", "get_tiled_rendering");
+
+    ClassDB::bind_method(D_METHOD("get_tile_size"), &PathTracingCamera::get_tile_size);
+    ClassDB::bind_method(D_METHOD("set_tile_size", "value"), &PathTracingCamera::set_tile_size);
+    ADD_PROPERTY(PropertyInfo(Variant::INT, "tile_size", PROPERTY_HINT_RANGE, "32,2048"), "set_tile_size", "get_tile_size");
+
+    ClassDB::bind_method(D_METHOD("get_frame_budget_ms"), &PathTracingCamera::get_frame_budget_ms);
+    ClassDB::bind_method(D_METHOD("set_frame_budget_ms", "value"), &PathTracingCamera::set_frame_budget_ms);
+    ADD_PROPERTY(PropertyInfo(Variant::FLOAT, "frame_budget_ms", PROPERTY_HINT_RANGE, "1,1000,0.5"),
+                 "set_frame_budget_ms", "get_frame_budget_ms");
+
+    ClassDB::bind_method(D_METHOD("get_workgroup_size"), &PathTracingCamera::get_workgroup_size);
+    ClassDB::bind_method(D_METHOD("set_workgroup_size", "value"), &PathTracingCamera::set_workgroup_size);
+    ADD_PROPERTY(PropertyInfo(Variant::VECTOR2I, "workgroup_size"), "set_workgroup_size", "get_workgroup_size");
+
+    ClassDB::bind_method(D_METHOD("get_traversal"), &PathTracingCamera::get_traversal);
+    ClassDB::bind_method(D_METHOD("set_traversal", "value"), &PathTracingCamera::set_traversal);
+    ADD_PROPERTY(PropertyInfo(Variant::INT, "traversal", PROPERTY_HINT_ENUM, "Stack,Stackless"), "set_traversal", "get_traversal");
+
+    ClassDB::bind_method(D_METHOD("get_sampler"), &PathTracingCamera::get_sampler);
+    ClassDB::bind_method(D_METHOD("set_sampler", "value"), &PathTracingCamera::set_sampler);
+    ADD_PROPERTY(PropertyInfo(Variant::INT, "sampler", PROPERTY_HINT_ENUM, "Random,Sobol,Blue Noise"), "set_sampler", "get_sampler");
+
+    ClassDB::bind_method(D_METHOD("get_restir_di"), &PathTracingCamera::get_restir_di);
+    ClassDB::bind_method(D_METHOD("set_restir_di", "value"), &PathTracingCamera::set_restir_di);
+    ADD_PROPERTY(PropertyInfo(Variant::BOOL, "restir_di"), "set_restir_di", "get_restir_di");
+
+    ClassDB::bind_method(D_METHOD("get_hybrid_rendering"), &PathTracingCamera::get_hybrid_rendering);
+    ClassDB::bind_method(D_METHOD("set_hybrid_rendering", "value"), &PathTracingCamera::set_hybrid_rendering);
+    ADD_PROPERTY(PropertyInfo(Variant::BOOL, "hybrid_rendering"), "set_hybrid_rendering", "get_hybrid_rendering");
+
+    ClassDB::bind_method(D_METHOD("get_primary_cache_positions"), &PathTracingCamera::get_primary_cache_positions);
+    ClassDB::bind_method(D_METHOD("set_primary_cache_positions", "value"), &PathTracingCamera::set_primary_cache_positions);
+    ADD_PROPERTY(PropertyInfo(Variant::INT, "primary_cache_positions", PROPERTY_HINT_RANGE, "0,16,1"),
+                 "set_primary_cache_positions", "get_primary_cache_positions");
+
+    ClassDB::bind_method(D_METHOD("get_interleave"), &PathTracingCamera::get_interleave);
+    ClassDB::bind_method(D_METHOD("set_interleave", "value"), &PathTracingCamera::set_interleave);
+    ADD_PROPERTY(PropertyInfo(Variant::INT, "interleave", PROPERTY_HINT_ENUM, "None,Checkerboard,2x2"),
+                 "set_interleave", "get_interleave");
+
+    ClassDB::bind_method(D_METHOD("get_sample_density"), &PathTracingCamera::get_sample_density);
+    ClassDB::bind_method(D_METHOD("set_sample_density", "value"), &PathTracingCamera::set_sample_density);
+    ADD_PROPERTY(PropertyInfo(Variant::INT, "sample_density", PROPERTY_HINT_ENUM, "None,Radial,Texture"),
+                 "set_sample_density", "get_sample_density");
+
+    ClassDB::bind_method(D_METHOD("get_gaze_point"), &PathTracingCamera::get_gaze_point);
+    ClassDB::bind_method(D_METHOD("set_gaze_point", "value"), &PathTracingCamera::set_gaze_point);
+    ADD_PROPERTY(PropertyInfo(Variant::VECTOR2, "gaze_point"), "set_gaze_point", "get_gaze_point");
+
+    ClassDB::bind_method(D_METHOD("get_fovea_radius"), &PathTracingCamera::get_fovea_radius);
+    ClassDB::bind_method(D_METHOD("set_fovea_radius", "value"), &PathTracingCamera::set_fovea_radius);
+    ADD_PROPERTY(PropertyInfo(Variant::FLOAT, "fovea_radius", PROPERTY_HINT_RANGE, "0,2,0.01"),
+                 "set_fovea_radius", "get_fovea_radius");
+
+    ClassDB::bind_method(D_METHOD("get_periphery_radius"), &PathTracingCamera::get_periphery_radius);
+    ClassDB::bind_method(D_METHOD("set_periphery_radius", "value"), &PathTracingCamera::set_periphery_radius);
+    ADD_PROPERTY(PropertyInfo(Variant::FLOAT, "periphery_radius", PROPERTY_HINT_RANGE, "0,2,0.01"),
+                 "set_periphery_radius", "get_periphery_radius");
+
+    ClassDB::bind_method(D_METHOD("get_min_density"), &PathTracingCamera::get_min_density);
+    ClassDB::bind_method(D_METHOD("set_min_density", "value"), &PathTracingCamera::set_min_density);
+    ADD_PROPERTY(PropertyInfo(Variant::FLOAT, "min_density", PROPERTY_HINT_RANGE, "0.01,1,0.01"),
+                 "set_min_density", "get_min_density");
+
+    ClassDB::bind_method(D_METHOD("get_density_texture"), &PathTracingCamera::get_density_texture);
+    ClassDB::bind_method(D_METHOD("set_density_texture", "value"), &PathTracingCamera::set_density_texture);
+    ADD_PROPERTY(PropertyInfo(Variant::OBJECT, "density_texture", PROPERTY_HINT_RESOURCE_TYPE, "Texture2D"),
+                 "set_density_texture", "get_density_texture");
+
+    ClassDB::bind_method(D_METHOD("get_auto_exposure"), &PathTracingCamera::get_auto_exposure);
+    ClassDB::bind_method(D_METHOD("set_auto_exposure", "value"), &PathTracingCamera::set_auto_exposure);
+    ADD_PROPERTY(PropertyInfo(Variant::BOOL, "auto_exposure"), "set_auto_exposure", "get_auto_exposure");
+
+    ClassDB::bind_method(D_METHOD("get_exposure_compensation"), &PathTracingCamera::get_exposure_compensation);
+    ClassDB::bind_method(D_METHOD("set_exposure_compensation", "value"), &PathTracingCamera::set_exposure_compensation);
+    ADD_PROPERTY(PropertyInfo(Variant::FLOAT, "exposure_compensation", PROPERTY_HINT_RANGE, "-10,10,0.1,suffix:EV"),
+                 "set_exposure_compensation", "get_exposure_compensation");
+
+    ClassDB::bind_method(D_METHOD("get_exposure_adaptation_speed"), &PathTracingCamera::get_exposure_adaptation_speed);
+    ClassDB::bind_method(D_METHOD("set_exposure_adaptation_speed", "value"), &PathTracingCamera::set_exposure_adaptation_speed);
+    ADD_PROPERTY(PropertyInfo(Variant::FLOAT, "exposure_adaptation_speed", PROPERTY_HINT_RANGE, "0,20,0.1"),
+                 "set_exposure_adaptation_speed", "get_exposure_adaptation_speed");
+
+    ClassDB::bind_method(D_METHOD("get_accumulation_precision"), &PathTracingCamera::get_accumulation_precision);
+    ClassDB::bind_method(D_METHOD("set_accumulation_precision", "value"), &PathTracingCamera::set_accumulation_precision);
+    ADD_PROPERTY(PropertyInfo(Variant::INT, "accumulation_precision", PROPERTY_HINT_ENUM, "Full,Half"),
+                 "set_accumulation_precision", "get_accumulation_precision");
+
+    ClassDB::bind_method(D_METHOD("get_history_precision"), &PathTracingCamera::get_history_precision);
+    ClassDB::bind_method(D_METHOD("set_history_precision", "value"), &PathTracingCamera::set_history_precision);
+    ADD_PROPERTY(PropertyInfo(Variant::INT, "history_precision", PROPERTY_HINT_ENUM, "Full,Half,R11G11B10"),
+                 "set_history_precision", "get_history_precision");
+
+    ClassDB::bind_method(D_METHOD("get_auto_tune"), &PathTracingCamera::get_auto_tune);
+    ClassDB::bind_method(D_METHOD("set_auto_tune", "value"), &PathTracingCamera::set_auto_tune);
+    ADD_PROPERTY(PropertyInfo(Variant::BOOL, "auto_tune"), "set_auto_tune", "get_auto_tune");
+
+    ClassDB::bind_method(D_METHOD("tune"), &PathTracingCamera::tune);
+    ClassDB::bind_method(D_METHOD("benchmark_ray_sorting", "frames"), &PathTracingCamera::benchmark_ray_sorting, DEFVAL(16));
+    ClassDB::bind_method(D_METHOD("get_render_statistics"), &PathTracingCamera::get_render_statistics);
+    ClassDB::bind_method(D_METHOD("get_pass_times"), &PathTracingCamera::get_pass_times);
+    ClassDB::bind_method(D_METHOD("get_pass_time_ms", "pass"), &PathTracingCamera::get_pass_time_ms);
+
+    ClassDB::bind_method(D_METHOD("get_performance_monitors"), &PathTracingCamera::get_performance_monitors);
+    ClassDB::bind_method(D_METHOD("set_performance_monitors", "value"), &PathTracingCamera::set_performance_monitors);
+    ADD_PROPERTY(PropertyInfo(Variant::BOOL, "performance_monitors"), "set_performance_monitors",
+                 "get_performance_monitors");
+    ClassDB::bind_method(D_METHOD("render_offline", "resolution", "samples_per_pixel", "path", "reference_path"),
+                         &PathTracingCamera::render_offline, DEFVAL(""));
+    ClassDB::bind_method(D_METHOD("render_reference", "resolution", "samples_per_pixel", "path", "reference_path"),
+                         &PathTracingCamera::render_reference, DEFVAL(""));
+
     BIND_ENUM_CONSTANT(PROGRESSIVE_RENDERING);
     BIND_ENUM_CONSTANT(TEMPORAL_REPROJECTION);
     BIND_ENUM_CONSTANT(NONE);
+    BIND_ENUM_CONSTANT(SVGF);
+
+    BIND_ENUM_CONSTANT(TRAVERSAL_STACK);
+    BIND_ENUM_CONSTANT(TRAVERSAL_STACKLESS);
+
+    BIND_ENUM_CONSTANT(SAMPLER_RANDOM);
+    BIND_ENUM_CONSTANT(SAMPLER_SOBOL);
+    BIND_ENUM_CONSTANT(SAMPLER_BLUE_NOISE);
+
+    BIND_ENUM_CONSTANT(PRECISION_FULL);
+    BIND_ENUM_CONSTANT(PRECISION_HALF);
+    BIND_ENUM_CONSTANT(PRECISION_PACKED);
+
+    BIND_ENUM_CONSTANT(INTERLEAVE_NONE);
+    BIND_ENUM_CONSTANT(INTERLEAVE_CHECKERBOARD);
+    BIND_ENUM_CONSTANT(INTERLEAVE_2X2);
+
+    BIND_ENUM_CONSTANT(SAMPLE_DENSITY_NONE);
+    BIND_ENUM_CONSTANT(SAMPLE_DENSITY_RADIAL);
+    BIND_ENUM_CONSTANT(SAMPLE_DENSITY_TEXTURE);
 }
 
 void PathTracingCamera::_notification(int p_what)
@@ -40,12 +227,13 @@ void PathTracingCamera::_notification(int p_what)
     {
     case NOTIFICATION_ENTER_TREE: {
         set_process_internal(true);
-
+        if (performance_monitors)
+            add_performance_monitors();
         break;
     }
     case NOTIFICATION_EXIT_TREE: {
         set_process_internal(false);
-
+        remove_performance_monitors();
         break;
     }
     case NOTIFICATION_READY: {
@@ -68,15 +256,16 @@ void PathTracingCamera::set_fov(float value)
     fov = value;
 }
 
-// int PathTracingCamera::get_num_bounces() const
-// {
-//     return num_bounces;
-// }
+int PathTracingCamera::get_num_bounces() const
+{
+    return num_bounces;
+}
 
-// void PathTracingCamera::set_num_bounces(int value)
-// {
-//     num_bounces = value;
-// }
+void PathTracingCamera::set_num_bounces(int value)
+{
+    num_bounces = std::max(1, value);
+    shader_dirty = true;
+}
 
 TextureRect *PathTracingCamera::get_output_texture() const
 {
@@ -105,15 +294,715 @@ PathTracingCamera::Denoising PathTracingCamera::get_denoising_mode() const
 
 void PathTracingCamera::set_denoising_mode(Denoising mode)
 {
+    // the G-buffer and motion vectors are only written for the modes that use them, primary hits are only cached
+    // while accumulating
+    if (mode != denoising_mode && (mode == SVGF || mode == TEMPORAL_REPROJECTION || denoising_mode == SVGF ||
+                                   denoising_mode == TEMPORAL_REPROJECTION || primary_cache_positions > 0))
+        shader_dirty = true;
     denoising_mode = mode;
 }
 
+int PathTracingCamera::get_svgf_iterations() const
+{
+    return svgf_iterations;
+}
+
+void PathTracingCamera::set_svgf_iterations(int value)
+{
+    svgf_iterations = std::clamp(value, 1, 10);
+}
+
+bool PathTracingCamera::get_ray_sorting() const
+{
+    return ray_sorting;
+}
+
+void PathTracingCamera::set_ray_sorting(bool value)
+{
+    ray_sorting = value;
+    clamp_workgroup_size();
+    shader_dirty = true;
+}
+
+int PathTracingCamera::get_samples_per_frame() const
+{
+    return render_parameters.samples_per_frame;
+}
+
+void PathTracingCamera::set_samples_per_frame(int value)
+{
+    render_parameters.samples_per_frame = std::max(1, value);
+    parameters_dirty = true;
+}
+
+int PathTracingCamera::get_batch_frames() const
+{
+    return batch_frames;
+}
+
+void PathTracingCamera::set_batch_frames(int value)
+{
+    batch_frames = std::max(1, value);
+}
+
+bool PathTracingCamera::get_debug_steps() const
+{
+    return debug_steps;
+}
+
+void PathTracingCamera::set_debug_steps(bool value)
+{
+    debug_steps = value;
+    shader_dirty = true;
+}
+
+bool PathTracingCamera::get_texture_sampling() const
+{
+    return texture_sampling;
+}
+
+void PathTracingCamera::set_texture_sampling(bool value)
+{
+    texture_sampling = value;
+    shader_dirty = true;
+}
+
+bool PathTracingCamera::get_use_shader_cache() const
+{
+    return use_shader_cache;
+}
+
+void PathTracingCamera::set_use_shader_cache(bool value)
+{
+    use_shader_cache = value;
+}
+
+void PathTracingCamera::clear_shader_cache()
+{
+    ShaderCache::clear();
+}
+
+bool PathTracingCamera::get_adaptive_sampling() const
+{
+    return adaptive_sampling;
+}
+
+void PathTracingCamera::set_adaptive_sampling(bool value)
+{
+    adaptive_sampling = value;
+    shader_dirty = true;
+}
+
+float PathTracingCamera::get_adaptive_threshold() const
+{
+    return adaptive_threshold;
+}
+
+void PathTracingCamera::set_adaptive_threshold(float value)
+{
+    adaptive_threshold = value;
+}
+
+int PathTracingCamera::get_adaptive_min_samples() const
+{
+    return adaptive_min_samples;
+}
+
+void PathTracingCamera::set_adaptive_min_samples(int value)
+{
+    adaptive_min_samples = value;
+}
+
+float PathTracingCamera::get_convergence_fraction() const
+{
+    return convergence_fraction;
+}
+
+void PathTracingCamera::set_convergence_fraction(float value)
+{
+    convergence_fraction = value;
+}
+
+bool PathTracingCamera::get_tiled_rendering() const
+{
+    return tiled_rendering;
+}
+
+void PathTracingCamera::set_tiled_rendering(bool value)
+{
+    if (value != tiled_rendering && interleave != INTERLEAVE_NONE)
+    { // interleaving only applies to whole frames
+        shader_dirty = true;
+        post_processing_dirty = true;
+    }
+    tiled_rendering = value;
+    tile_order.clear();
+}
+
+int PathTracingCamera::get_tile_size() const
+{
+    return tile_size;
+}
+
+void PathTracingCamera::set_tile_size(int value)
+{
+    tile_size = std::max(32, value);
+    tile_order.clear();
+}
+
+float PathTracingCamera::get_frame_budget_ms() const
+{
+    return frame_budget_ms;
+}
+
+void PathTracingCamera::set_frame_budget_ms(float value)
+{
+    frame_budget_ms = std::max(0.1f, value);
+}
+
+Vector2i PathTracingCamera::get_workgroup_size() const
+{
+    return workgroup_size;
+}
+
+void PathTracingCamera::set_workgroup_size(Vector2i value)
+{
+    // at most 1024 invocations, the minimum guaranteed by vulkan
+    workgroup_size = Vector2i(std::clamp(value.x, 1, 1024), std::clamp(value.y, 1, 1024 / std::clamp(value.x, 1, 1024)));
+    clamp_workgroup_size();
+    shader_dirty = true;
+    tile_order.clear(); // tiles are aligned to the workgroup size
+}
+
+// ray sorting keeps two keys for misses and terminated paths and needs bins left for the materials and directions,
+// so its workgroups have at least 32 invocations. Grows the shorter side.
+void PathTracingCamera::clamp_workgroup_size()
+{
+    if (!ray_sorting)
+        return;
+    while (workgroup_size.x * workgroup_size.y < 32)
+    {
+        if (workgroup_size.x <= workgroup_size.y)
+            workgroup_size.x *= 2;
+        else
+            workgroup_size.y *= 2;
+    }
+    tile_order.clear();
+}
+
+PathTracingCamera::Traversal PathTracingCamera::get_traversal() const
+{
+    return traversal;
+}
+
+void PathTracingCamera::set_traversal(Traversal value)
+{
+    traversal = value;
+    shader_dirty = true;
+}
+
+PathTracingCamera::Sampler PathTracingCamera::get_sampler() const
+{
+    return sampler;
+}
+
+void PathTracingCamera::set_sampler(Sampler value)
+{
+    sampler = value;
+    shader_dirty = true;
+}
+
+bool PathTracingCamera::get_restir_di() const
+{
+    return restir_di;
+}
+
+void PathTracingCamera::set_restir_di(bool value)
+{
+    restir_di = value;
+    shader_dirty = true;
+}
+
+bool PathTracingCamera::get_hybrid_rendering() const
+{
+    return hybrid_rendering;
+}
+
+void PathTracingCamera::set_hybrid_rendering(bool value)
+{
+    hybrid_rendering = value;
+    hybrid_failed = false; // try the visibility raster again
+    shader_dirty = true;
+}
+
+bool PathTracingCamera::is_hybrid_active() const
+{
+    return hybrid_rendering && !hybrid_failed;
+}
+
+int PathTracingCamera::get_primary_cache_positions() const
+{
+    return primary_cache_positions;
+}
+
+void PathTracingCamera::set_primary_cache_positions(int value)
+{
+    primary_cache_positions = std::clamp(value, 0, 16);
+    shader_dirty = true;
+}
+
+PathTracingCamera::Interleave PathTracingCamera::get_interleave() const
+{
+    return interleave;
+}
+
+void PathTracingCamera::set_interleave(Interleave value)
+{
+    interleave = value;
+    shader_dirty = true;
+    post_processing_dirty = true;
+}
+
+int PathTracingCamera::get_interleave_factor() const
+{
+    if (tiled_rendering)
+        return 1;
+    return interleave == INTERLEAVE_CHECKERBOARD ? 2 : interleave == INTERLEAVE_2X2 ? 4 : 1;
+}
+
+bool PathTracingCamera::needs_reconstruction() const
+{
+    return get_interleave_factor() > 1 || sample_density != SAMPLE_DENSITY_NONE;
+}
+
+PathTracingCamera::SampleDensity PathTracingCamera::get_sample_density() const
+{
+    return sample_density;
+}
+
+void PathTracingCamera::set_sample_density(SampleDensity value)
+{
+    sample_density = value;
+    shader_dirty = true;
+    post_processing_dirty = true;
+}
+
+Vector2 PathTracingCamera::get_gaze_point() const
+{
+    return Vector2(render_parameters.gaze[0], render_parameters.gaze[1]);
+}
+
+void PathTracingCamera::set_gaze_point(Vector2 value)
+{
+    render_parameters.gaze[0] = value.x;
+    render_parameters.gaze[1] = value.y;
+    parameters_dirty = true;
+}
+
+float PathTracingCamera::get_fovea_radius() const
+{
+    return render_parameters.fovea_radius;
+}
+
+void PathTracingCamera::set_fovea_radius(float value)
+{
+    render_parameters.fovea_radius = std::max(0.0f, value);
+    parameters_dirty = true;
+}
+
+float PathTracingCamera::get_periphery_radius() const
+{
+    return render_parameters.periphery_radius;
+}
+
+void PathTracingCamera::set_periphery_radius(float value)
+{
+    render_parameters.periphery_radius = std::max(0.0f, value);
+    parameters_dirty = true;
+}
+
+float PathTracingCamera::get_min_density() const
+{
+    return render_parameters.min_density;
+}
+
+void PathTracingCamera::set_min_density(float value)
+{
+    // every pixel has to be traced now and then, the reconstruction only fills gaps
+    render_parameters.min_density = std::clamp(value, 0.01f, 1.0f);
+    parameters_dirty = true;
+}
+
+Ref<Texture2D> PathTracingCamera::get_density_texture() const
+{
+    return density_texture;
+}
+
+void PathTracingCamera::set_density_texture(const Ref<Texture2D> &value)
+{
+    density_texture = value;
+    density_image.unref();
+    if (sample_density == SAMPLE_DENSITY_TEXTURE)
+        shader_dirty = true;
+}
+
+bool PathTracingCamera::get_auto_exposure() const
+{
+    return auto_exposure;
+}
+
+void PathTracingCamera::set_auto_exposure(bool value)
+{
+    auto_exposure = value;
+}
+
+float PathTracingCamera::get_exposure_compensation() const
+{
+    return exposure_compensation;
+}
+
+void PathTracingCamera::set_exposure_compensation(float value)
+{
+    exposure_compensation = value;
+}
+
+float PathTracingCamera::get_exposure_adaptation_speed() const
+{
+    return exposure_adaptation_speed;
+}
+
+void PathTracingCamera::set_exposure_adaptation_speed(float value)
+{
+    exposure_adaptation_speed = std::max(0.0f, value);
+}
+
+PathTracingCamera::Precision PathTracingCamera::get_accumulation_precision() const
+{
+    return accumulation_precision;
+}
+
+void PathTracingCamera::set_accumulation_precision(Precision value)
+{
+    // the accumulation needs the sample count in alpha
+    accumulation_precision = value == PRECISION_PACKED ? PRECISION_HALF : value;
+    post_processing_dirty = true;
+}
+
+PathTracingCamera::Precision PathTracingCamera::get_history_precision() const
+{
+    return history_precision;
+}
+
+void PathTracingCamera::set_history_precision(Precision value)
+{
+    history_precision = value;
+    post_processing_dirty = true;
+}
+
+bool PathTracingCamera::get_auto_tune() const
+{
+    return auto_tune;
+}
+
+void PathTracingCamera::set_auto_tune(bool value)
+{
+    auto_tune = value;
+}
+
+std::vector<String> PathTracingCamera::get_shader_defines() const
+{
+    std::vector<String> defines = ShaderCache::workgroup_defines(workgroup_size);
+    defines.push_back("#define MAX_BOUNCES " + String::num_int64(num_bounces));
+    if (debug_steps)
+        defines.push_back("#define DEBUG_STEPS");
+    if (texture_sampling)
+        defines.push_back("#define TEXTURE_SAMPLING");
+    if (ray_sorting)
+        defines.push_back("#define RAY_SORTING");
+    if (traversal == TRAVERSAL_STACKLESS)
+        defines.push_back("#define TRAVERSAL_STACKLESS");
+    if (sampler == SAMPLER_SOBOL)
+        defines.push_back("#define SAMPLER_SOBOL");
+    else if (sampler == SAMPLER_BLUE_NOISE)
+        defines.push_back("#define SAMPLER_BLUE_NOISE");
+    if (adaptive_sampling)
+        defines.push_back("#define ADAPTIVE_SAMPLING");
+    if (geometry_group != nullptr && geometry_group->has_environment())
+        defines.push_back("#define ENVIRONMENT_MAP");
+    if (restir_di && geometry_group != nullptr && geometry_group->get_emitter_count() > 0)
+        defines.push_back("#define RESTIR_DI");
+    if (denoising_mode == SVGF)
+        defines.push_back("#define GBUFFER_OUTPUT");
+    if (denoising_mode == TEMPORAL_REPROJECTION)
+        defines.push_back("#define MOTION_VECTORS");
+    if (is_hybrid_active())
+        defines.push_back("#define HYBRID_PRIMARY");
+    else if (primary_cache_positions > 0 && denoising_mode == PROGRESSIVE_RENDERING)
+        defines.push_back("#define PRIMARY_CACHE " + String::num_int64(primary_cache_positions));
+    if (get_interleave_factor() > 1)
+        defines.push_back("#define INTERLEAVE " + String::num_int64(get_interleave_factor()));
+    // a still has no reconstruction to fill the skipped pixels, every pixel gets the requested samples as with
+    // adaptive sampling
+    if (!offline_rendering && sample_density == SAMPLE_DENSITY_RADIAL)
+        defines.push_back("#define SAMPLE_DENSITY_RADIAL");
+    else if (!offline_rendering && sample_density == SAMPLE_DENSITY_TEXTURE && density_texture.is_valid())
+        defines.push_back("#define SAMPLE_DENSITY_TEXTURE");
+    return defines;
+}
+
+Dictionary PathTracingCamera::get_render_statistics() const
+{
+    Dictionary result;
+    result["rays_traced"] = render_statistics.rays_traced;
+    // gpu time of the path tracing pass, such that no readback is part of it
+    result["render_time_ms"] = gpu_timer.get_time_ms("path_tracing");
+    // false when the device reported no timestamps and the times above are cpu times
+    result["gpu_timed"] = gpu_timer.is_gpu_timed("path_tracing");
+    result["mrays_per_second"] = get_gpu_mrays_per_second();
+
+    // fraction of sorted rays whose neighbouring invocation shares its sort key
+    const char *kinds[2] = {"direction", "material"};
+    for (int i = 0; i < 2; i++)
+    {
+        const float sorted = std::max(1.0f, static_cast<float>(render_statistics.sorted_rays[i]));
+        result[String(kinds[i]) + "_coherence_before"] = render_statistics.coherent_before[i] / sorted;
+        result[String(kinds[i]) + "_coherence_after"] = render_statistics.coherent_after[i] / sorted;
+    }
+    // fraction of the covered pixels traced, after the sample density and adaptive sampling skipped theirs
+    const float candidates = static_cast<float>(render_statistics.candidate_pixels) * render_parameters.samples_per_frame;
+    result["sample_density"] = candidates > 0.0f ? render_statistics.paths_traced / candidates : 0.0f;
+    result["paths_traced"] = render_statistics.paths_traced;
+    result["gpu_mrays_per_second"] = get_gpu_mrays_per_second();
+    result["paths_per_second"] = get_paths_per_second();
+    return result;
+}
+
+//--------- PROFILING ---------
+
+Dictionary PathTracingCamera::get_pass_times() const
+{
+    Dictionary result;
+    for (const String &pass : gpu_timer.get_passes())
+        result[pass] = gpu_timer.get_time_ms(pass);
+    return result;
+}
+
+float PathTracingCamera::get_pass_time_ms(const String &pass) const
+{
+    return gpu_timer.get_time_ms(pass);
+}
+
+float PathTracingCamera::get_gpu_mrays_per_second() const
+{
+    const float ms = gpu_timer.get_time_ms("path_tracing");
+    return ms > 0.0f ? timed_statistics.rays_traced / (ms * 1000.0f) : 0.0f;
+}
+
+float PathTracingCamera::get_paths_per_second() const
+{
+    const float ms = gpu_timer.get_time_ms("path_tracing");
+    return ms > 0.0f ? timed_statistics.paths_traced / (ms / 1000.0f) : 0.0f;
+}
+
+bool PathTracingCamera::get_performance_monitors() const
+{
+    return performance_monitors;
+}
+
+void PathTracingCamera::set_performance_monitors(bool value)
+{
+    performance_monitors = value;
+    if (!is_inside_tree() || godot::Engine::get_singleton()->is_editor_hint())
+        return;
+    if (performance_monitors)
+        add_performance_monitors();
+    else
+        remove_performance_monitors();
+}
+
+// every pass main.glsl and the post processing stages can run, passes of other modes stay at 0
+static const char *const MONITORED_PASSES[] = {"path_tracing", "visibility", "reconstruction", "progressive", "temporal",
+                                               "svgf", "tonemap", "uniforms", "readback"};
+
+void PathTracingCamera::add_performance_monitors()
+{
+    Performance *performance = Performance::get_singleton();
+    if (monitors_added || performance->has_custom_monitor("PathTracing/path_tracing_ms"))
+        return;
+    for (const char *pass : MONITORED_PASSES)
+    {
+        Array arguments;
+        arguments.push_back(String(pass));
+        performance->add_custom_monitor("PathTracing/" + String(pass) + "_ms",
+                                        callable_mp(this, &PathTracingCamera::get_pass_time_ms), arguments);
+    }
+    performance->add_custom_monitor("PathTracing/mrays_per_second",
+                                    callable_mp(this, &PathTracingCamera::get_gpu_mrays_per_second));
+    performance->add_custom_monitor("PathTracing/paths_per_second",
+                                    callable_mp(this, &PathTracingCamera::get_paths_per_second));
+    monitors_added = true;
+}
+
+void PathTracingCamera::remove_performance_monitors()
+{
+    if (!monitors_added)
+        return;
+    Performance *performance = Performance::get_singleton();
+    for (const char *pass : MONITORED_PASSES)
+        performance->remove_custom_monitor("PathTracing/" + String(pass) + "_ms");
+    performance->remove_custom_monitor("PathTracing/mrays_per_second");
+    performance->remove_custom_monitor("PathTracing/paths_per_second");
+    monitors_added = false;
+}
+
+Vector3i PathTracingCamera::get_dispatch_size() const
+{
+    // one invocation per traced pixel, interleaving traces one pixel per cell of 2x1 or 2x2
+    const int factor = get_interleave_factor();
+    const int width = factor > 1 ? (render_parameters.width + 1) / 2 : render_parameters.width;
+    const int height = factor > 2 ? (render_parameters.height + 1) / 2 : render_parameters.height;
+    return Vector3i(static_cast<int32_t>(std::ceil(width / static_cast<float>(workgroup_size.x))),
+                    static_cast<int32_t>(std::ceil(height / static_cast<float>(workgroup_size.y))), 1);
+}
+
+//--------- AUTO TUNING ---------
+
+static const char *TUNING_PATH = "user://path_tracing_tuning.cfg";
+
+String PathTracingCamera::get_device_key() const
+{
+    return (_rd->get_device_vendor_name() + " " + _rd->get_device_name()).validate_node_name();
+}
+
+bool PathTracingCamera::load_tuning()
+{
+    Ref<ConfigFile> config;
+    config.instantiate();
+    String device = get_device_key();
+    if (config->load(TUNING_PATH) != OK || !config->has_section(device))
+        return false;
+    workgroup_size = config->get_value(device, "workgroup_size", workgroup_size);
+    traversal = static_cast<Traversal>(static_cast<int>(config->get_value(device, "traversal", traversal)));
+    return true;
+}
+
+void PathTracingCamera::save_tuning() const
+{
+    Ref<ConfigFile> config;
+    config.instantiate();
+    config->load(TUNING_PATH); // keep the results of other devices
+    String device = get_device_key();
+    config->set_value(device, "workgroup_size", workgroup_size);
+    config->set_value(device, "traversal", static_cast<int>(traversal));
+    config->save(TUNING_PATH);
+}
+
+// average time in ms of a path tracing dispatch with the current shader, the statistics count the timed dispatches
+float PathTracingCamera::benchmark(int frames)
+{
+    const int warmup = 2;
+    uint64_t start = 0;
+    for (int i = 0; i < warmup + frames; i++)
+    {
+        if (i == warmup)
+        {
+            cs->update_storage_buffer_uniform(statistics_rid, RenderStatistics().to_packed_byte_array());
+            start = Time::get_singleton()->get_ticks_usec();
+        }
+        camera.frame_index++;
+        cs->update_storage_buffer_uniform(camera_rid, camera.to_packed_byte_array());
+        cs->compute(get_dispatch_size());
+        _rd->buffer_get_data(statistics_rid); // wait for the dispatch
+    }
+    return (Time::get_singleton()->get_ticks_usec() - start) / (1000.0f * frames);
+}
+
+void PathTracingCamera::tune()
+{
+    if (cs == nullptr)
+        return;
+    const Vector2i shapes[] = {Vector2i(8, 4), Vector2i(8, 8), Vector2i(16, 8), Vector2i(16, 16), Vector2i(32, 8), Vector2i(32, 32)};
+    const Traversal traversals[] = {TRAVERSAL_STACK, TRAVERSAL_STACKLESS};
+
+    camera.set_camera_transform(get_global_transform(), projection_matrix);
+    float best_time = 1e30f;
+    Vector2i best_shape = workgroup_size;
+    Traversal best_traversal = traversal;
+    for (const Traversal &candidate_traversal : traversals)
+    {
+        for (const Vector2i &shape : shapes)
+        {
+            workgroup_size = shape;
+            traversal = candidate_traversal;
+            clear_compute_shader();
+            init_compute_shader();
+            if (cs == nullptr || !cs->check_ready())
+                continue;
+            float time = benchmark(8);
+            UtilityFunctions::print("Path tracing tuning: ", shape, " traversal ", static_cast<int>(candidate_traversal), ": ", time, " ms");
+            if (time < best_time)
+            {
+                best_time = time;
+                best_shape = shape;
+                best_traversal = candidate_traversal;
+            }
+        }
+    }
+
+    workgroup_size = best_shape;
+    traversal = best_traversal;
+    clear_compute_shader();
+    init_compute_shader();
+    save_tuning();
+    UtilityFunctions::print("Path tracing tuning picked ", workgroup_size, " traversal ", static_cast<int>(traversal), " on ", get_device_key());
+}
+
+// throughput of the current view with and without ray sorting, sorting only pays off once its coherence gain
+// outweighs the cost of the sort
+Dictionary PathTracingCamera::benchmark_ray_sorting(int frames)
+{
+    Dictionary result;
+    if (cs == nullptr)
+        return result;
+    const bool sorting = ray_sorting;
+    const Vector2i shape = workgroup_size;
+    frames = std::max(1, frames);
+
+    camera.set_camera_transform(get_global_transform(), projection_matrix);
+    const char *keys[2] = {"unsorted_mrays_per_second", "sorted_mrays_per_second"};
+    float mrays[2] = {0.0f, 0.0f};
+    for (int i = 0; i < 2; i++)
+    {
+        ray_sorting = i == 1;
+        clamp_workgroup_size();
+        clear_compute_shader();
+        init_compute_shader();
+        if (cs == nullptr || !cs->check_ready())
+            continue;
+        const float time = benchmark(frames);
+        PackedByteArray data = _rd->buffer_get_data(statistics_rid);
+        RenderStatistics statistics;
+        if (data.size() >= sizeof(RenderStatistics))
+            std::memcpy(&statistics, data.ptr(), sizeof(RenderStatistics));
+        mrays[i] = time > 0.0f ? statistics.rays_traced / (time * frames * 1000.0f) : 0.0f;
+        result[keys[i]] = mrays[i];
+    }
+    result["sorting_speedup"] = mrays[0] > 0.0f ? mrays[1] / mrays[0] : 0.0f;
+
+    ray_sorting = sorting;
+    workgroup_size = shape;
+    clear_compute_shader();
+    init_compute_shader();
+    UtilityFunctions::print("Ray sorting: ", mrays[1], " Mrays/s sorted, ", mrays[0], " Mrays/s unsorted on ", get_device_key());
+    return result;
+}
+
 void PathTracingCamera::init()
 {
     //we want to use one RD for all shaders relevant to the camera.
     _rd = RenderingServer::get_singleton()->create_local_rendering_device();
 
-    // setup geometry
+    // setup geometry, also for the cpu renderer and ray queries without a RenderingDevice
     if (geometry_group == nullptr)
     {
         UtilityFunctions::printerr("No geometry group set.");
@@ -126,36 +1015,69 @@ void PathTracingCamera::init()
     geometry_group->build();
 
     { // setup parameters
-        render_parameters.width = resolution.x;
-        render_parameters.height = resolution.y;
+        set_resolution(resolution);
         render_parameters.fov = fov;
         render_parameters.triangleCount = geometry_group->get_triangle_count();
         render_parameters.blasCount = geometry_group->get_blas_count();
-        projection_matrix = Projection::create_perspective(fov, static_cast<float>(render_parameters.width) / render_parameters.height, 0.01f, 1000.0f, false);
-        camera.set_camera_transform(get_global_transform().affine_inverse(), projection_matrix);
+        camera.set_camera_transform(get_global_transform(), projection_matrix);
+    }
+
+    if (_rd == nullptr)
+    {
+        UtilityFunctions::printerr("Path tracing needs a RenderingDevice, run with a Vulkan or D3D12 rendering driver. "
+                                   "Offline stills fall back to render_reference on the cpu.");
+        return;
     }
+    gpu_timer.init(_rd);
+
+    if (auto_tune && load_tuning())
+        auto_tune = false; // use the stored winner for this device
+    init_compute_shader();
+    if (auto_tune)
+        tune();
+}
+
+void PathTracingCamera::set_resolution(Vector2i resolution)
+{
+    render_parameters.width = resolution.x;
+    render_parameters.height = resolution.y;
+    projection_matrix = Projection::create_perspective(fov, static_cast<float>(resolution.x) / resolution.y, 0.01f, 1000.0f, false);
+    tile_order.clear();
+}
 
-    // setup compute shader
-    cs = new ComputeShader("res://addons/jar_path_tracing/src/shaders/main.glsl", _rd, {"#define TESTe"});
+void PathTracingCamera::init_compute_shader()
+{
+    // setup compute shader, the variant is selected through generated defines
+    const String shader_path = "res://addons/jar_path_tracing/src/shaders/main.glsl";
+    cs = ShaderCache::create(_rd, shader_path, get_shader_defines(), use_shader_cache);
+    shader_dirty = false;
     //--------- GENERAL BUFFERS ---------
     { // input general buffer
         render_parameters_rid = cs->create_storage_buffer_uniform(render_parameters.to_packed_byte_array(), 2, 0);
         camera_rid = cs->create_storage_buffer_uniform(camera.to_packed_byte_array(), 3, 0);
+        statistics_rid = cs->create_storage_buffer_uniform(render_statistics.to_packed_byte_array(), 4, 0);
+        statistics_pending = false;
     }
 
     Ref<RDTextureView> output_texture_view = memnew(RDTextureView);
-    { // output texture
-        auto output_format = cs->create_texture_format(render_parameters.width, render_parameters.height, RenderingDevice::DATA_FORMAT_R8G8B8A8_UNORM);
-        if (output_texture_rect == nullptr)
+    { // output texture, float radiance that the post processing chain tonemaps into its display texture
+        auto output_format = cs->create_texture_format(render_parameters.width, render_parameters.height,
+                                                       RenderingDevice::DATA_FORMAT_R32G32B32A32_SFLOAT);
+        output_format->set_usage_bits(output_format->get_usage_bits() | RenderingDevice::TEXTURE_USAGE_CAN_COPY_TO_BIT); // cleared in tiled rendering
+        Ref<Image> radiance_image = Image::create(render_parameters.width, render_parameters.height, false, Image::FORMAT_RGBAF);
+        output_texture_rid = cs->create_image_uniform(radiance_image, output_format, output_texture_view, 0, 0);
+
+        // offline rendering reads the radiance back itself, the interactive output texture keeps its last frame
+        output_image = Image::create(render_parameters.width, render_parameters.height, false, Image::FORMAT_RGBA8);
+        if (!offline_rendering && output_texture_rect != nullptr)
+        {
+            output_texture = ImageTexture::create_from_image(output_image);
+            output_texture_rect->set_texture(output_texture);
+        }
+        else if (!offline_rendering)
         {
             UtilityFunctions::printerr("No output texture set.");
-            return;
         }
-        output_image = Image::create(render_parameters.width, render_parameters.height, false, Image::FORMAT_RGBA8);
-        output_texture = ImageTexture::create_from_image(output_image);
-        output_texture_rect->set_texture(output_texture);
-        
-        output_texture_rid = cs->create_image_uniform(output_image, output_format, output_texture_view, 0, 0);
     }
 
     Ref<RDTextureView> depth_texture_view = memnew(RDTextureView);
@@ -165,6 +1087,51 @@ void PathTracingCamera::init()
         depth_texture_rid = cs->create_image_uniform(depth_image, depth_format, depth_texture_view, 1, 0);
     }
 
+    Ref<RDTextureView> sample_mask_view = memnew(RDTextureView);
+    { // sample mask, written by progressive rendering. Starts out with every pixel needing samples.
+        auto sample_mask_format = cs->create_texture_format(render_parameters.width, render_parameters.height, RenderingDevice::DATA_FORMAT_R8_UNORM);
+        sample_mask_image = Image::create(render_parameters.width, render_parameters.height, false, Image::FORMAT_R8);
+        sample_mask_image->fill(Color(1.0f, 1.0f, 1.0f, 1.0f));
+        sample_mask_rid = cs->create_image_uniform(sample_mask_image, sample_mask_format, sample_mask_view, 5, 0);
+    }
+
+    Ref<RDTextureView> blue_noise_view = memnew(RDTextureView);
+    { // blue-noise mask for the blue-noise sampler
+        Ref<Image> blue_noise = BlueNoise::get_mask();
+        auto blue_noise_format = cs->create_texture_format(blue_noise->get_width(), blue_noise->get_height(), RenderingDevice::DATA_FORMAT_R32_SFLOAT);
+        blue_noise_rid = cs->create_image_uniform(blue_noise, blue_noise_format, blue_noise_view, 6, 0);
+    }
+
+    Ref<RDTextureView> reservoirs_view = memnew(RDTextureView);
+    Ref<RDTextureView> reservoir_surfaces_view = memnew(RDTextureView);
+    { // ReSTIR reservoirs of this and the previous frame side by side, a single texel while unused
+        Vector2i size = restir_di ? Vector2i(render_parameters.width * 2, render_parameters.height) : Vector2i(1, 1);
+        auto reservoir_format = cs->create_texture_format(size.x, size.y, RenderingDevice::DATA_FORMAT_R32G32B32A32_SFLOAT);
+        Ref<Image> reservoir_image = Image::create(size.x, size.y, false, Image::FORMAT_RGBAF);
+        reservoirs_rid = cs->create_image_uniform(reservoir_image, reservoir_format, reservoirs_view, 7, 0);
+        reservoir_surfaces_rid = cs->create_image_uniform(reservoir_image, reservoir_format, reservoir_surfaces_view, 8, 0);
+    }
+
+    Ref<RDTextureView> gbuffer_normal_view = memnew(RDTextureView);
+    Ref<RDTextureView> gbuffer_albedo_view = memnew(RDTextureView);
+    Ref<RDTextureView> gbuffer_depth_view = memnew(RDTextureView);
+    { // G-buffer of the primary hits for SVGF, a single texel while unused
+        Vector2i size = denoising_mode == SVGF ? Vector2i(render_parameters.width, render_parameters.height) : Vector2i(1, 1);
+        auto normal_format = cs->create_texture_format(size.x, size.y, RenderingDevice::DATA_FORMAT_R16G16B16A16_SFLOAT);
+        auto albedo_format = cs->create_texture_format(size.x, size.y, RenderingDevice::DATA_FORMAT_R8G8B8A8_UNORM);
+        auto depth_format = cs->create_texture_format(size.x, size.y, RenderingDevice::DATA_FORMAT_R32_SFLOAT);
+        gbuffer_rids[0] = cs->create_image_uniform(Image::create(size.x, size.y, false, Image::FORMAT_RGBAH), normal_format, gbuffer_normal_view, 9, 0);
+        gbuffer_rids[1] = cs->create_image_uniform(Image::create(size.x, size.y, false, Image::FORMAT_RGBA8), albedo_format, gbuffer_albedo_view, 10, 0);
+        gbuffer_rids[2] = cs->create_image_uniform(Image::create(size.x, size.y, false, Image::FORMAT_RF), depth_format, gbuffer_depth_view, 11, 0);
+    }
+
+    Ref<RDTextureView> motion_vectors_view = memnew(RDTextureView);
+    { // motion vectors for temporal reprojection, a single texel while unused
+        Vector2i size = denoising_mode == TEMPORAL_REPROJECTION ? Vector2i(render_parameters.width, render_parameters.height) : Vector2i(1, 1);
+        auto motion_vectors_format = cs->create_texture_format(size.x, size.y, RenderingDevice::DATA_FORMAT_R16G16_SFLOAT);
+        motion_vectors_rid = cs->create_image_uniform(Image::create(size.x, size.y, false, Image::FORMAT_RGH), motion_vectors_format, motion_vectors_view, 12, 0);
+    }
+
     //--------- SCENE STORAGE ---------
     {
         triangles_geometry_rid = cs->create_storage_buffer_uniform(geometry_group->get_triangles_geometry_buffer(), 0, 1);
@@ -173,6 +1140,64 @@ void PathTracingCamera::init()
         bvh_tree_rid = cs->create_storage_buffer_uniform(geometry_group->get_bvh_buffer(), 3, 1);
         blas_rid = cs->create_storage_buffer_uniform(geometry_group->get_blas_buffer(), 4, 1);
         tlas_rid = cs->create_storage_buffer_uniform(geometry_group->get_tlas_buffer(), 5, 1);
+        bvh_links_rid = cs->create_storage_buffer_uniform(geometry_group->get_bvh_links_buffer(), 6, 1);
+        tlas_links_rid = cs->create_storage_buffer_uniform(geometry_group->get_tlas_links_buffer(), 7, 1);
+        environment_distribution_rid = cs->create_storage_buffer_uniform(geometry_group->get_environment_distribution_buffer(), 8, 1);
+        emitters_rid = cs->create_storage_buffer_uniform(geometry_group->get_emitters_buffer(), 9, 1);
+    }
+
+    Ref<RDTextureView> visibility_view = memnew(RDTextureView);
+    { // rasterized primary visibility for hybrid rendering, drawn from the scene buffers above. A single texel while unused.
+        if (is_hybrid_active() &&
+            visibility_buffer.init(_rd, Vector2i(render_parameters.width, render_parameters.height), triangles_geometry_rid,
+                                   blas_rid, geometry_group->get_instance_triangles()))
+        {
+            visibility_rid = visibility_buffer.get_texture();
+            cs->add_existing_buffer(visibility_rid, RenderingDevice::UNIFORM_TYPE_IMAGE, 13, 0);
+        }
+        else
+        {
+            if (is_hybrid_active())
+            { // every primary ray would see the sky, use the path traced primary rays instead
+                UtilityFunctions::printerr("Hybrid rendering could not set up the visibility raster, tracing primary rays instead.");
+                hybrid_failed = true;
+                shader_dirty = true;
+            }
+            auto visibility_format = cs->create_texture_format(1, 1, RenderingDevice::DATA_FORMAT_R32G32_UINT);
+            visibility_rid = cs->create_image_uniform(Image::create(1, 1, false, Image::FORMAT_RGF), visibility_format, visibility_view, 13, 0);
+        }
+    }
+
+    Ref<RDTextureView> primary_cache_view = memnew(RDTextureView);
+    { // cached primary hits, one screen per jitter position stacked vertically. A single texel while unused.
+        // Created and cleared on the gpu, generation 0 never matches.
+        const bool cached = !is_hybrid_active() && primary_cache_positions > 0 && denoising_mode == PROGRESSIVE_RENDERING;
+        Vector2i size = cached ? Vector2i(render_parameters.width, render_parameters.height * primary_cache_positions) : Vector2i(1, 1);
+        auto primary_cache_format = cs->create_texture_format(size.x, size.y, RenderingDevice::DATA_FORMAT_R32G32_UINT);
+        primary_cache_format->set_usage_bits(primary_cache_format->get_usage_bits() | RenderingDevice::TEXTURE_USAGE_CAN_COPY_TO_BIT);
+        primary_cache_rid = _rd->texture_create(primary_cache_format, primary_cache_view);
+        _rd->texture_clear(primary_cache_rid, Color(0.0f, 0.0f, 0.0f, 0.0f), 0, 1, 0, 1);
+        cs->add_existing_buffer(primary_cache_rid, RenderingDevice::UNIFORM_TYPE_IMAGE, 14, 0);
+    }
+
+    Ref<RDTextureView> sample_density_view = memnew(RDTextureView);
+    { // user density map resized to the screen, a single texel while unused
+        density_image.unref();
+        if (sample_density == SAMPLE_DENSITY_TEXTURE && density_texture.is_valid() && !offline_rendering)
+        {
+            density_image = density_texture->get_image();
+            if (density_image.is_valid())
+            {
+                density_image = density_image->duplicate();
+                if (density_image->is_compressed())
+                    density_image->decompress();
+                density_image->convert(Image::FORMAT_R8);
+                density_image->resize(render_parameters.width, render_parameters.height, Image::INTERPOLATE_BILINEAR);
+            }
+        }
+        Ref<Image> image = density_image.is_valid() ? density_image : Image::create(1, 1, false, Image::FORMAT_R8);
+        auto sample_density_format = cs->create_texture_format(image->get_width(), image->get_height(), RenderingDevice::DATA_FORMAT_R8_UNORM);
+        sample_density_rid = cs->create_image_uniform(image, sample_density_format, sample_density_view, 15, 0);
     }
     //textures
     {
@@ -182,51 +1207,513 @@ void PathTracingCamera::init()
         auto textures_format = cs->create_texture_format(resolution, resolution, RenderingDevice::DATA_FORMAT_R8G8B8A8_UNORM);
         texture_array_rid = cs->create_layered_image_uniform(textures, textures_format, texture_view, 0, 2);
     }
+    { // environment panorama, sampled through the distribution in set 1
+        Ref<RDTextureView> environment_view = memnew(RDTextureView);
+        Ref<Image> environment = geometry_group->get_environment_image();
+        auto environment_format = cs->create_texture_format(environment->get_width(), environment->get_height(), RenderingDevice::DATA_FORMAT_R32G32B32A32_SFLOAT);
+        environment_map_rid = cs->create_image_uniform(environment, environment_format, environment_view, 1, 2);
+    }
 
     cs->finish_create_uniforms();
 }
 
 void PathTracingCamera::clear_compute_shader()
 {
+    // post processing is bound to the output texture of the current shader, so it is rebuilt as well
+    post_processing.clear();
+    progressive_renderer = nullptr;
+    svgf_denoiser = nullptr;
+    tonemap = nullptr;
+    visibility_buffer.clear(); // drawn from the scene buffers of the shader
+    if (cs != nullptr)
+        delete cs;
+    cs = nullptr;
+    if (primary_cache_rid.is_valid())
+        _rd->free_rid(primary_cache_rid);
+    primary_cache_rid = RID();
+}
+
+//--------- TILED RENDERING ---------
+
+void PathTracingCamera::build_tile_order()
+{
+    // tiles are aligned to workgroups, such that a tile covers whole workgroups
+    Vector2i tile(std::max(1, tile_size / workgroup_size.x) * workgroup_size.x,
+                  std::max(1, tile_size / workgroup_size.y) * workgroup_size.y);
+    Vector2 centre(render_parameters.width * 0.5f, render_parameters.height * 0.5f);
+
+    tile_order.clear();
+    for (int y = 0; y < render_parameters.height; y += tile.y)
+        for (int x = 0; x < render_parameters.width; x += tile.x)
+            tile_order.push_back(Vector2i(x, y));
+
+    // centre first
+    std::stable_sort(tile_order.begin(), tile_order.end(), [&](const Vector2i &a, const Vector2i &b) {
+        Vector2 ca = Vector2(a) + Vector2(tile) * 0.5f;
+        Vector2 cb = Vector2(b) + Vector2(tile) * 0.5f;
+        return ca.distance_squared_to(centre) < cb.distance_squared_to(centre);
+    });
+    next_tile = 0;
+}
+
+void PathTracingCamera::render_tiles(bool progressive)
+{
+    if (tile_order.empty())
+        build_tile_order();
+    Vector2i tile(std::max(1, tile_size / workgroup_size.x) * workgroup_size.x,
+                  std::max(1, tile_size / workgroup_size.y) * workgroup_size.y);
+    Vector3i groups(tile.x / workgroup_size.x, tile.y / workgroup_size.y, 1);
+
+    // only progressive rendering can accumulate partial frames, other modes dispatch every tile
+    size_t tile_count = tile_order.size();
+    if (progressive)
+    {
+        if (progressive_renderer->has_moved(get_global_transform()))
+            next_tile = 0; // the accumulation restarts, so start at the centre again
+        tile_count = std::clamp(static_cast<size_t>(frame_budget_ms / std::max(tile_time_ms, 0.01f)), size_t(1),
+                                tile_order.size());
+    }
+
+    // pixels outside this frame's tiles have alpha 0, such that they are not accumulated
+    if (tile_count < tile_order.size())
+        _rd->texture_clear(output_texture_rid, Color(0.0f, 0.0f, 0.0f, 0.0f), 0, 1, 0, 1);
+
+    for (size_t i = 0; i < tile_count; i++)
+    {
+        Vector2i offset = tile_order[next_tile];
+        next_tile = (next_tile + 1) % tile_order.size();
+
+        render_parameters.tile_offset[0] = offset.x;
+        render_parameters.tile_offset[1] = offset.y;
+        cs->update_storage_buffer_uniform(render_parameters_rid, render_parameters.to_packed_byte_array());
+
+        gpu_timer.begin("tile");
+        cs->compute(groups);
+        gpu_timer.end("tile");
+    }
+
+    render_parameters.tile_offset[0] = 0;
+    render_parameters.tile_offset[1] = 0;
+    parameters_dirty = true;
+}
+
+// per frame inputs of the primary rays: the rasterized visibility in hybrid mode, the generation of the cached
+// primary hits otherwise
+void PathTracingCamera::update_primary_rays(unsigned int cache_generation)
+{
+    camera.primary_cache_generation = cache_generation;
+    if (!is_hybrid_active())
+        return;
+    // one primary ray position per frame along the R2 sequence, rasterized before the path tracing dispatch
+    camera.jitter[0] = static_cast<float>(std::fmod(0.5 + camera.frame_index * 0.7548776662, 1.0));
+    camera.jitter[1] = static_cast<float>(std::fmod(0.5 + camera.frame_index * 0.5698402910, 1.0));
+    gpu_timer.begin("visibility");
+    visibility_buffer.render(camera.vp, Vector2(camera.jitter[0], camera.jitter[1]));
+    gpu_timer.end("visibility");
+}
+
+// the outputs of main.glsl that stages can read from the pool
+void PathTracingCamera::set_post_processing_inputs(PostProcessChain &chain) const
+{
+    chain.set_input(PostProcessInput::SCREEN, output_texture_rid);
+    chain.set_input(PostProcessInput::SAMPLE_MASK, sample_mask_rid);
+    chain.set_input(PostProcessInput::DEPTH, depth_texture_rid);
+    chain.set_input(PostProcessInput::MOTION_VECTORS, motion_vectors_rid);
+    chain.set_input(PostProcessInput::GBUFFER_NORMAL, gbuffer_rids[0]);
+    chain.set_input(PostProcessInput::GBUFFER_ALBEDO, gbuffer_rids[1]);
+    chain.set_input(PostProcessInput::GBUFFER_DEPTH, gbuffer_rids[2]);
+}
+
+void PathTracingCamera::build_post_processing(const Vector2i Size)
+{
+    post_processing.clear();
+    progressive_renderer = nullptr;
+    svgf_denoiser = nullptr;
+    tonemap = nullptr;
+    if (needs_reconstruction())
+        post_processing.add(new InterleaveReconstruction()); // completes the frame before any other stage reads it
+    switch (denoising_mode) {
+        case PROGRESSIVE_RENDERING:
+            progressive_renderer = new ProgressiveRendering();
+            post_processing.add(progressive_renderer);
+            // the new renderer counts generations from 1 again, hits cached under the old one must not match
+            if (primary_cache_rid.is_valid())
+                _rd->texture_clear(primary_cache_rid, Color(0.0f, 0.0f, 0.0f, 0.0f), 0, 1, 0, 1);
+            break;
+        case TEMPORAL_REPROJECTION:
+            post_processing.add(new TemporalReprojection());
+            break;
+        case SVGF:
+            svgf_denoiser = new SVGFDenoiser();
+            post_processing.add(svgf_denoiser);
+            break;
+        case NONE:
+            // No denoising
+            break;
+    }
+    tonemap = new Tonemap();
+    post_processing.add(tonemap);
+    set_post_processing_inputs(post_processing);
+
+    const RenderingDevice::DataFormat formats[3] = {RenderingDevice::DATA_FORMAT_R32G32B32A32_SFLOAT,
+                                                    RenderingDevice::DATA_FORMAT_R16G16B16A16_SFLOAT,
+                                                    RenderingDevice::DATA_FORMAT_B10G11R11_UFLOAT_PACK32};
+    RenderingDevice::DataFormat history_format = formats[history_precision];
+    if (history_format == RenderingDevice::DATA_FORMAT_B10G11R11_UFLOAT_PACK32 &&
+        !_rd->texture_is_format_supported_for_usage(history_format, RenderingDevice::TEXTURE_USAGE_STORAGE_BIT))
+    { // packed floats are an optional storage format
+        UtilityFunctions::printerr("R11G11B10 storage images are not supported by this device, using half precision histories.");
+        history_format = RenderingDevice::DATA_FORMAT_R16G16B16A16_SFLOAT;
+    }
+    post_processing.init(_rd, Size, workgroup_size, formats[accumulation_precision], history_format);
+    post_processing_dirty = false;
+    display_texture_rid = post_processing.get_pool().get(PostProcessOutput::DISPLAY, RenderingDevice::DATA_FORMAT_R8G8B8A8_UNORM);
+    post_processing_mode = denoising_mode;
+}
+
+void PathTracingCamera::render_post_processing(const Vector2i Size)
+{
+    if (post_processing.is_empty() || post_processing_mode != denoising_mode || post_processing_dirty)
+        build_post_processing(Size);
+    tonemap->set_exposure(auto_exposure, exposure_compensation, exposure_adaptation_speed);
+    if (svgf_denoiser != nullptr)
+        svgf_denoiser->set_iterations(svgf_iterations);
+
+    PostProcessFrame frame;
+    frame.camera_transform = get_global_transform();
+    frame.projection = projection_matrix;
+    post_processing.render(frame, &gpu_timer);
 }
 
 void PathTracingCamera::render()
 {
+    if (cs != nullptr && shader_dirty)
+    { // switch to a different shader variant
+        clear_compute_shader();
+        init_compute_shader();
+    }
     if (cs == nullptr || !cs->check_ready())
         return;
-    // update rendering parameters
-    camera.set_camera_transform(get_global_transform(), projection_matrix);
-    camera.frame_index++;
-    cs->update_storage_buffer_uniform(camera_rid, camera.to_packed_byte_array());
 
-    // render
+    // timestamps of the previous frame, read a frame late such that they never wait for the gpu. Its statistics are
+    // read once the timestamps are resolved, an idle frame times nothing
+    gpu_timer.resolve();
+    read_statistics();
+    timed_statistics = gpu_timer.get_count("path_tracing") > 0 ? render_statistics : RenderStatistics();
+    if (gpu_timer.get_count("tile") > 0)
+        tile_time_ms = gpu_timer.get_time_ms("tile") / gpu_timer.get_count("tile");
+
+    const bool progressive = denoising_mode == PROGRESSIVE_RENDERING && progressive_renderer != nullptr;
+    if (progressive)
+    {
+        progressive_renderer->read_active_pixels(); // of the previous frame, after its sync as well
+        progressive_renderer->set_adaptive_sampling(adaptive_sampling ? adaptive_threshold : 0.0f, adaptive_min_samples,
+                                                    convergence_fraction);
+        if (progressive_renderer->is_converged(get_global_transform()))
+            return; // the image is done, idle until the view changes
+    }
+
+    gpu_timer.begin_cpu("uniforms");
+    if (parameters_dirty)
+    {
+        cs->update_storage_buffer_uniform(render_parameters_rid, render_parameters.to_packed_byte_array());
+        parameters_dirty = false;
+    }
+    cs->update_storage_buffer_uniform(statistics_rid, RenderStatistics().to_packed_byte_array());
+    gpu_timer.end_cpu("uniforms");
+
+    // batch mode runs several dispatches (and their accumulation) before presenting once
     Vector2i Size = {render_parameters.width, render_parameters.height};
-    cs->compute({static_cast<int32_t>(std::ceil(Size.x / 32.0f)), static_cast<int32_t>(std::ceil(Size.y / 32.0f)), 1});
-    
-    { // post processing
-        switch (denoising_mode) {
-            case PROGRESSIVE_RENDERING:
-                if (progressive_renderer == nullptr) {
-                    progressive_renderer = new ProgressiveRendering();
-                    progressive_renderer->init(_rd, output_texture_rid, Size);
-                }
-                progressive_renderer->render(get_global_transform());
-                break;
-            case TEMPORAL_REPROJECTION:
-                if (temporal_reprojection == nullptr) {
-                    temporal_reprojection = new TemporalReprojection();
-                    temporal_reprojection->init(_rd, output_texture_rid, depth_texture_rid, Size);
-                }
-                temporal_reprojection->render(get_global_transform().affine_inverse(), projection_matrix);
-                break;
-            case NONE:
-                // No post-processing
-                break;
+    for (int batch = 0; batch < batch_frames; batch++)
+    {
+        // moving instances, their previous transform feeds the motion vectors
+        gpu_timer.begin_cpu("uniforms");
+        if (geometry_group != nullptr && geometry_group->update_transforms())
+        {
+            cs->update_storage_buffer_uniform(blas_rid, geometry_group->get_blas_buffer());
+            cs->update_storage_buffer_uniform(tlas_rid, geometry_group->get_tlas_buffer());
+            cs->update_storage_buffer_uniform(tlas_links_rid, geometry_group->get_tlas_links_buffer());
+            if (progressive)
+                progressive_renderer->invalidate(); // neither the accumulation nor the cached primary hits hold
         }
+
+        // update rendering parameters
+        camera.set_camera_transform(get_global_transform(), projection_matrix);
+        camera.frame_index++;
+        camera.sample_frame = progressive ? progressive_renderer->get_sample_frame(get_global_transform()) : camera.frame_index;
+        camera.use_sample_mask = progressive && adaptive_sampling && !progressive_renderer->has_moved(get_global_transform());
+        gpu_timer.end_cpu("uniforms");
+        update_primary_rays(progressive ? progressive_renderer->get_generation(get_global_transform()) : 0);
+        gpu_timer.begin_cpu("uniforms");
+        cs->update_storage_buffer_uniform(camera_rid, camera.to_packed_byte_array());
+        gpu_timer.end_cpu("uniforms");
+
+        // render, the statistics add up over the batches and are read with the next frame
+        gpu_timer.begin("path_tracing");
+        if (tiled_rendering)
+            render_tiles(progressive);
+        else
+            cs->compute(get_dispatch_size());
+        gpu_timer.end("path_tracing");
+        camera.end_dispatch();
+        statistics_pending = true;
+
+        render_post_processing(Size);
     }
-    
+
+    // the single sync of the frame, every timestamp above is captured by it
+    if (output_texture.is_null() || post_processing.is_empty())
+        return;
+    gpu_timer.begin_cpu("readback");
     output_image->set_data(Size.x, Size.y, false, Image::FORMAT_RGBA8,
-                           cs->get_image_uniform_buffer(output_texture_rid));
+                           _rd->texture_get_data(display_texture_rid, 0));
     output_texture->update(output_image);
+    gpu_timer.end_cpu("readback");
     // load texture data?
 }
+
+// statistics of the previous frame. Its display readback already waited for the device, so this readback does not
+// stall on gpu work
+void PathTracingCamera::read_statistics()
+{
+    if (!statistics_pending)
+        return;
+    gpu_timer.begin_cpu("readback");
+    PackedByteArray statistics = _rd->buffer_get_data(statistics_rid);
+    gpu_timer.end_cpu("readback");
+    if (statistics.size() >= sizeof(RenderStatistics))
+        std::memcpy(&render_statistics, statistics.ptr(), sizeof(RenderStatistics));
+    statistics_pending = false;
+}
+
+//--------- OFFLINE RENDERING ---------
+
+// same curve as tonemap.glsl
+static float aces_film(float x)
+{
+    return std::clamp((x * (2.51f * x + 0.03f)) / (x * (2.43f * x + 0.59f) + 0.14f), 0.0f, 1.0f);
+}
+
+// the exposure the tonemap stage adapts to for this image: the mean of the log luminance histogram of the lit
+// pixels mapped to middle grey, with the same bins as tonemap.glsl
+static float still_exposure(const float *radiance, int64_t pixels, bool auto_exposure, float exposure_compensation)
+{
+    const int bins = 256;
+    const float min_log_luminance = -10.0f;
+    const float log_luminance_range = 22.0f;
+    float exposure = std::exp2(exposure_compensation);
+    if (!auto_exposure)
+        return exposure;
+
+    double weighted = 0.0;
+    int64_t lit = 0;
+    for (int64_t i = 0; i < pixels; i++)
+    {
+        const float *c = radiance + i * 4;
+        const float l = 0.2126f * c[0] + 0.7152f * c[1] + 0.0722f * c[2];
+        if (!(l >= 1e-5f))
+            continue; // bin 0, black or nan
+        const float t = std::clamp((std::log2(l) - min_log_luminance) / log_luminance_range, 0.0f, 1.0f);
+        weighted += static_cast<int>(t * (bins - 2) + 1.0f);
+        lit++;
+    }
+    if (lit == 0)
+        return exposure;
+    const double mean_bin = weighted / lit - 1.0;
+    const float average = static_cast<float>(std::exp2(mean_bin / (bins - 2) * log_luminance_range + min_log_luminance));
+    return exposure * 0.18f / std::max(average, 1e-4f);
+}
+
+// writes <path>.exr (linear) and <path>.png (tonemapped at exposure) of rgbaf radiance, with the rmse against
+// reference_path if given
+static void write_still(const Vector2i resolution, const PackedByteArray &radiance, float exposure, const String &path,
+                        const String &reference_path, Dictionary &result)
+{
+    const int64_t pixels = static_cast<int64_t>(resolution.x) * resolution.y;
+    const String base = path.get_extension().is_empty() ? path : path.get_basename();
+    Ref<Image> hdr_image = Image::create_from_data(resolution.x, resolution.y, false, Image::FORMAT_RGBAF, radiance);
+    result["exr_error"] = hdr_image->save_exr(base + ".exr", false);
+
+    PackedByteArray ldr;
+    ldr.resize(pixels * 4);
+    const float *src = reinterpret_cast<const float *>(radiance.ptr());
+    uint8_t *dst = ldr.ptrw();
+    for (int64_t i = 0; i < pixels; i++)
+    {
+        for (int c = 0; c < 3; c++)
+            dst[i * 4 + c] = static_cast<uint8_t>(aces_film(src[i * 4 + c] * exposure) * 255.0f + 0.5f);
+        dst[i * 4 + 3] = 255;
+    }
+    result["png_error"] = Image::create_from_data(resolution.x, resolution.y, false, Image::FORMAT_RGBA8, ldr)->save_png(base + ".png");
+
+    if (!reference_path.is_empty())
+    { // error against a converged render, for comparing time to error between samplers
+        Ref<Image> reference = Image::load_from_file(reference_path);
+        if (reference.is_valid() && reference->get_size() == resolution)
+        {
+            reference->convert(Image::FORMAT_RGBAF);
+            const PackedByteArray reference_data = reference->get_data();
+            const float *ref = reinterpret_cast<const float *>(reference_data.ptr());
+            double squared_error = 0.0;
+            for (int64_t i = 0; i < pixels * 4; i++)
+                if (i % 4 != 3)
+                    squared_error += (src[i] - ref[i]) * (src[i] - ref[i]);
+            result["rmse"] = std::sqrt(squared_error / (pixels * 3));
+        }
+        else
+        {
+            UtilityFunctions::printerr("Reference image missing or of a different resolution: ", reference_path);
+        }
+    }
+}
+
+Dictionary PathTracingCamera::render_offline(Vector2i resolution, int samples_per_pixel, const String &path,
+                                             const String &reference_path)
+{
+    Dictionary result;
+    if (geometry_group == nullptr)
+    {
+        UtilityFunctions::printerr("Offline rendering needs a geometry group.");
+        return result;
+    }
+    if (resolution.x <= 0 || resolution.y <= 0 || samples_per_pixel <= 0)
+    {
+        UtilityFunctions::printerr("Invalid offline render settings: ", resolution, " ", samples_per_pixel, " spp.");
+        return result;
+    }
+    if (_rd == nullptr)
+    { // e.g. --headless, which runs the dummy renderer
+        UtilityFunctions::print("No RenderingDevice, rendering the still on the cpu instead.");
+        result = render_reference(resolution, samples_per_pixel, path, reference_path);
+        result["cpu_fallback"] = true;
+        return result;
+    }
+
+    uint64_t start = Time::get_singleton()->get_ticks_usec();
+
+    // switch to the requested resolution, the interactive setup is restored afterwards
+    const RenderParameters interactive_parameters = render_parameters;
+    clear_compute_shader();
+    offline_rendering = true;
+    set_resolution(resolution);
+    init_compute_shader();
+
+    // accumulation in float through the progressive renderer, with a fixed sample count
+    PostProcessChain accumulator;
+    accumulator.add(new ProgressiveRendering());
+    set_post_processing_inputs(accumulator);
+    if (cs != nullptr && cs->check_ready())
+        accumulator.init(_rd, resolution, workgroup_size);
+    PostProcessFrame frame;
+    uint64_t setup_end = Time::get_singleton()->get_ticks_usec();
+
+    PackedByteArray radiance;
+    // an interleaved dispatch traces a part of the pixels only, every pixel still gets the requested samples
+    const int interleave_factor = get_interleave_factor();
+    const int dispatches = (samples_per_pixel + render_parameters.samples_per_frame - 1) / render_parameters.samples_per_frame *
+                           interleave_factor;
+    if (cs != nullptr && cs->check_ready())
+    {
+        const Transform3D transform = get_global_transform();
+        frame.camera_transform = transform;
+        frame.projection = projection_matrix;
+        camera.set_camera_transform(transform, projection_matrix);
+        camera.use_sample_mask = 0;
+        cs->update_storage_buffer_uniform(render_parameters_rid, render_parameters.to_packed_byte_array());
+        for (int i = 0; i < dispatches; i++)
+        {
+            camera.frame_index++;
+            camera.sample_frame = i; // the accumulator started with this render
+            update_primary_rays(1); // the camera holds still and the cache was just created
+            cs->update_storage_buffer_uniform(camera_rid, camera.to_packed_byte_array());
+            if (tiled_rendering)
+                render_tiles(false); // every tile each sample, tiles only keep single submissions short
+            else
+                cs->compute(get_dispatch_size());
+            camera.end_dispatch();
+            accumulator.render(frame);
+        }
+        radiance = cs->get_image_uniform_buffer(output_texture_rid); // waits for the gpu
+    }
+    uint64_t render_end = Time::get_singleton()->get_ticks_usec();
+
+    const int64_t pixels = static_cast<int64_t>(resolution.x) * resolution.y;
+    if (radiance.size() >= pixels * 4 * static_cast<int64_t>(sizeof(float)))
+    {
+        const float exposure = still_exposure(reinterpret_cast<const float *>(radiance.ptr()), pixels, auto_exposure,
+                                              exposure_compensation);
+        write_still(resolution, radiance, exposure, path, reference_path, result);
+        result["exposure"] = exposure;
+    }
+    else
+    {
+        result["exr_error"] = ERR_CANT_CREATE;
+        result["png_error"] = ERR_CANT_CREATE;
+        UtilityFunctions::printerr("Offline rendering failed, the output image could not be read back.");
+    }
+    uint64_t write_end = Time::get_singleton()->get_ticks_usec();
+
+    // back to the interactive setup
+    accumulator.clear();
+    clear_compute_shader();
+    offline_rendering = false;
+    render_parameters = interactive_parameters;
+    set_resolution(Vector2i(render_parameters.width, render_parameters.height));
+    init_compute_shader();
+    parameters_dirty = true;
+
+    result["samples_per_pixel"] = dispatches / interleave_factor * static_cast<int>(render_parameters.samples_per_frame);
+    result["setup_time_ms"] = (setup_end - start) / 1000.0f;
+    result["render_time_ms"] = (render_end - setup_end) / 1000.0f;
+    result["write_time_ms"] = (write_end - render_end) / 1000.0f;
+    result["total_time_ms"] = (write_end - start) / 1000.0f;
+    UtilityFunctions::print("Offline render ", resolution, " at ", result["samples_per_pixel"], " spp took ",
+                            result["total_time_ms"], " ms (render ", result["render_time_ms"], " ms).");
+    return result;
+}
+
+Dictionary PathTracingCamera::render_reference(Vector2i resolution, int samples_per_pixel, const String &path,
+                                               const String &reference_path)
+{
+    Dictionary result;
+    if (geometry_group == nullptr)
+    {
+        UtilityFunctions::printerr("Reference rendering needs a geometry group.");
+        return result;
+    }
+    if (resolution.x <= 0 || resolution.y <= 0 || samples_per_pixel <= 0)
+    {
+        UtilityFunctions::printerr("Invalid reference render settings: ", resolution, " ", samples_per_pixel, " spp.");
+        return result;
+    }
+
+    uint64_t start = Time::get_singleton()->get_ticks_usec();
+    Camera reference_camera;
+    reference_camera.set_camera_transform(get_global_transform(),
+                                          Projection::create_perspective(fov, static_cast<float>(resolution.x) / resolution.y, 0.01f, 1000.0f, false));
+    CpuPathTracer tracer(*geometry_group, texture_sampling);
+    PackedByteArray radiance;
+    radiance.resize(static_cast<int64_t>(resolution.x) * resolution.y * 4 * sizeof(float));
+    uint64_t setup_end = Time::get_singleton()->get_ticks_usec();
+
+    tracer.render(reference_camera, resolution, samples_per_pixel, num_bounces, reinterpret_cast<float *>(radiance.ptrw()));
+    uint64_t render_end = Time::get_singleton()->get_ticks_usec();
+
+    const float exposure = still_exposure(reinterpret_cast<const float *>(radiance.ptr()),
+                                          static_cast<int64_t>(resolution.x) * resolution.y, auto_exposure, exposure_compensation);
+    write_still(resolution, radiance, exposure, path, reference_path, result);
+    result["exposure"] = exposure;
+    uint64_t write_end = Time::get_singleton()->get_ticks_usec();
+
+    const uint64_t render_usec = std::max<uint64_t>(1, render_end - setup_end);
+    result["samples_per_pixel"] = samples_per_pixel;
+    result["rays_traced"] = tracer.get_rays_traced();
+    result["mrays_per_second"] = static_cast<double>(tracer.get_rays_traced()) / render_usec;
+    result["setup_time_ms"] = (setup_end - start) / 1000.0f;
+    result["render_time_ms"] = (render_end - setup_end) / 1000.0f;
+    result["write_time_ms"] = (write_end - render_end) / 1000.0f;
+    result["total_time_ms"] = (write_end - start) / 1000.0f;
+    UtilityFunctions::print("Reference render ", resolution, " at ", samples_per_pixel, " spp took ",
+                            result["render_time_ms"], " ms, ", result["mrays_per_second"], " Mrays/s on the cpu.");
+    return result;
+}
@@ -1,19 +1,34 @@
 #ifndef PATH_TRACING_CAMERA_H
 #define PATH_TRACING_CAMERA_H
 
+#include "blue_noise.h"
+#include "cpu_path_tracer.h"
 #include "geometry_group3d.h"
 #include "gdcs/include/gdcs.h"
+#include "post_process_stage.h"
 #include "temporal_reprojection.h"
 #include "progressive_rendering.h"
+#include "interleave_reconstruction.h"
+#include "svgf_denoiser.h"
+#include "tonemap.h"
+#include "visibility_buffer.h"
+#include "gpu_timer.h"
 #include "render_parameters.h"
+#include "shader_cache.h"
+#include <godot_cpp/classes/config_file.hpp>
 #include <godot_cpp/classes/engine.hpp>
 #include <godot_cpp/classes/image.hpp>
 #include <godot_cpp/classes/image_texture.hpp>
 #include <godot_cpp/classes/node3d.hpp>
+#include <godot_cpp/classes/performance.hpp>
 #include <godot_cpp/classes/rd_texture_format.hpp>
 #include <godot_cpp/classes/rd_texture_view.hpp>
+#include <godot_cpp/classes/texture2d.hpp>
 #include <godot_cpp/classes/texture_rect.hpp>
+#include <godot_cpp/classes/time.hpp>
 #include <godot_cpp/core/class_db.hpp>
+#include <godot_cpp/variant/callable_method_pointer.hpp>
+#include <godot_cpp/variant/dictionary.hpp>
 #include <godot_cpp/variant/packed_byte_array.hpp>
 #include <godot_cpp/variant/projection.hpp>
 #include <godot_cpp/variant/transform3d.hpp>
@@ -30,7 +45,40 @@ class PathTracingCamera : public Node3D
     enum Denoising {
         PROGRESSIVE_RENDERING,
         TEMPORAL_REPROJECTION,
-        NONE
+        NONE,
+        SVGF
+    };
+
+    enum Traversal {
+        TRAVERSAL_STACK,
+        TRAVERSAL_STACKLESS
+    };
+
+    enum Sampler {
+        SAMPLER_RANDOM,
+        SAMPLER_SOBOL,
+        SAMPLER_BLUE_NOISE
+    };
+
+    // storage of the post processing accumulation and history buffers
+    enum Precision {
+        PRECISION_FULL, // rgba32f
+        PRECISION_HALF, // rgba16f. Accumulation counts up to 2048 samples, after that the mean is a moving average.
+        PRECISION_PACKED // r11g11b10f, histories without alpha only. Half precision where storage is unsupported.
+    };
+
+    // subset of the pixels traced per frame, the rest is reconstructed
+    enum Interleave {
+        INTERLEAVE_NONE,
+        INTERLEAVE_CHECKERBOARD, // half of the pixels
+        INTERLEAVE_2X2 // a quarter of the pixels
+    };
+
+    // fraction of the frames each pixel is traced in, the rest is reconstructed
+    enum SampleDensity {
+        SAMPLE_DENSITY_NONE,
+        SAMPLE_DENSITY_RADIAL, // full around the gaze point, falling off towards the periphery
+        SAMPLE_DENSITY_TEXTURE // read from density_texture, white is traced every frame
     };
 
     struct RenderParameters // match the struct on the gpu
@@ -41,6 +89,12 @@ class PathTracingCamera : public Node3D
         float fov;
         unsigned int triangleCount;
         unsigned int blasCount;
+        unsigned int samples_per_frame = 1;
+        int tile_offset[2] = {0, 0};
+        float gaze[2] = {0.5f, 0.5f};
+        float fovea_radius = 0.15f;
+        float periphery_radius = 0.6f;
+        float min_density = 0.125f;
 
         PackedByteArray to_packed_byte_array()
         {
@@ -51,6 +105,24 @@ class PathTracingCamera : public Node3D
         }
     };
 
+    struct RenderStatistics // match the struct on the gpu
+    {
+        unsigned int rays_traced = 0;
+        unsigned int sorted_rays[2] = {0, 0}; // 0: direction sort, 1: material sort
+        unsigned int coherent_before[2] = {0, 0};
+        unsigned int coherent_after[2] = {0, 0};
+        unsigned int paths_traced = 0;
+        unsigned int candidate_pixels = 0;
+
+        PackedByteArray to_packed_byte_array()
+        {
+            PackedByteArray byte_array;
+            byte_array.resize(sizeof(RenderStatistics));
+            std::memcpy(byte_array.ptrw(), this, sizeof(RenderStatistics));
+            return byte_array;
+        }
+    };
+
   protected:
     static void _bind_methods();
 
@@ -60,8 +132,8 @@ class PathTracingCamera : public Node3D
     float get_fov() const;
     void set_fov(float value);
 
-    // int get_num_bounces() const;
-    // void set_num_bounces(int value);
+    int get_num_bounces() const;
+    void set_num_bounces(int value);
 
     TextureRect *get_output_texture() const;
     void set_output_texture(TextureRect *value);
@@ -72,21 +144,179 @@ class PathTracingCamera : public Node3D
     Denoising get_denoising_mode() const;
     void set_denoising_mode(Denoising mode);
 
+    // a-trous passes of the SVGF filter, each doubles the filter radius
+    int get_svgf_iterations() const;
+    void set_svgf_iterations(int value);
+
+    bool get_ray_sorting() const;
+    void set_ray_sorting(bool value);
+
+    int get_samples_per_frame() const;
+    void set_samples_per_frame(int value);
+
+    int get_batch_frames() const;
+    void set_batch_frames(int value);
+
+    bool get_debug_steps() const;
+    void set_debug_steps(bool value);
+
+    bool get_texture_sampling() const;
+    void set_texture_sampling(bool value);
+
+    bool get_use_shader_cache() const;
+    void set_use_shader_cache(bool value);
+
+    void clear_shader_cache();
+
+    bool get_adaptive_sampling() const;
+    void set_adaptive_sampling(bool value);
+
+    float get_adaptive_threshold() const;
+    void set_adaptive_threshold(float value);
+
+    int get_adaptive_min_samples() const;
+    void set_adaptive_min_samples(int value);
+
+    float get_convergence_fraction() const;
+    void set_convergence_fraction(float value);
+
+    bool get_tiled_rendering() const;
+    void set_tiled_rendering(bool value);
+
+    int get_tile_size() const;
+    void set_tile_size(int value);
+
+    float get_frame_budget_ms() const;
+    void set_frame_budget_ms(float value);
+
+    Vector2i get_workgroup_size() const;
+    void set_workgroup_size(Vector2i value);
+
+    Traversal get_traversal() const;
+    void set_traversal(Traversal value);
+
+    Sampler get_sampler() const;
+    void set_sampler(Sampler value);
+
+    bool get_restir_di() const;
+    void set_restir_di(bool value);
+
+    bool get_hybrid_rendering() const;
+    void set_hybrid_rendering(bool value);
+
+    int get_primary_cache_positions() const;
+    void set_primary_cache_positions(int value);
+
+    Interleave get_interleave() const;
+    void set_interleave(Interleave value);
+
+    SampleDensity get_sample_density() const;
+    void set_sample_density(SampleDensity value);
+
+    Vector2 get_gaze_point() const;
+    void set_gaze_point(Vector2 value);
+
+    float get_fovea_radius() const;
+    void set_fovea_radius(float value);
+
+    float get_periphery_radius() const;
+    void set_periphery_radius(float value);
+
+    float get_min_density() const;
+    void set_min_density(float value);
+
+    Ref<Texture2D> get_density_texture() const;
+    void set_density_texture(const Ref<Texture2D> &value);
+
+    bool get_auto_exposure() const;
+    void set_auto_exposure(bool value);
+
+    float get_exposure_compensation() const;
+    void set_exposure_compensation(float value);
+
+    float get_exposure_adaptation_speed() const;
+    void set_exposure_adaptation_speed(float value);
+
+    Precision get_accumulation_precision() const;
+    void set_accumulation_precision(Precision value);
+
+    Precision get_history_precision() const;
+    void set_history_precision(Precision value);
+
+    bool get_auto_tune() const;
+    void set_auto_tune(bool value);
+
+    void tune();
+    // gpu throughput of the current view with ray sorting off and on, over frames dispatches each
+    Dictionary benchmark_ray_sorting(int frames = 16);
+
+    Dictionary get_render_statistics() const;
+
+    // gpu time in ms per pass of the previous frame, cpu time for readbacks and uniform updates
+    Dictionary get_pass_times() const;
+    float get_pass_time_ms(const String &pass) const;
+    // throughput of the path tracing pass of the previous frame, on its gpu time
+    float get_gpu_mrays_per_second() const;
+    float get_paths_per_second() const;
+
+    // publishes the pass times and throughput as custom monitors of the Performance singleton
+    bool get_performance_monitors() const;
+    void set_performance_monitors(bool value);
+
+    // renders a still without the window or output texture and writes <path>.exr (linear) and <path>.png, tonemapped
+    // with the exposure settings of the camera. Auto exposure uses the exposure the viewport adapts to for the image.
+    // Given the exr of a converged render, the rmse against it is reported as well.
+    // --headless runs Godot's dummy renderer, which has no RenderingDevice. Without one the still is rendered by
+    // render_reference on the cpu. For the gpu path run with a rendering driver, e.g.
+    // godot --path project --rendering-driver vulkan <scene calling render_offline>
+    Dictionary render_offline(Vector2i resolution, int samples_per_pixel, const String &path,
+                              const String &reference_path = "");
+
+    // the same still path traced on the cpu, without a RenderingDevice. Reports the throughput in Mrays/s.
+    Dictionary render_reference(Vector2i resolution, int samples_per_pixel, const String &path,
+                                const String &reference_path = "");
+
   private:
     void init();
+    void init_compute_shader();
     void clear_compute_shader();
     void render();
+    void read_statistics();
+    void set_post_processing_inputs(PostProcessChain &chain) const;
+    void build_post_processing(const Vector2i Size);
+    void render_post_processing(const Vector2i Size);
+    void add_performance_monitors();
+    void remove_performance_monitors();
+    void render_tiles(bool progressive);
+    void update_primary_rays(unsigned int cache_generation);
+    void build_tile_order();
+
+    std::vector<String> get_shader_defines() const;
+    Vector3i get_dispatch_size() const;
+    int get_interleave_factor() const;
+    bool needs_reconstruction() const;
+    bool is_hybrid_active() const;
+    void clamp_workgroup_size();
+
+    bool load_tuning();
+    void save_tuning() const;
+    String get_device_key() const;
+    float benchmark(int frames);
+    void set_resolution(Vector2i resolution);
 
     float fov = 90.0f;
-    // int num_bounces = 4;
+    int num_bounces = 5;
 
     ComputeShader *cs = nullptr;
-    ProgressiveRendering *progressive_renderer = nullptr;
-    TemporalReprojection *temporal_reprojection = nullptr;
+    PostProcessChain post_processing; // built for the denoising mode, bound to the textures of the current shader
+    ProgressiveRendering *progressive_renderer = nullptr; // owned by post_processing, for adaptive sampling
+    SVGFDenoiser *svgf_denoiser = nullptr; // owned by post_processing while denoising with SVGF
+    Tonemap *tonemap = nullptr; // owned by post_processing, always the last stage
     GeometryGroup3D *geometry_group = nullptr;
     TextureRect *output_texture_rect = nullptr;
     Ref<Image> output_image;
     Ref<Image> depth_image;
+    Ref<Image> sample_mask_image;
     Ref<ImageTexture> output_texture;
 
     RenderParameters render_parameters;
@@ -96,6 +326,7 @@ class PathTracingCamera : public Node3D
     // BUFFER IDs
     RID output_texture_rid;
     RID depth_texture_rid;
+    RID sample_mask_rid;
     RID render_parameters_rid;
     RID camera_rid;
     RID triangles_geometry_rid;
@@ -104,13 +335,103 @@ class PathTracingCamera : public Node3D
     RID bvh_tree_rid;
     RID blas_rid;
     RID tlas_rid;
+    RID bvh_links_rid;
+    RID tlas_links_rid;
     RID texture_array_rid;
+    RID environment_distribution_rid;
+    RID environment_map_rid;
+    RID statistics_rid;
+    RID blue_noise_rid;
+    RID reservoirs_rid;
+    RID reservoir_surfaces_rid;
+    RID gbuffer_rids[3]; // normal, albedo, depth
+    RID motion_vectors_rid;
+    RID visibility_rid; // owned by visibility_buffer in hybrid mode
+    RID primary_cache_rid;
+    RID sample_density_rid;
+    RID display_texture_rid; // tonemapped rgba8, owned by the post processing pool
+    RID emitters_rid;
 
-    RenderingDevice *_rd;
+    RenderingDevice *_rd = nullptr;
 
     Denoising denoising_mode = PROGRESSIVE_RENDERING; // Default option
+    Denoising post_processing_mode = NONE; // mode the chain was built for
+    bool post_processing_dirty = false; // rebuild the chain with new settings
+    Precision accumulation_precision = PRECISION_FULL;
+    Precision history_precision = PRECISION_FULL;
+
+    // shader variant toggles, changing any of these rebuilds the compute shader
+    bool ray_sorting = false;
+    bool debug_steps = false;
+    bool texture_sampling = true;
+    bool use_shader_cache = true;
+    bool shader_dirty = false;
+    bool parameters_dirty = false;
+    bool offline_rendering = false; // the output texture is left alone while rendering offline
+
+    int batch_frames = 1; // dispatches per presented frame, for offline stills
+
+    // tiled rendering: tiles are dispatched centre first, as many per frame as fit in the budget
+    bool tiled_rendering = false;
+    int tile_size = 256;
+    float frame_budget_ms = 12.0f;
+    std::vector<Vector2i> tile_order;
+    size_t next_tile = 0;
+    float tile_time_ms = 1.0f; // running estimate of the gpu time of one tile
+
+    GpuTimer gpu_timer;
+    RenderStatistics timed_statistics; // the statistics of the frame gpu_timer last resolved
+    bool performance_monitors = true;
+    bool monitors_added = false; // the first camera in the tree owns the monitors
+
+    // adaptive sampling in progressive mode
+    bool adaptive_sampling = false;
+    float adaptive_threshold = 0.02f;
+    int adaptive_min_samples = 16;
+    float convergence_fraction = 0.001f;
+
+    // dispatch shape and traversal, either set by hand or picked by tune()
+    Vector2i workgroup_size = Vector2i(32, 32);
+    Traversal traversal = TRAVERSAL_STACK;
+    bool auto_tune = false;
+
+    Sampler sampler = SAMPLER_SOBOL;
+
+    // reservoir resampled direct light from emissive triangles at the primary hit
+    bool restir_di = false;
+
+    // hybrid rendering: primary visibility is rasterized, the bvh is only traversed from the first bounce on
+    bool hybrid_rendering = false;
+    bool hybrid_failed = false; // the visibility raster could not be set up, primary rays are traced until the setting changes
+    VisibilityBuffer visibility_buffer;
+
+    // primary hits of a static camera in progressive mode, for this many fixed jitter positions per pixel
+    int primary_cache_positions = 0;
+
+    // ignored in tiled rendering, tiles already bound the cost of a frame
+    Interleave interleave = INTERLEAVE_NONE;
+
+    // foveated or importance driven tracing, the gaze and radii live in render_parameters
+    SampleDensity sample_density = SAMPLE_DENSITY_NONE;
+    Ref<Texture2D> density_texture;
+    Ref<Image> density_image; // density_texture as r8 at the render resolution
+
+    // tonemap stage, the exposure adapts on the gpu from a luminance histogram
+    bool auto_exposure = true;
+    float exposure_compensation = 0.0f; // stops
+    float exposure_adaptation_speed = 2.0f; // 1/s
+
+    int svgf_iterations = 5;
+
+    RenderStatistics render_statistics;
+    bool statistics_pending = false; // the statistics buffer holds a frame that has not been read yet
 };
 
 VARIANT_ENUM_CAST(PathTracingCamera::Denoising);
+VARIANT_ENUM_CAST(PathTracingCamera::Traversal);
+VARIANT_ENUM_CAST(PathTracingCamera::Sampler);
+VARIANT_ENUM_CAST(PathTracingCamera::Precision);
+VARIANT_ENUM_CAST(PathTracingCamera::Interleave);
+VARIANT_ENUM_CAST(PathTracingCamera::SampleDensity);
 
 #endif // PATH_TRACING_CAMERA_H
\ No newline at end of file
@@ -0,0 +1,92 @@
+#include "interleave_reconstruction.h"
+#include <utils.h>
+
+InterleaveReconstruction::InterleaveReconstruction()
+{
+}
+
+InterleaveReconstruction::~InterleaveReconstruction()
+{
+    if (cs != nullptr)
+        delete cs;
+}
+
+void InterleaveReconstruction::init(const PostProcessContext &context)
+{
+    TexturePool *pool = context.pool;
+    workgroup_size = context.workgroup_size;
+    { // setup parameters
+        render_parameters.width = context.size.x;
+        render_parameters.height = context.size.y;
+    }
+
+    // the distance lives in alpha, so a packed history format falls back to half precision
+    const RenderingDevice::DataFormat history_format =
+        context.history_format == RenderingDevice::DATA_FORMAT_R32G32B32A32_SFLOAT ? context.history_format
+                                                                                  : RenderingDevice::DATA_FORMAT_R16G16B16A16_SFLOAT;
+    std::vector<String> defines = ShaderCache::workgroup_defines(workgroup_size);
+    defines.push_back("#define HISTORY_FORMAT " + get_format_qualifier(history_format));
+    cs = ShaderCache::create(context.rd, "res://addons/jar_path_tracing/src/shaders/interleave_reconstruction.glsl", defines);
+
+    //--------- GENERAL BUFFERS ---------
+    { // input general buffer
+        render_parameters_rid = cs->create_storage_buffer_uniform(render_parameters.to_packed_byte_array(), 0, 0);
+        cs->add_existing_buffer(pool->get(PostProcessInput::SCREEN, RenderingDevice::DATA_FORMAT_R32G32B32A32_SFLOAT),
+                                RenderingDevice::UNIFORM_TYPE_IMAGE, 1, 0);
+        cs->add_existing_buffer(pool->get(PostProcessInput::DEPTH, RenderingDevice::DATA_FORMAT_R32_SFLOAT),
+                                RenderingDevice::UNIFORM_TYPE_IMAGE, 2, 0);
+    }
+
+    { // reconstructed frames, ping-ponged between frames
+        history_rid_1 = pool->get("interleave_history_1", history_format);
+        history_rid_2 = pool->get("interleave_history_2", history_format);
+        cs->add_existing_buffer(history_rid_1, RenderingDevice::UNIFORM_TYPE_IMAGE, 3, 0);
+        cs->add_existing_buffer(history_rid_2, RenderingDevice::UNIFORM_TYPE_IMAGE, 4, 0);
+    }
+
+    { // per pixel outputs of main.glsl, completed for the skipped pixels
+        const RID outputs[4] = {pool->get(PostProcessInput::MOTION_VECTORS, RenderingDevice::DATA_FORMAT_R16G16_SFLOAT),
+                                pool->get(PostProcessInput::GBUFFER_NORMAL, RenderingDevice::DATA_FORMAT_R16G16B16A16_SFLOAT),
+                                pool->get(PostProcessInput::GBUFFER_ALBEDO, RenderingDevice::DATA_FORMAT_R8G8B8A8_UNORM),
+                                pool->get(PostProcessInput::GBUFFER_DEPTH, RenderingDevice::DATA_FORMAT_R32_SFLOAT)};
+        for (int i = 0; i < 4; i++)
+            cs->add_existing_buffer(outputs[i], RenderingDevice::UNIFORM_TYPE_IMAGE, 5 + i, 0);
+    }
+
+    cs->finish_create_uniforms();
+}
+
+void InterleaveReconstruction::render(const PostProcessFrame &frame)
+{
+    const Transform3D &camera_transform = frame.camera_transform;
+    if (cs == nullptr || !cs->check_ready())
+        return;
+
+    // update rendering parameters
+    Projection vp = frame.projection * Projection(camera_transform.affine_inverse());
+    Utils::projection_to_float(render_parameters.inverse_vp, vp.inverse());
+    Utils::projection_to_float(render_parameters.previous_vp, previous_vp);
+    previous_vp = vp;
+    const Vector3 position = camera_transform.origin;
+    const Vector3 positions[2] = {position, previous_camera_position};
+    float *targets[2] = {render_parameters.camera_position, render_parameters.previous_camera_position};
+    for (int i = 0; i < 2; i++)
+    {
+        targets[i][0] = positions[i].x;
+        targets[i][1] = positions[i].y;
+        targets[i][2] = positions[i].z;
+        targets[i][3] = 1.0f;
+    }
+    previous_camera_position = position;
+    render_parameters.near = frame.projection.get_z_near();
+    render_parameters.far = frame.projection.get_z_far();
+    render_parameters.frame_count++;
+
+    // the reconstruction reads the traced neighbourhood of every pixel, so the filled pixels are written in a second pass
+    for (unsigned int pass = 0; pass < 2; pass++)
+    {
+        render_parameters.pass = pass;
+        cs->update_storage_buffer_uniform(render_parameters_rid, render_parameters.to_packed_byte_array());
+        cs->compute(get_dispatch_size({render_parameters.width, render_parameters.height}, workgroup_size));
+    }
+}
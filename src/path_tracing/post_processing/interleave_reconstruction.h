@@ -0,0 +1,63 @@
+#ifndef INTERLEAVE_RECONSTRUCTION_H
+#define INTERLEAVE_RECONSTRUCTION_H
+
+#include "gdcs/include/gdcs.h"
+#include "post_process_stage.h"
+#include "shader_cache.h"
+
+using namespace godot;
+
+// First stage of the chain when main.glsl traces an interleaved subset of the pixels (INTERLEAVE). The skipped
+// pixels are filled from the reprojected reconstruction of the previous frame, guided by the depth of the traced
+// neighbours, and keep alpha 0 such that accumulation only counts traced samples.
+class InterleaveReconstruction : public PostProcessStage
+{
+    struct RenderParameters // match the struct on the gpu
+    {
+        float inverse_vp[16];
+        float previous_vp[16];
+        float camera_position[4];
+        float previous_camera_position[4];
+        int width;
+        int height;
+        unsigned int frame_count = 0;
+        unsigned int pass = 0;
+        float near = 0.01f;
+        float far = 1000.0f;
+
+        PackedByteArray to_packed_byte_array()
+        {
+            PackedByteArray byte_array;
+            byte_array.resize(sizeof(RenderParameters));
+            std::memcpy(byte_array.ptrw(), this, sizeof(RenderParameters));
+            return byte_array;
+        }
+    };
+
+  public:
+    InterleaveReconstruction();
+    ~InterleaveReconstruction() override;
+
+    void init(const PostProcessContext &context) override;
+
+    void render(const PostProcessFrame &frame) override;
+    const char *get_name() const override
+    {
+        return "reconstruction";
+    }
+
+  private:
+    ComputeShader *cs = nullptr;
+
+    RenderParameters render_parameters;
+    Vector2i workgroup_size;
+    Projection previous_vp;
+    Vector3 previous_camera_position;
+
+    // BUFFER IDs
+    RID render_parameters_rid;
+    RID history_rid_1;
+    RID history_rid_2;
+};
+
+#endif // INTERLEAVE_RECONSTRUCTION_H
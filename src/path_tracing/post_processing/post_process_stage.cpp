@@ -0,0 +1,83 @@
+#include "post_process_stage.h"
+#include <cmath>
+
+Vector3i PostProcessStage::get_dispatch_size(const Vector2i size, const Vector2i workgroup_size)
+{
+    return Vector3i(static_cast<int32_t>(std::ceil(size.x / static_cast<float>(workgroup_size.x))),
+                    static_cast<int32_t>(std::ceil(size.y / static_cast<float>(workgroup_size.y))), 1);
+}
+
+String PostProcessStage::get_format_qualifier(RenderingDevice::DataFormat format)
+{
+    switch (format)
+    {
+    case RenderingDevice::DATA_FORMAT_R16G16B16A16_SFLOAT:
+        return "rgba16f";
+    case RenderingDevice::DATA_FORMAT_B10G11R11_UFLOAT_PACK32:
+        return "r11f_g11f_b10f";
+    default:
+        return "rgba32f";
+    }
+}
+
+PostProcessChain::~PostProcessChain()
+{
+    clear();
+}
+
+void PostProcessChain::add(PostProcessStage *stage)
+{
+    stages.push_back(stage);
+}
+
+void PostProcessChain::set_input(const String &name, const RID rid)
+{
+    pool.add_external(name, rid);
+}
+
+void PostProcessChain::init(RenderingDevice *rd, const Vector2i size, const Vector2i workgroup_size,
+                            RenderingDevice::DataFormat accumulation_format, RenderingDevice::DataFormat history_format)
+{
+    PostProcessContext context;
+    context.rd = rd;
+    context.pool = &pool;
+    context.size = size;
+    context.workgroup_size = workgroup_size;
+    context.accumulation_format = accumulation_format;
+    context.history_format = history_format;
+
+    pool.init(rd, size);
+    for (PostProcessStage *stage : stages)
+        stage->init(context);
+}
+
+void PostProcessChain::render(const PostProcessFrame &frame, GpuTimer *timer)
+{
+    for (PostProcessStage *stage : stages)
+    {
+        if (timer != nullptr)
+            timer->begin(stage->get_name());
+        stage->render(frame);
+        if (timer != nullptr)
+            timer->end(stage->get_name());
+    }
+}
+
+void PostProcessChain::clear()
+{
+    // stages first, their uniform sets refer to the pooled textures
+    for (PostProcessStage *stage : stages)
+        delete stage;
+    stages.clear();
+    pool.clear();
+}
+
+bool PostProcessChain::is_empty() const
+{
+    return stages.empty();
+}
+
+TexturePool &PostProcessChain::get_pool()
+{
+    return pool;
+}
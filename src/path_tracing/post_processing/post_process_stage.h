@@ -0,0 +1,90 @@
+#ifndef POST_PROCESS_STAGE_H
+#define POST_PROCESS_STAGE_H
+
+#include "gpu_timer.h"
+#include "texture_pool.h"
+#include <godot_cpp/variant/projection.hpp>
+#include <godot_cpp/variant/transform3d.hpp>
+#include <vector>
+
+using namespace godot;
+
+// names of the textures the path tracer adds to the pool, not every texture is valid in every shader variant
+namespace PostProcessInput
+{
+static const char *const SCREEN = "screen";             // rgba32f radiance, stages before the tonemap work in place
+static const char *const SAMPLE_MASK = "sample_mask";   // r8, adaptive sampling
+static const char *const DEPTH = "depth";               // r32f non-linear depth of the primary hits
+static const char *const MOTION_VECTORS = "motion_vectors";
+static const char *const GBUFFER_NORMAL = "gbuffer_normal";
+static const char *const GBUFFER_ALBEDO = "gbuffer_albedo";
+static const char *const GBUFFER_DEPTH = "gbuffer_depth";
+} // namespace PostProcessInput
+
+namespace PostProcessOutput
+{
+static const char *const DISPLAY = "display"; // rgba8, written by the Tonemap stage
+} // namespace PostProcessOutput
+
+struct PostProcessContext
+{
+    RenderingDevice *rd = nullptr;
+    TexturePool *pool = nullptr;
+    Vector2i size;
+    Vector2i workgroup_size = Vector2i(32, 32);
+    // progressive accumulation: rgba32f sums or rgba16f compensated means
+    RenderingDevice::DataFormat accumulation_format = RenderingDevice::DATA_FORMAT_R32G32B32A32_SFLOAT;
+    // color histories: rgba32f, rgba16f or B10G11R11 where the stage keeps no alpha
+    RenderingDevice::DataFormat history_format = RenderingDevice::DATA_FORMAT_R32G32B32A32_SFLOAT;
+};
+
+struct PostProcessFrame
+{
+    Transform3D camera_transform;
+    Projection projection;
+};
+
+// A compute pass on the output of the path tracer. Stages get their textures from the pool of the chain.
+class PostProcessStage
+{
+  public:
+    virtual ~PostProcessStage() = default;
+
+    virtual void init(const PostProcessContext &context) = 0;
+    virtual void render(const PostProcessFrame &frame) = 0;
+    // pass name for the gpu timer
+    virtual const char *get_name() const = 0;
+
+  protected:
+    static Vector3i get_dispatch_size(const Vector2i size, const Vector2i workgroup_size);
+    // glsl image format qualifier of a float format, e.g. rgba16f
+    static String get_format_qualifier(RenderingDevice::DataFormat format);
+};
+
+// Stages run in the order they were added, e.g. accumulate -> denoise -> tonemap.
+class PostProcessChain
+{
+  public:
+    ~PostProcessChain();
+
+    // takes ownership of the stage
+    void add(PostProcessStage *stage);
+    // external textures have to be added before init
+    void set_input(const String &name, const RID rid);
+    void init(RenderingDevice *rd, const Vector2i size, const Vector2i workgroup_size,
+              RenderingDevice::DataFormat accumulation_format = RenderingDevice::DATA_FORMAT_R32G32B32A32_SFLOAT,
+              RenderingDevice::DataFormat history_format = RenderingDevice::DATA_FORMAT_R32G32B32A32_SFLOAT);
+    // times every stage under its name when a timer is given
+    void render(const PostProcessFrame &frame, GpuTimer *timer = nullptr);
+    // removes all stages and frees the pooled textures
+    void clear();
+
+    bool is_empty() const;
+    TexturePool &get_pool();
+
+  private:
+    std::vector<PostProcessStage *> stages;
+    TexturePool pool;
+};
+
+#endif // POST_PROCESS_STAGE_H
@@ -11,18 +11,24 @@ ProgressiveRendering::~ProgressiveRendering()
         delete cs;
 }
 
-void ProgressiveRendering::init(RenderingDevice *rd, const RID original_screen_texture_rid, const Vector2i size)
+void ProgressiveRendering::init(const PostProcessContext &context)
 {
-    // godot::UtilityFunctions::print(original_screen_texture_rid);
-    screen_texture_rid = original_screen_texture_rid;
+    rd = context.rd;
+    TexturePool *pool = context.pool;
+    screen_texture_rid = pool->get(PostProcessInput::SCREEN, RenderingDevice::DATA_FORMAT_R32G32B32A32_SFLOAT);
+    workgroup_size = context.workgroup_size;
     { // setup parameters
-        render_parameters.width = size.x;
-        render_parameters.height = size.y;
+        render_parameters.width = context.size.x;
+        render_parameters.height = context.size.y;
         render_parameters.frame_count = 1;
     }
 
     // setup compute shader
-    cs = new ComputeShader("res://addons/jar_path_tracing/src/shaders/progressive_rendering.glsl", rd);
+    const bool half = context.accumulation_format == RenderingDevice::DATA_FORMAT_R16G16B16A16_SFLOAT;
+    std::vector<String> defines = ShaderCache::workgroup_defines(workgroup_size);
+    if (half)
+        defines.push_back("#define ACCUMULATION_HALF");
+    cs = ShaderCache::create(rd, "res://addons/jar_path_tracing/src/shaders/progressive_rendering.glsl", defines);
     //--------- GENERAL BUFFERS ---------
     { // input general buffer
         render_parameters_rid = cs->create_storage_buffer_uniform(render_parameters.to_packed_byte_array(), 0, 0);
@@ -32,35 +38,89 @@ void ProgressiveRendering::init(RenderingDevice *rd, const RID original_screen_t
     }
 
     { // frame_buffer texture
-        auto frame_buffer_format = cs->create_texture_format(size.x, size.y, RenderingDevice::DATA_FORMAT_R32G32B32A32_SFLOAT);
-        Ref<RDTextureView> frame_buffer_texture_view = memnew(RDTextureView);
-        frame_buffer_image = Image::create(size.x, size.y, false, Image::FORMAT_RGBAF);
-        frame_buffer_texture = ImageTexture::create_from_image(frame_buffer_image);
-        frame_buffer_rid = cs->create_image_uniform(frame_buffer_image, frame_buffer_format, frame_buffer_texture_view, 2, 0);
+        frame_buffer_rid = pool->get("accumulation", half ? RenderingDevice::DATA_FORMAT_R16G16B16A16_SFLOAT
+                                                          : RenderingDevice::DATA_FORMAT_R32G32B32A32_SFLOAT);
+        cs->add_existing_buffer(frame_buffer_rid, RenderingDevice::UNIFORM_TYPE_IMAGE, 2, 0);
     }
 
-
+    { // adaptive sampling
+        // half precision keeps the compensation of the mean next to the moment
+        moment_buffer_rid = pool->get("accumulation_moments", half ? RenderingDevice::DATA_FORMAT_R16G16B16A16_SFLOAT
+                                                                   : RenderingDevice::DATA_FORMAT_R32_SFLOAT);
+        cs->add_existing_buffer(moment_buffer_rid, RenderingDevice::UNIFORM_TYPE_IMAGE, 3, 0);
+        cs->add_existing_buffer(pool->get(PostProcessInput::SAMPLE_MASK, RenderingDevice::DATA_FORMAT_R8_UNORM),
+                                RenderingDevice::UNIFORM_TYPE_IMAGE, 4, 0);
+    }
 
     cs->finish_create_uniforms();
 }
 
-void ProgressiveRendering::render(Transform3D camera_transform)
+void ProgressiveRendering::render(const PostProcessFrame &frame)
 {
-    // camera.get_global_position
     if (cs == nullptr || !cs->check_ready())
         return;
+    const Transform3D &camera_transform = frame.camera_transform;
     // update rendering parameters
     bool camera_moved = !previous_transform.is_equal_approx(camera_transform);
     previous_transform = camera_transform;
 
-    if(camera_moved) {
+    if(camera_moved || restart) {
         render_parameters.frame_count = 1;
+        generation = generation % 0xFFFF + 1;
+        restart = false;
     } else {
         render_parameters.frame_count++;
     }
+    render_parameters.active_pixels = 0;
     cs->update_storage_buffer_uniform(render_parameters_rid, render_parameters.to_packed_byte_array());
 
     // render
-    Vector2i Size = {render_parameters.width, render_parameters.height};
-    cs->compute({static_cast<int32_t>(std::ceil(Size.x / 32.0f)), static_cast<int32_t>(std::ceil(Size.y / 32.0f)), 1});
+    cs->compute(get_dispatch_size({render_parameters.width, render_parameters.height}, workgroup_size));
+    active_pixels_pending = render_parameters.threshold > 0.0f;
+}
+
+void ProgressiveRendering::read_active_pixels()
+{
+    if (!active_pixels_pending || cs == nullptr)
+        return;
+    PackedByteArray data = rd->buffer_get_data(render_parameters_rid);
+    if (data.size() >= sizeof(RenderParameters))
+        render_parameters.active_pixels = reinterpret_cast<const RenderParameters *>(data.ptr())->active_pixels;
+    active_pixels_pending = false;
+}
+
+void ProgressiveRendering::set_adaptive_sampling(float threshold, int min_samples, float convergence_fraction)
+{
+    render_parameters.threshold = threshold;
+    render_parameters.min_samples = std::max(1, min_samples);
+    this->convergence_fraction = convergence_fraction;
+}
+
+bool ProgressiveRendering::has_moved(const Transform3D &camera_transform) const
+{
+    return !previous_transform.is_equal_approx(camera_transform);
+}
+
+bool ProgressiveRendering::is_converged(const Transform3D &camera_transform) const
+{
+    if (render_parameters.threshold <= 0.0f || render_parameters.frame_count < render_parameters.min_samples ||
+        has_moved(camera_transform) || restart)
+        return false;
+    const float pixels = static_cast<float>(render_parameters.width) * render_parameters.height;
+    return render_parameters.active_pixels <= convergence_fraction * pixels;
+}
+
+void ProgressiveRendering::invalidate()
+{
+    restart = true;
+}
+
+unsigned int ProgressiveRendering::get_sample_frame(const Transform3D &camera_transform) const
+{
+    return has_moved(camera_transform) || restart ? 0 : render_parameters.frame_count;
+}
+
+unsigned int ProgressiveRendering::get_generation(const Transform3D &camera_transform) const
+{
+    return has_moved(camera_transform) || restart ? generation % 0xFFFF + 1 : generation;
 }
@@ -2,13 +2,13 @@
 #define PROGRESSIVE_RENDERING_H
 
 #include "gdcs/include/gdcs.h"
-#include <godot_cpp/classes/image.hpp>
-#include <godot_cpp/classes/image_texture.hpp>
-#include <godot_cpp/variant/transform3d.hpp>
+#include "post_process_stage.h"
+#include "shader_cache.h"
 
 using namespace godot;
 
-class ProgressiveRendering
+// Accumulates the frames of a static camera into the pooled "accumulation" texture and writes the average.
+class ProgressiveRendering : public PostProcessStage
 {
 
     struct RenderParameters // match the struct on the gpu
@@ -16,6 +16,9 @@ class ProgressiveRendering
         int width;
         int height;
         unsigned int frame_count;
+        float threshold = 0.0f; // relative error at which a pixel counts as converged, 0 disables adaptive sampling
+        unsigned int min_samples = 16;
+        unsigned int active_pixels = 0; // written by the gpu
 
         PackedByteArray to_packed_byte_array()
         {
@@ -28,25 +31,51 @@ class ProgressiveRendering
 
   public:
     ProgressiveRendering();
-    ~ProgressiveRendering();
+    ~ProgressiveRendering() override;
 
-    void init(RenderingDevice *rd, const RID original_screen_texture_rid, const Vector2i size);
+    void init(const PostProcessContext &context) override;
 
-    void render(Transform3D camera_transform);
+    void render(const PostProcessFrame &frame) override;
+    const char *get_name() const override
+    {
+        return "progressive";
+    }
+
+    // adaptive sampling: pixels whose relative error drops below threshold are masked out of main.glsl.
+    // The image counts as converged once at most convergence_fraction of the pixels still need samples.
+    void set_adaptive_sampling(float threshold, int min_samples, float convergence_fraction);
+    bool has_moved(const Transform3D &camera_transform) const;
+    bool is_converged(const Transform3D &camera_transform) const;
+    // reads how many pixels still needed samples in the previous frame. Call once its frame has synced, such that
+    // the readback does not wait for the gpu.
+    void read_active_pixels();
+
+    // the scene changed, the accumulation restarts with the next frame
+    void invalidate();
+    // changes whenever the accumulation restarts, including the restart of the next frame if the camera moved.
+    // Per pixel data that only holds for a static camera and scene, such as cached primary hits, is keyed by it.
+    unsigned int get_generation(const Transform3D &camera_transform) const;
+    // frames accumulated before the next one, 0 when the next frame restarts the accumulation
+    unsigned int get_sample_frame(const Transform3D &camera_transform) const;
 
   private:
     ComputeShader *cs = nullptr;
-    Ref<Image> frame_buffer_image;
-    Ref<ImageTexture> frame_buffer_texture;
+    RenderingDevice *rd = nullptr;
 
     RenderParameters render_parameters;
+    Vector2i workgroup_size;
 
     Transform3D previous_transform;
+    float convergence_fraction = 0.0f;
+    bool restart = false;
+    bool active_pixels_pending = false; // the gpu counted active pixels that were not read yet
+    unsigned int generation = 1; // 16 bits, never 0
 
     // BUFFER IDs
     RID render_parameters_rid;
     RID screen_texture_rid;
     RID frame_buffer_rid;
+    RID moment_buffer_rid;
 };
 
 #endif // PROGRESSIVE_RENDERING_H
\ No newline at end of file
@@ -0,0 +1,106 @@
+#include "svgf_denoiser.h"
+#include <utils.h>
+
+SVGFDenoiser::SVGFDenoiser()
+{
+}
+
+SVGFDenoiser::~SVGFDenoiser()
+{
+    if (atrous_cs != nullptr)
+        delete atrous_cs;
+    if (temporal_cs != nullptr)
+        delete temporal_cs;
+}
+
+void SVGFDenoiser::init(const PostProcessContext &context)
+{
+    RenderingDevice *rd = context.rd;
+    TexturePool *pool = context.pool;
+    workgroup_size = context.workgroup_size;
+    { // setup parameters
+        render_parameters.width = context.size.x;
+        render_parameters.height = context.size.y;
+    }
+
+    // both passes share every buffer, the temporal pass owns the parameters
+    // the history length lives in alpha, so a packed history format falls back to half precision
+    const RenderingDevice::DataFormat history_format =
+        context.history_format == RenderingDevice::DATA_FORMAT_R32G32B32A32_SFLOAT ? context.history_format
+                                                                                  : RenderingDevice::DATA_FORMAT_R16G16B16A16_SFLOAT;
+    std::vector<String> defines = ShaderCache::workgroup_defines(workgroup_size);
+    defines.push_back("#define HISTORY_FORMAT " + get_format_qualifier(history_format));
+    temporal_cs = ShaderCache::create(rd, "res://addons/jar_path_tracing/src/shaders/svgf_temporal.glsl", defines);
+    atrous_cs = ShaderCache::create(rd, "res://addons/jar_path_tracing/src/shaders/svgf_atrous.glsl", defines);
+
+    //--------- GENERAL BUFFERS ---------
+    { // input general buffer
+        render_parameters_rid = temporal_cs->create_storage_buffer_uniform(render_parameters.to_packed_byte_array(), 0, 0);
+        atrous_cs->add_existing_buffer(render_parameters_rid, RenderingDevice::UNIFORM_TYPE_STORAGE_BUFFER, 0, 0);
+
+        const RID inputs[4] = {pool->get(PostProcessInput::SCREEN, RenderingDevice::DATA_FORMAT_R32G32B32A32_SFLOAT),
+                               pool->get(PostProcessInput::GBUFFER_NORMAL, RenderingDevice::DATA_FORMAT_R16G16B16A16_SFLOAT),
+                               pool->get(PostProcessInput::GBUFFER_ALBEDO, RenderingDevice::DATA_FORMAT_R8G8B8A8_UNORM),
+                               pool->get(PostProcessInput::GBUFFER_DEPTH, RenderingDevice::DATA_FORMAT_R32_SFLOAT)};
+        for (int i = 0; i < 4; i++)
+        {
+            temporal_cs->add_existing_buffer(inputs[i], RenderingDevice::UNIFORM_TYPE_IMAGE, 1 + i, 0);
+            atrous_cs->add_existing_buffer(inputs[i], RenderingDevice::UNIFORM_TYPE_IMAGE, 1 + i, 0);
+        }
+    }
+
+    { // history textures persist between frames, the moments of this frame and the filter ping-pong are scratch
+        const RenderingDevice::DataFormat format = RenderingDevice::DATA_FORMAT_R32G32B32A32_SFLOAT;
+        history_color_rid = pool->get("svgf_history_color", history_format);
+        history_moments_rid = pool->get("svgf_history_moments", format);
+        current_moments_rid = pool->get_transient(2, format);
+        filter_ping_rid = pool->get_transient(0, format);
+        filter_pong_rid = pool->get_transient(1, format);
+        previous_gbuffer_rid = pool->get("svgf_previous_gbuffer", format);
+        const RID rids[6] = {history_color_rid, history_moments_rid, current_moments_rid,
+                             filter_ping_rid,   filter_pong_rid,     previous_gbuffer_rid};
+        for (int i = 0; i < 6; i++)
+        {
+            temporal_cs->add_existing_buffer(rids[i], RenderingDevice::UNIFORM_TYPE_IMAGE, 5 + i, 0);
+            atrous_cs->add_existing_buffer(rids[i], RenderingDevice::UNIFORM_TYPE_IMAGE, 5 + i, 0);
+        }
+    }
+
+    temporal_cs->finish_create_uniforms();
+    atrous_cs->finish_create_uniforms();
+}
+
+void SVGFDenoiser::render(const PostProcessFrame &frame)
+{
+    const Transform3D &camera_transform = frame.camera_transform;
+    if (temporal_cs == nullptr || !temporal_cs->check_ready() || atrous_cs == nullptr || !atrous_cs->check_ready())
+        return;
+
+    // update rendering parameters
+    Projection vp = frame.projection * Projection(camera_transform.affine_inverse());
+    Utils::projection_to_float(render_parameters.inverse_vp, vp.inverse());
+    Utils::projection_to_float(render_parameters.previous_vp, previous_vp);
+    previous_vp = vp;
+    render_parameters.camera_position[0] = camera_transform.origin.x;
+    render_parameters.camera_position[1] = camera_transform.origin.y;
+    render_parameters.camera_position[2] = camera_transform.origin.z;
+    render_parameters.camera_position[3] = 1.0f;
+
+    Vector3i groups = get_dispatch_size({render_parameters.width, render_parameters.height}, workgroup_size);
+
+    render_parameters.iteration = 0;
+    temporal_cs->update_storage_buffer_uniform(render_parameters_rid, render_parameters.to_packed_byte_array());
+    temporal_cs->compute(groups);
+
+    for (int i = 0; i < render_parameters.iterations; i++)
+    {
+        render_parameters.iteration = i;
+        atrous_cs->update_storage_buffer_uniform(render_parameters_rid, render_parameters.to_packed_byte_array());
+        atrous_cs->compute(groups);
+    }
+}
+
+void SVGFDenoiser::set_iterations(int value)
+{
+    render_parameters.iterations = std::max(1, value);
+}
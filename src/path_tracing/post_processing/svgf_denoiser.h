@@ -0,0 +1,70 @@
+#ifndef SVGF_DENOISER_H
+#define SVGF_DENOISER_H
+
+#include "gdcs/include/gdcs.h"
+#include "post_process_stage.h"
+#include "shader_cache.h"
+
+using namespace godot;
+
+// Spatiotemporal variance-guided filtering (Schied et al. 2017) of the path traced frame. A temporal pass accumulates
+// the illumination (color divided by albedo) and its moments, then a number of edge-aware a-trous passes filter it
+// guided by the variance and the normal, albedo and depth G-buffer that main.glsl writes with GBUFFER_OUTPUT.
+class SVGFDenoiser : public PostProcessStage
+{
+    struct RenderParameters // match the struct on the gpu
+    {
+        float inverse_vp[16];
+        float previous_vp[16];
+        float camera_position[4];
+        int width;
+        int height;
+        int iteration = 0;
+        int iterations = 5;
+        float phi_color = 4.0f;
+        float phi_normal = 128.0f;
+        float phi_depth = 0.1f;
+        float alpha = 0.2f;
+
+        PackedByteArray to_packed_byte_array()
+        {
+            PackedByteArray byte_array;
+            byte_array.resize(sizeof(RenderParameters));
+            std::memcpy(byte_array.ptrw(), this, sizeof(RenderParameters));
+            return byte_array;
+        }
+    };
+
+  public:
+    SVGFDenoiser();
+    ~SVGFDenoiser() override;
+
+    void init(const PostProcessContext &context) override;
+
+    void render(const PostProcessFrame &frame) override;
+    const char *get_name() const override
+    {
+        return "svgf";
+    }
+
+    void set_iterations(int value);
+
+  private:
+    ComputeShader *temporal_cs = nullptr;
+    ComputeShader *atrous_cs = nullptr;
+
+    RenderParameters render_parameters;
+    Vector2i workgroup_size;
+    Projection previous_vp;
+
+    // BUFFER IDs
+    RID render_parameters_rid;
+    RID history_color_rid;
+    RID history_moments_rid;
+    RID current_moments_rid;
+    RID filter_ping_rid;
+    RID filter_pong_rid;
+    RID previous_gbuffer_rid;
+};
+
+#endif // SVGF_DENOISER_H
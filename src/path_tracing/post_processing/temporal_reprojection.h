@@ -2,25 +2,25 @@
 #define TEMPORAL_REPROJECTION_H
 
 #include "gdcs/include/gdcs.h"
-#include <godot_cpp/classes/image.hpp>
-#include <godot_cpp/classes/image_texture.hpp>
-#include <godot_cpp/variant/transform3d.hpp>
-#include <godot_cpp/variant/projection.hpp>
+#include "post_process_stage.h"
+#include "shader_cache.h"
 
 using namespace godot;
 
-class TemporalReprojection
+// Blends the frame with the history reprojected along the motion vectors of main.glsl (MOTION_VECTORS), which
+// cover camera and instance motion.
+class TemporalReprojection : public PostProcessStage
 {
 
     struct RenderParameters // match the struct on the gpu
     {
-        float deltaMatrix[16];
         int width;
         int height;
         unsigned int frame_count;
         float blendFactor = 0.75f;
         float nearPlane = 0.01f;
         float farPlane = 1000.0f;
+        unsigned int pass = 0;
 
         PackedByteArray to_packed_byte_array()
         {
@@ -33,28 +33,26 @@ class TemporalReprojection
 
   public:
     TemporalReprojection();
-    ~TemporalReprojection();
+    ~TemporalReprojection() override;
 
-    void init(RenderingDevice *rd, const RID original_screen_texture_rid, const RID original_depth_texture_rid,
-              const Vector2i size);
+    void init(const PostProcessContext &context) override;
 
-    void render(Transform3D view_matrix, Projection projection_matrix);
+    void render(const PostProcessFrame &frame) override;
+    const char *get_name() const override
+    {
+        return "temporal";
+    }
 
   private:
     ComputeShader *cs = nullptr;
-    Ref<Image> frame_buffer_image_1;
-    Ref<ImageTexture> frame_buffer_texture_1;
-    Ref<Image> frame_buffer_image_2;
-    Ref<ImageTexture> frame_buffer_texture_2;
 
     RenderParameters render_parameters;
-
-    Projection previous_vp;
+    Vector2i workgroup_size;
 
     // BUFFER IDs
     RID render_parameters_rid;
     RID screen_texture_rid;
-    RID depth_texture_rid;
+    RID motion_vectors_rid;
     RID frame_buffer_rid_1;
     RID frame_buffer_rid_2;
 };
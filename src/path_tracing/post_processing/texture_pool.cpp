@@ -0,0 +1,72 @@
+#include "texture_pool.h"
+#include <godot_cpp/variant/utility_functions.hpp>
+
+TexturePool::~TexturePool()
+{
+    clear();
+}
+
+void TexturePool::init(RenderingDevice *rd, const Vector2i size)
+{
+    this->rd = rd;
+    this->size = size;
+}
+
+void TexturePool::clear()
+{
+    for (auto &entry : textures)
+    {
+        if (entry.second.owned && rd != nullptr && entry.second.rid.is_valid())
+            rd->free_rid(entry.second.rid);
+    }
+    textures.clear();
+}
+
+RID TexturePool::get(const String &name, RenderingDevice::DataFormat format)
+{
+    auto it = textures.find(name);
+    if (it != textures.end())
+    {
+        if (it->second.owned && it->second.format != format)
+            UtilityFunctions::printerr("Pooled texture ", name, " is requested with a different format.");
+        return it->second.rid;
+    }
+    if (rd == nullptr)
+        return RID();
+
+    Ref<RDTextureFormat> texture_format;
+    texture_format.instantiate();
+    texture_format->set_width(size.x);
+    texture_format->set_height(size.y);
+    texture_format->set_format(format);
+    texture_format->set_usage_bits(RenderingDevice::TEXTURE_USAGE_STORAGE_BIT | RenderingDevice::TEXTURE_USAGE_SAMPLING_BIT |
+                                   RenderingDevice::TEXTURE_USAGE_CAN_COPY_FROM_BIT | RenderingDevice::TEXTURE_USAGE_CAN_COPY_TO_BIT);
+    Ref<RDTextureView> texture_view;
+    texture_view.instantiate();
+
+    RID rid = rd->texture_create(texture_format, texture_view);
+    if (rid.is_valid())
+        rd->texture_clear(rid, Color(0.0f, 0.0f, 0.0f, 0.0f), 0, 1, 0, 1); // histories start empty
+    textures[name] = {rid, format, true};
+    return rid;
+}
+
+RID TexturePool::get_transient(int slot, RenderingDevice::DataFormat format)
+{
+    return get("transient_" + String::num_int64(format) + "_" + String::num_int64(slot), format);
+}
+
+void TexturePool::add_external(const String &name, const RID rid)
+{
+    textures[name] = {rid, RenderingDevice::DATA_FORMAT_MAX, false};
+}
+
+bool TexturePool::has(const String &name) const
+{
+    return textures.find(name) != textures.end();
+}
+
+Vector2i TexturePool::get_size() const
+{
+    return size;
+}
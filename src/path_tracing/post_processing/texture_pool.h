@@ -0,0 +1,50 @@
+#ifndef TEXTURE_POOL_H
+#define TEXTURE_POOL_H
+
+#include <godot_cpp/classes/rd_texture_format.hpp>
+#include <godot_cpp/classes/rd_texture_view.hpp>
+#include <godot_cpp/classes/rendering_device.hpp>
+#include <godot_cpp/variant/string.hpp>
+#include <map>
+
+using namespace godot;
+
+// Screen sized textures of the post processing chain. They only live on the gpu: no Image is allocated for them.
+// Textures are looked up by name, such that stages share intermediate results (e.g. the accumulated color) and
+// scratch textures whose content does not survive a stage (see get_transient).
+class TexturePool
+{
+  public:
+    ~TexturePool();
+
+    // textures created before are kept, clear the pool when the size changes
+    void init(RenderingDevice *rd, const Vector2i size);
+    // frees the textures owned by the pool and forgets the external ones
+    void clear();
+
+    // the texture with this name, created cleared to zero on first use. Asking for an existing name with a
+    // different format is an error.
+    RID get(const String &name, RenderingDevice::DataFormat format);
+    // scratch texture, stages may overwrite each other's transient textures
+    RID get_transient(int slot, RenderingDevice::DataFormat format);
+
+    // textures owned elsewhere, such as the output of the path tracer
+    void add_external(const String &name, const RID rid);
+    bool has(const String &name) const;
+
+    Vector2i get_size() const;
+
+  private:
+    struct Texture
+    {
+        RID rid;
+        RenderingDevice::DataFormat format;
+        bool owned;
+    };
+
+    RenderingDevice *rd = nullptr;
+    Vector2i size;
+    std::map<String, Texture> textures;
+};
+
+#endif // TEXTURE_POOL_H
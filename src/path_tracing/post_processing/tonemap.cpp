@@ -0,0 +1,74 @@
+#include "tonemap.h"
+#include <algorithm>
+#include <cmath>
+#include <godot_cpp/classes/time.hpp>
+
+Tonemap::Tonemap()
+{
+}
+
+Tonemap::~Tonemap()
+{
+    if (cs != nullptr)
+        delete cs;
+}
+
+void Tonemap::init(const PostProcessContext &context)
+{
+    TexturePool *pool = context.pool;
+    workgroup_size = context.workgroup_size;
+    { // setup parameters
+        render_parameters.width = context.size.x;
+        render_parameters.height = context.size.y;
+    }
+
+    cs = ShaderCache::create(context.rd, "res://addons/jar_path_tracing/src/shaders/tonemap.glsl",
+                             ShaderCache::workgroup_defines(workgroup_size));
+    //--------- GENERAL BUFFERS ---------
+    { // input general buffer
+        render_parameters_rid = cs->create_storage_buffer_uniform(render_parameters.to_packed_byte_array(), 0, 0);
+
+        // bins and the adapted luminance, zero initialised
+        PackedByteArray histogram;
+        histogram.resize((HISTOGRAM_BINS + 1) * sizeof(uint32_t));
+        histogram.fill(0);
+        histogram_rid = cs->create_storage_buffer_uniform(histogram, 1, 0);
+    }
+
+    { // float input and the display output
+        cs->add_existing_buffer(pool->get(PostProcessInput::SCREEN, RenderingDevice::DATA_FORMAT_R32G32B32A32_SFLOAT),
+                                RenderingDevice::UNIFORM_TYPE_IMAGE, 2, 0);
+        cs->add_existing_buffer(pool->get(PostProcessOutput::DISPLAY, RenderingDevice::DATA_FORMAT_R8G8B8A8_UNORM),
+                                RenderingDevice::UNIFORM_TYPE_IMAGE, 3, 0);
+    }
+
+    cs->finish_create_uniforms();
+}
+
+void Tonemap::render(const PostProcessFrame &frame)
+{
+    if (cs == nullptr || !cs->check_ready())
+        return;
+
+    // frame rate independent adaptation
+    const uint64_t ticks = Time::get_singleton()->get_ticks_usec();
+    const float delta = previous_ticks > 0 ? (ticks - previous_ticks) / 1000000.0f : 0.0f;
+    previous_ticks = ticks;
+    render_parameters.adaptation = 1.0f - std::exp(-delta * adaptation_speed);
+
+    const Vector3i groups = get_dispatch_size({render_parameters.width, render_parameters.height}, workgroup_size);
+    const Vector3i single_group(1, 1, 1);
+    for (unsigned int pass = 0; pass < 3; pass++)
+    {
+        render_parameters.pass = pass;
+        cs->update_storage_buffer_uniform(render_parameters_rid, render_parameters.to_packed_byte_array());
+        cs->compute(pass == 1 ? single_group : groups);
+    }
+}
+
+void Tonemap::set_exposure(bool auto_exposure, float exposure_compensation, float adaptation_speed)
+{
+    render_parameters.auto_exposure = auto_exposure ? 1 : 0;
+    render_parameters.exposure_compensation = exposure_compensation;
+    this->adaptation_speed = std::max(0.0f, adaptation_speed);
+}
@@ -0,0 +1,64 @@
+#ifndef TONEMAP_H
+#define TONEMAP_H
+
+#include "gdcs/include/gdcs.h"
+#include "post_process_stage.h"
+#include "shader_cache.h"
+
+using namespace godot;
+
+// Last stage of the chain: histogram based auto exposure and ACES tonemapping of the float screen texture into the
+// rgba8 display texture. The histogram and the adapted luminance stay on the gpu.
+class Tonemap : public PostProcessStage
+{
+    struct RenderParameters // match the struct on the gpu
+    {
+        int width;
+        int height;
+        unsigned int pass = 0;
+        unsigned int auto_exposure = 1;
+        float min_log_luminance = -10.0f;
+        float log_luminance_range = 22.0f;
+        float adaptation = 1.0f;
+        float exposure_compensation = 0.0f;
+
+        PackedByteArray to_packed_byte_array()
+        {
+            PackedByteArray byte_array;
+            byte_array.resize(sizeof(RenderParameters));
+            std::memcpy(byte_array.ptrw(), this, sizeof(RenderParameters));
+            return byte_array;
+        }
+    };
+
+    static const int HISTOGRAM_BINS = 256;
+
+  public:
+    Tonemap();
+    ~Tonemap() override;
+
+    void init(const PostProcessContext &context) override;
+
+    void render(const PostProcessFrame &frame) override;
+    const char *get_name() const override
+    {
+        return "tonemap";
+    }
+
+    // exposure_compensation in stops, adaptation_speed is the inverse time constant in 1/s
+    void set_exposure(bool auto_exposure, float exposure_compensation, float adaptation_speed);
+
+  private:
+    ComputeShader *cs = nullptr;
+
+    RenderParameters render_parameters;
+    Vector2i workgroup_size;
+    float adaptation_speed = 2.0f;
+    uint64_t previous_ticks = 0;
+
+    // BUFFER IDs
+    RID render_parameters_rid;
+    RID histogram_rid;
+};
+
+#endif // TONEMAP_H
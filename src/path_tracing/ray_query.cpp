@@ -0,0 +1,400 @@
+#include "ray_query.h"
+#include "parallel_for.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define RAY_QUERY_SSE
+#endif
+
+namespace
+{
+// one value per ray of a packet, SSE registers where available and plain loops otherwise
+#ifdef RAY_QUERY_SSE
+struct float4
+{
+    __m128 v;
+    float4() = default;
+    float4(__m128 v) : v(v)
+    {
+    }
+    explicit float4(float s) : v(_mm_set1_ps(s))
+    {
+    }
+    explicit float4(const float *lanes) : v(_mm_loadu_ps(lanes))
+    {
+    }
+    void store(float *lanes) const
+    {
+        _mm_storeu_ps(lanes, v);
+    }
+};
+
+struct mask4
+{
+    __m128 v;
+};
+
+inline float4 operator+(float4 a, float4 b) { return _mm_add_ps(a.v, b.v); }
+inline float4 operator-(float4 a, float4 b) { return _mm_sub_ps(a.v, b.v); }
+inline float4 operator*(float4 a, float4 b) { return _mm_mul_ps(a.v, b.v); }
+inline float4 operator/(float4 a, float4 b) { return _mm_div_ps(a.v, b.v); }
+inline float4 min(float4 a, float4 b) { return _mm_min_ps(a.v, b.v); }
+inline float4 max(float4 a, float4 b) { return _mm_max_ps(a.v, b.v); }
+inline float4 abs(float4 a) { return _mm_andnot_ps(_mm_set1_ps(-0.0f), a.v); }
+inline mask4 operator<(float4 a, float4 b) { return {_mm_cmplt_ps(a.v, b.v)}; }
+inline mask4 operator<=(float4 a, float4 b) { return {_mm_cmple_ps(a.v, b.v)}; }
+inline mask4 operator>(float4 a, float4 b) { return {_mm_cmpgt_ps(a.v, b.v)}; }
+inline mask4 operator>=(float4 a, float4 b) { return {_mm_cmpge_ps(a.v, b.v)}; }
+inline mask4 operator&(mask4 a, mask4 b) { return {_mm_and_ps(a.v, b.v)}; }
+inline int bits(mask4 m) { return _mm_movemask_ps(m.v); }
+inline float4 select(mask4 m, float4 a, float4 b) { return _mm_or_ps(_mm_and_ps(m.v, a.v), _mm_andnot_ps(m.v, b.v)); }
+#else
+struct float4
+{
+    float v[4];
+    float4() = default;
+    explicit float4(float s) : v{s, s, s, s}
+    {
+    }
+    explicit float4(const float *lanes) : v{lanes[0], lanes[1], lanes[2], lanes[3]}
+    {
+    }
+    void store(float *lanes) const
+    {
+        std::copy(v, v + 4, lanes);
+    }
+};
+
+struct mask4
+{
+    int bits;
+};
+
+#define LANES(expr)                                                                                                    \
+    float4 r;                                                                                                          \
+    for (int i = 0; i < 4; i++)                                                                                        \
+        r.v[i] = expr;                                                                                                 \
+    return r;
+#define LANE_MASK(expr)                                                                                                \
+    mask4 r = {0};                                                                                                     \
+    for (int i = 0; i < 4; i++)                                                                                        \
+        r.bits |= (expr) ? 1 << i : 0;                                                                                 \
+    return r;
+
+inline float4 operator+(float4 a, float4 b) { LANES(a.v[i] + b.v[i]) }
+inline float4 operator-(float4 a, float4 b) { LANES(a.v[i] - b.v[i]) }
+inline float4 operator*(float4 a, float4 b) { LANES(a.v[i] * b.v[i]) }
+inline float4 operator/(float4 a, float4 b) { LANES(a.v[i] / b.v[i]) }
+inline float4 min(float4 a, float4 b) { LANES(a.v[i] < b.v[i] ? a.v[i] : b.v[i]) }
+inline float4 max(float4 a, float4 b) { LANES(a.v[i] > b.v[i] ? a.v[i] : b.v[i]) }
+inline float4 abs(float4 a) { LANES(std::fabs(a.v[i])) }
+inline mask4 operator<(float4 a, float4 b) { LANE_MASK(a.v[i] < b.v[i]) }
+inline mask4 operator<=(float4 a, float4 b) { LANE_MASK(a.v[i] <= b.v[i]) }
+inline mask4 operator>(float4 a, float4 b) { LANE_MASK(a.v[i] > b.v[i]) }
+inline mask4 operator>=(float4 a, float4 b) { LANE_MASK(a.v[i] >= b.v[i]) }
+inline mask4 operator&(mask4 a, mask4 b) { return {a.bits & b.bits}; }
+inline int bits(mask4 m) { return m.bits; }
+inline float4 select(mask4 m, float4 a, float4 b) { LANES(m.bits & (1 << i) ? a.v[i] : b.v[i]) }
+
+#undef LANES
+#undef LANE_MASK
+#endif
+
+struct Rays // a packet of four rays, structure of arrays
+{
+    float4 o[3];
+    float4 d[3];
+    float4 rd[3];
+};
+
+struct Hits
+{
+    float4 t; // closest hit so far, starts at the maximum distance
+    float4 min_t; // nearer hits are ignored, such that a query may start on a surface
+    float4 u;
+    float4 v;
+    unsigned int instance[4];
+    unsigned int triangle[4];
+    int active; // lanes still traced, any hit queries retire a lane at its first hit
+};
+
+inline float4 dot(const float4 a[3], const float4 b[3])
+{
+    return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+}
+
+inline void cross(const float4 a[3], const float4 b[3], float4 result[3])
+{
+    result[0] = a[1] * b[2] - a[2] * b[1];
+    result[1] = a[2] * b[0] - a[0] * b[2];
+    result[2] = a[0] * b[1] - a[1] * b[0];
+}
+
+// lanes that enter the box before their closest hit, nearest is the smallest entry distance among them
+int intersect_aabb(const Rays &rays, const Hits &hits, const vec3 &bmin, const vec3 &bmax, float &nearest)
+{
+    float4 tmin(-INFINITY);
+    float4 tmax(INFINITY);
+    for (int axis = 0; axis < 3; axis++)
+    {
+        float4 t1 = (float4(bmin[axis]) - rays.o[axis]) * rays.rd[axis];
+        float4 t2 = (float4(bmax[axis]) - rays.o[axis]) * rays.rd[axis];
+        tmin = max(tmin, min(t1, t2));
+        tmax = min(tmax, max(t1, t2));
+    }
+    const int lanes = bits((tmax >= tmin) & (tmax > float4(0.0f)) & (tmin < hits.t)) & hits.active;
+    nearest = INFINITY;
+    float entry[4];
+    tmin.store(entry);
+    for (int i = 0; i < 4; i++)
+    {
+        if (lanes & (1 << i))
+            nearest = std::min(nearest, entry[i]);
+    }
+    return lanes;
+}
+
+// Moller-Trumbore like intersectTriangle in main.glsl, one triangle against the whole packet
+template <bool any_hit>
+void intersect_triangle(const Rays &rays, Hits &hits, const GpuTriangleGeometry &tri, const unsigned int index,
+                        const unsigned int instance)
+{
+    const float4 v0[3] = {float4(tri.v0.x), float4(tri.v0.y), float4(tri.v0.z)};
+    const float4 edge1[3] = {float4(tri.edge1.x), float4(tri.edge1.y), float4(tri.edge1.z)};
+    const float4 edge2[3] = {float4(tri.edge2.x), float4(tri.edge2.y), float4(tri.edge2.z)};
+
+    float4 pvec[3];
+    cross(rays.d, edge2, pvec);
+    const float4 det = dot(edge1, pvec);
+    const float4 inv_det = float4(1.0f) / det;
+    const float4 tvec[3] = {rays.o[0] - v0[0], rays.o[1] - v0[1], rays.o[2] - v0[2]};
+    const float4 u = dot(tvec, pvec) * inv_det;
+    float4 qvec[3];
+    cross(tvec, edge1, qvec);
+    const float4 v = dot(rays.d, qvec) * inv_det;
+    const float4 t = dot(edge2, qvec) * inv_det;
+
+    const float4 zero(0.0f);
+    const float4 one(1.0f);
+    const mask4 hit = (abs(det) >= float4(1e-5f)) & (u >= zero) & (u <= one) & (v >= zero) & (u + v <= one) &
+                      (t > hits.min_t) & (t < hits.t);
+    const int lanes = bits(hit) & hits.active;
+    if (lanes == 0)
+        return;
+
+    // lanes outside of active hold padding or retired rays, their results are never read
+    hits.t = select(hit, t, hits.t);
+    hits.u = select(hit, u, hits.u);
+    hits.v = select(hit, v, hits.v);
+    for (int i = 0; i < 4; i++)
+    {
+        if (lanes & (1 << i))
+        {
+            hits.instance[i] = instance;
+            hits.triangle[i] = index;
+        }
+    }
+    if (any_hit)
+        hits.active &= ~lanes;
+}
+
+// traversal stacks grow with the tree instead of dropping children past a fixed depth, and are kept per thread such
+// that a query does not allocate once they reached the depth of the scene
+thread_local std::vector<unsigned int> blas_stack;
+thread_local std::vector<unsigned int> tlas_stack;
+
+template <bool any_hit>
+void trace_blas(const std::vector<BVHNode> &nodes, const std::vector<GpuTriangleGeometry> &triangles,
+                const unsigned int root, const unsigned int instance, const Rays &rays, Hits &hits)
+{
+    std::vector<unsigned int> &stack = blas_stack;
+    stack.clear();
+    stack.push_back(root);
+
+    while (!stack.empty() && hits.active != 0)
+    {
+        const BVHNode &node = nodes[stack.back()];
+        stack.pop_back();
+        if (node.tri_count > 0)
+        {
+            for (unsigned int i = 0; i < node.tri_count; i++)
+            {
+                const unsigned int index = node.first_tri_index + i;
+                intersect_triangle<any_hit>(rays, hits, triangles[index], index, instance);
+            }
+            continue;
+        }
+        const BVHNode &left = nodes[node.left_child];
+        const BVHNode &right = nodes[node.right_child];
+        float near_left, near_right;
+        const bool left_valid = intersect_aabb(rays, hits, left.aabbMin, left.aabbMax, near_left) != 0;
+        const bool right_valid = intersect_aabb(rays, hits, right.aabbMin, right.aabbMax, near_right) != 0;
+
+        // the nearer child is popped first
+        if (near_left < near_right)
+        {
+            if (right_valid) stack.push_back(node.right_child);
+            if (left_valid) stack.push_back(node.left_child);
+        }
+        else
+        {
+            if (left_valid) stack.push_back(node.left_child);
+            if (right_valid) stack.push_back(node.right_child);
+        }
+    }
+}
+
+template <bool any_hit>
+void trace_tlas(const std::vector<TLASNode> &tlas_nodes, const std::vector<BLASInstance> &blas_instances,
+                const std::vector<BVHNode> &bvh_nodes, const std::vector<GpuTriangleGeometry> &triangles,
+                const Rays &rays, Hits &hits)
+{
+    std::vector<unsigned int> &stack = tlas_stack;
+    stack.clear();
+    stack.push_back(0);
+
+    while (!stack.empty() && hits.active != 0)
+    {
+        const TLASNode &node = tlas_nodes[stack.back()];
+        stack.pop_back();
+        if (node.leftRight == 0)
+        { // leaf, continue in the space of the instance
+            const BLASInstance &instance = blas_instances[node.blas];
+            const float *m = instance.inverse_transform; // column major
+            Rays local;
+            for (int r = 0; r < 3; r++)
+            {
+                local.o[r] = float4(m[r]) * rays.o[0] + float4(m[4 + r]) * rays.o[1] + float4(m[8 + r]) * rays.o[2] +
+                             float4(m[12 + r]);
+                local.d[r] = float4(m[r]) * rays.d[0] + float4(m[4 + r]) * rays.d[1] + float4(m[8 + r]) * rays.d[2];
+                local.rd[r] = float4(1.0f) / local.d[r];
+            }
+            trace_blas<any_hit>(bvh_nodes, triangles, instance.blas_index, node.blas, local, hits);
+            continue;
+        }
+        const unsigned int left = node.leftRight & 0xFFFF;
+        const unsigned int right = node.leftRight >> 16;
+        float near_left, near_right;
+        const bool left_valid = intersect_aabb(rays, hits, tlas_nodes[left].aabbMin, tlas_nodes[left].aabbMax, near_left) != 0;
+        const bool right_valid = intersect_aabb(rays, hits, tlas_nodes[right].aabbMin, tlas_nodes[right].aabbMax, near_right) != 0;
+
+        if (near_left < near_right)
+        {
+            if (right_valid) stack.push_back(right);
+            if (left_valid) stack.push_back(left);
+        }
+        else
+        {
+            if (left_valid) stack.push_back(left);
+            if (right_valid) stack.push_back(right);
+        }
+    }
+}
+
+} // namespace
+
+RayQuery::RayQuery(const std::vector<TLASNode> &tlas_nodes, const std::vector<BLASInstance> &blas_instances,
+                   const std::vector<BVHNode> &bvh_nodes, const std::vector<GpuTriangleGeometry> &triangles)
+    : tlas_nodes(tlas_nodes), blas_instances(blas_instances), bvh_nodes(bvh_nodes), triangles(triangles)
+{
+}
+
+template <bool any_hit>
+void RayQuery::trace_packet(const vec3 *origins, const vec3 *directions, int active, float min_t, float max_t,
+                            RayHit *hits) const
+{
+    const RayHit miss = {INFINITY, UINT32_MAX, UINT32_MAX, 0.0f, 0.0f};
+    if (active == 0 || tlas_nodes.empty() || blas_instances.empty())
+    {
+        std::fill(hits, hits + 4, miss);
+        return;
+    }
+
+    // inactive lanes repeat an active ray, such that they cost no extra nodes
+    int source = 0;
+    while (!(active & (1 << source)))
+        source++;
+    float o[3][4], d[3][4];
+    for (int i = 0; i < 4; i++)
+    {
+        const int ray = active & (1 << i) ? i : source;
+        for (int axis = 0; axis < 3; axis++)
+        {
+            o[axis][i] = origins[ray][axis];
+            d[axis][i] = directions[ray][axis];
+        }
+    }
+    Rays rays;
+    for (int axis = 0; axis < 3; axis++)
+    {
+        rays.o[axis] = float4(o[axis]);
+        rays.d[axis] = float4(d[axis]);
+        rays.rd[axis] = float4(1.0f) / rays.d[axis];
+    }
+    Hits packet_hits;
+    packet_hits.t = float4(max_t);
+    packet_hits.min_t = float4(min_t);
+    packet_hits.u = float4(0.0f);
+    packet_hits.v = float4(0.0f);
+    std::fill(packet_hits.instance, packet_hits.instance + 4, UINT32_MAX);
+    std::fill(packet_hits.triangle, packet_hits.triangle + 4, UINT32_MAX);
+    packet_hits.active = active & 15;
+
+    trace_tlas<any_hit>(tlas_nodes, blas_instances, bvh_nodes, triangles, rays, packet_hits);
+
+    float t[4], u[4], v[4];
+    packet_hits.t.store(t);
+    packet_hits.u.store(u);
+    packet_hits.v.store(v);
+    for (int i = 0; i < 4; i++)
+    {
+        hits[i] = packet_hits.instance[i] == UINT32_MAX || !(active & (1 << i))
+                      ? miss
+                      : RayHit{t[i], packet_hits.instance[i], packet_hits.triangle[i], u[i], v[i]};
+    }
+}
+
+template <bool any_hit>
+void RayQuery::trace(const vec3 *origins, const vec3 *directions, int count, float min_t, float max_t,
+                     RayHit *hits) const
+{
+    parallel_for((count + 3) / 4, 16, [&](const int packet) {
+        const int first = packet * 4;
+        const int lanes = std::min(4, count - first);
+        vec3 packet_origins[4], packet_directions[4];
+        std::copy(origins + first, origins + first + lanes, packet_origins);
+        std::copy(directions + first, directions + first + lanes, packet_directions);
+        RayHit packet_hits[4];
+        trace_packet<any_hit>(packet_origins, packet_directions, (1 << lanes) - 1, min_t, max_t, packet_hits);
+        std::copy(packet_hits, packet_hits + lanes, hits + first);
+    });
+}
+
+void RayQuery::intersect(const vec3 *origins, const vec3 *directions, int count, float max_t,
+                         RayHit *hits) const
+{
+    trace<false>(origins, directions, count, 0.0f, max_t, hits);
+}
+
+void RayQuery::intersect_packet(const vec3 origins[4], const vec3 directions[4], int active, float max_t,
+                                RayHit hits[4]) const
+{
+    trace_packet<false>(origins, directions, active, 0.0f, max_t, hits);
+}
+
+void RayQuery::occluded(const vec3 *from, const vec3 *to, int count, uint8_t *results) const
+{
+    std::vector<vec3> directions(count);
+    for (int i = 0; i < count; i++)
+        directions[i] = to[i] - from[i];
+    std::vector<RayHit> hits(count);
+    // the segment spans t in [0, 1], surfaces at either end point are not in the way, such that line of sight
+    // between points on walls or floors does not hit the walls themselves
+    const float epsilon = 1e-4f;
+    trace<true>(from, directions.data(), count, epsilon, 1.0f - epsilon, hits.data());
+    for (int i = 0; i < count; i++)
+        results[i] = hits[i].t < INFINITY ? 1 : 0;
+}
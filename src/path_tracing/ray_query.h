@@ -0,0 +1,53 @@
+#ifndef RAY_QUERY_H
+#define RAY_QUERY_H
+
+#include "bvh/bvh.h"
+#include <cstdint>
+#include <vector>
+
+using namespace BVH;
+
+// closest hit of a ray, t is INFINITY on a miss
+struct RayHit
+{
+    float t;
+    unsigned int instance; // blas instance
+    unsigned int triangle; // index into the triangle buffers, in leaf order
+    float u, v;            // barycentrics of vertex 1 and 2
+};
+
+// Answers ray queries on the cpu against the scene buffers of a GeometryGroup3D, with the same TLAS over BLAS
+// traversal as main.glsl. Rays are traced in packets of four with SSE where available and batches are spread over
+// the hardware threads. The buffers are only referenced, a query sees the scene as of the last build or
+// update_transforms. Like the builder, queries do not depend on the engine.
+class RayQuery
+{
+  public:
+    RayQuery(const std::vector<TLASNode> &tlas_nodes, const std::vector<BLASInstance> &blas_instances,
+             const std::vector<BVHNode> &bvh_nodes, const std::vector<GpuTriangleGeometry> &triangles);
+
+    // closest hits of count rays up to max_t, in units of the direction
+    void intersect(const vec3 *origins, const vec3 *directions, int count, float max_t, RayHit *hits) const;
+
+    // up to four rays traced together on the calling thread, lanes not set in the active bits miss
+    void intersect_packet(const vec3 origins[4], const vec3 directions[4], int active, float max_t,
+                          RayHit hits[4]) const;
+
+    // whether anything lies strictly between from and to, surfaces within 1e-4 of the segment length of either end
+    // point do not count
+    void occluded(const vec3 *from, const vec3 *to, int count, uint8_t *results) const;
+
+  private:
+    // hits are accepted for min_t < t < max_t
+    template <bool any_hit> void trace_packet(const vec3 *origins, const vec3 *directions, int active, float min_t,
+                                              float max_t, RayHit *hits) const;
+    template <bool any_hit> void trace(const vec3 *origins, const vec3 *directions, int count, float min_t,
+                                       float max_t, RayHit *hits) const;
+
+    const std::vector<TLASNode> &tlas_nodes;
+    const std::vector<BLASInstance> &blas_instances;
+    const std::vector<BVHNode> &bvh_nodes;
+    const std::vector<GpuTriangleGeometry> &triangles;
+};
+
+#endif // RAY_QUERY_H
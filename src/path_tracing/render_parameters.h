@@ -13,12 +13,17 @@ using namespace godot;
 
 struct Camera
 {
-    float vp[16];
-    float ivp[16];
+    float vp[16] = {};
+    float ivp[16] = {};
     BVH::vec4 position;
     unsigned int frame_index;
     float near = 0.01f;
     float far = 1000.0f;
+    unsigned int use_sample_mask = 0; // skip converged pixels, see ProgressiveRendering
+    float previous_vp[16] = {}; // view projection of the previous dispatch, for ReSTIR temporal reuse, see end_dispatch
+    float jitter[2] = {0.5f, 0.5f}; // subpixel position of the primary rays in hybrid mode, see VisibilityBuffer
+    unsigned int primary_cache_generation = 0; // see ProgressiveRendering::get_generation, 0 disables the cache
+    unsigned int sample_frame = 0; // frames since the accumulation restarted, indexes the low-discrepancy sequences
 
     void set_camera_transform(const Transform3D &model, const Projection &projection)
     {
@@ -37,6 +42,13 @@ struct Camera
         Utils::projection_to_float(ivp, t.inverse());
     }
 
+    // the view of a dispatch becomes the previous view once it is rendered. Transform updates without a dispatch,
+    // e.g. while tuning, leave the history alone.
+    void end_dispatch()
+    {
+        std::memcpy(previous_vp, vp, sizeof(vp));
+    }
+
     PackedByteArray to_packed_byte_array()
     {
         PackedByteArray byte_array;
@@ -56,9 +68,22 @@ struct GpuMaterial
     float padding[5];
 };
 
-struct GpuTriangleGeometry
+// emissive triangle of a blas instance, with its entry of the alias table over emitter power
+struct GpuEmitter
+{
+    unsigned int blas;
+    unsigned int triangle;
+    float probability;
+    unsigned int alias;
+    float threshold;
+    float padding[3];
+};
+
+struct GpuEmittersHeader
 {
-    BVH::vec4 vertices[3];
+    unsigned int count;
+    float power;
+    unsigned int padding[2];
 };
 
 struct GpuTriangleData
@@ -0,0 +1,112 @@
+#include "shader_cache.h"
+
+const char *ShaderCache::CACHE_DIRECTORY = "user://shader_cache";
+
+String ShaderCache::load_source(const String &path, int depth)
+{
+    if (depth > 8)
+    {
+        UtilityFunctions::printerr("Shader includes nested too deep: ", path);
+        return String();
+    }
+    if (!FileAccess::file_exists(path))
+    {
+        UtilityFunctions::printerr("Shader source not found: ", path);
+        return String();
+    }
+
+    // resolve includes relative to the including file, the way the glsl importer does
+    PackedStringArray lines = FileAccess::get_file_as_string(path).split("\n");
+    String result;
+    for (int i = 0; i < lines.size(); i++)
+    {
+        String line = lines[i].strip_edges();
+        if (line.begins_with("#["))
+            continue; // stage markers are for the importer only
+        if (line.begins_with("#include"))
+        {
+            String include = line.get_slice("\"", 1);
+            result += load_source(path.get_base_dir().path_join(include), depth + 1) + "\n";
+            continue;
+        }
+        result += lines[i] + "\n";
+    }
+    return result;
+}
+
+String ShaderCache::insert_defines(const String &source, const std::vector<String> &defines)
+{
+    // defines have to follow the #version directive
+    int version_end = source.find("\n", source.find("#version")) + 1;
+    String define_block;
+    for (const String &define : defines)
+        define_block += define + "\n";
+    return source.substr(0, version_end) + define_block + source.substr(version_end);
+}
+
+String ShaderCache::get_variant(RenderingDevice *rd, const String &shader_path, const std::vector<String> &defines)
+{
+    String source = load_source(shader_path);
+    if (source.is_empty())
+        return shader_path;
+    source = insert_defines(source, defines);
+
+    String variant_path = String(CACHE_DIRECTORY).path_join(shader_path.get_file().get_basename() + "_" +
+                                                            source.md5_text() + ".res");
+    if (FileAccess::file_exists(variant_path))
+        return variant_path;
+
+    Ref<RDShaderSource> shader_source;
+    shader_source.instantiate();
+    shader_source->set_language(RenderingDevice::SHADER_LANGUAGE_GLSL);
+    shader_source->set_stage_source(RenderingDevice::SHADER_STAGE_COMPUTE, source);
+
+    Ref<RDShaderSPIRV> spirv = rd->shader_compile_spirv_from_source(shader_source);
+    if (spirv.is_null() || !spirv->get_stage_compile_error(RenderingDevice::SHADER_STAGE_COMPUTE).is_empty())
+    {
+        UtilityFunctions::printerr("Failed to compile shader variant of ", shader_path, ":\n",
+                                   spirv.is_valid() ? spirv->get_stage_compile_error(RenderingDevice::SHADER_STAGE_COMPUTE)
+                                                    : String());
+        return shader_path;
+    }
+
+    Ref<RDShaderFile> shader_file;
+    shader_file.instantiate();
+    shader_file->set_bytecode(spirv);
+
+    DirAccess::make_dir_recursive_absolute(CACHE_DIRECTORY);
+    if (ResourceSaver::get_singleton()->save(shader_file, variant_path) != OK)
+    {
+        UtilityFunctions::printerr("Failed to write shader cache: ", variant_path);
+        return shader_path;
+    }
+    return variant_path;
+}
+
+ComputeShader *ShaderCache::create(RenderingDevice *rd, const String &shader_path, const std::vector<String> &defines,
+                                   bool use_cache)
+{
+    if (use_cache)
+    {
+        String variant_path = get_variant(rd, shader_path, defines);
+        if (variant_path != shader_path)
+            return new ComputeShader(variant_path, rd);
+    }
+    return new ComputeShader(shader_path, rd, defines);
+}
+
+std::vector<String> ShaderCache::workgroup_defines(const Vector2i workgroup_size)
+{
+    return {"#define LOCAL_SIZE_X " + String::num_int64(workgroup_size.x),
+            "#define LOCAL_SIZE_Y " + String::num_int64(workgroup_size.y)};
+}
+
+void ShaderCache::clear()
+{
+    Ref<DirAccess> dir = DirAccess::open(CACHE_DIRECTORY);
+    if (dir.is_null())
+        return;
+    PackedStringArray files = dir->get_files();
+    for (int i = 0; i < files.size(); i++)
+        dir->remove(files[i]);
+}
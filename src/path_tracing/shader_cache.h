@@ -0,0 +1,45 @@
+#ifndef SHADER_CACHE_H
+#define SHADER_CACHE_H
+
+#include "gdcs/include/gdcs.h"
+#include <godot_cpp/classes/dir_access.hpp>
+#include <godot_cpp/classes/file_access.hpp>
+#include <godot_cpp/classes/rd_shader_file.hpp>
+#include <godot_cpp/classes/rd_shader_source.hpp>
+#include <godot_cpp/classes/rd_shader_spirv.hpp>
+#include <godot_cpp/classes/rendering_device.hpp>
+#include <godot_cpp/classes/resource_saver.hpp>
+#include <godot_cpp/variant/string.hpp>
+#include <godot_cpp/variant/utility_functions.hpp>
+#include <godot_cpp/variant/vector2i.hpp>
+#include <vector>
+
+using namespace godot;
+
+// Compiles variants of a glsl compute shader, where a variant is the shader source with a list of generated defines.
+// The SPIR-V of every variant is stored as an RDShaderFile in user://shader_cache, keyed by a hash of the
+// preprocessed source and the defines, such that switching modes and cold starts skip glsl compilation.
+class ShaderCache
+{
+  public:
+    // returns the path to an RDShaderFile holding the variant, or shader_path itself if compilation failed.
+    static String get_variant(RenderingDevice *rd, const String &shader_path, const std::vector<String> &defines);
+
+    // creates a compute shader for the variant, falling back to compiling through gdcs if the cache is unusable.
+    static ComputeShader *create(RenderingDevice *rd, const String &shader_path, const std::vector<String> &defines,
+                                 bool use_cache = true);
+
+    // defines selecting the workgroup shape of a shader
+    static std::vector<String> workgroup_defines(const Vector2i workgroup_size);
+
+    // removes all cached variants
+    static void clear();
+
+  private:
+    static const char *CACHE_DIRECTORY;
+
+    static String load_source(const String &path, int depth = 0);
+    static String insert_defines(const String &source, const std::vector<String> &defines);
+};
+
+#endif // SHADER_CACHE_H
@@ -0,0 +1,150 @@
+#include "visibility_buffer.h"
+#include <godot_cpp/variant/utility_functions.hpp>
+
+VisibilityBuffer::~VisibilityBuffer()
+{
+    clear();
+}
+
+bool VisibilityBuffer::init(RenderingDevice *rd, const Vector2i size, const RID triangles_geometry,
+                            const RID blas_instances, const std::vector<Vector2i> &instance_triangles)
+{
+    clear();
+    this->rd = rd;
+    this->size = size;
+    this->instance_triangles = instance_triangles;
+
+    { // shader, compiled by the glsl importer
+        const String shader_path = "res://addons/jar_path_tracing/src/shaders/visibility_buffer.glsl";
+        Ref<RDShaderFile> shader_file = ResourceLoader::get_singleton()->load(shader_path);
+        Ref<RDShaderSPIRV> spirv = shader_file.is_valid() ? shader_file->get_spirv() : Ref<RDShaderSPIRV>();
+        if (spirv.is_null() || !spirv->get_stage_compile_error(RenderingDevice::SHADER_STAGE_VERTEX).is_empty() ||
+            !spirv->get_stage_compile_error(RenderingDevice::SHADER_STAGE_FRAGMENT).is_empty())
+        {
+            UtilityFunctions::printerr("Failed to load the visibility buffer shader: ", shader_path);
+            return false;
+        }
+        shader = rd->shader_create_from_spirv(spirv);
+    }
+
+    { // visibility and depth attachments, main.glsl reads the visibility as a storage image
+        Ref<RDTextureFormat> visibility_format;
+        visibility_format.instantiate();
+        visibility_format->set_width(size.x);
+        visibility_format->set_height(size.y);
+        visibility_format->set_format(RenderingDevice::DATA_FORMAT_R32G32_UINT);
+        visibility_format->set_usage_bits(RenderingDevice::TEXTURE_USAGE_COLOR_ATTACHMENT_BIT |
+                                          RenderingDevice::TEXTURE_USAGE_STORAGE_BIT |
+                                          RenderingDevice::TEXTURE_USAGE_CAN_COPY_FROM_BIT);
+        visibility_texture = rd->texture_create(visibility_format, memnew(RDTextureView));
+
+        Ref<RDTextureFormat> depth_format;
+        depth_format.instantiate();
+        depth_format->set_width(size.x);
+        depth_format->set_height(size.y);
+        depth_format->set_format(RenderingDevice::DATA_FORMAT_D32_SFLOAT);
+        depth_format->set_usage_bits(RenderingDevice::TEXTURE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT);
+        depth_texture = rd->texture_create(depth_format, memnew(RDTextureView));
+
+        TypedArray<RID> attachments;
+        attachments.push_back(visibility_texture);
+        attachments.push_back(depth_texture);
+        framebuffer = rd->framebuffer_create(attachments);
+    }
+
+    { // pipeline, both faces are drawn since paths can hit either
+        Ref<RDPipelineRasterizationState> rasterization;
+        rasterization.instantiate();
+        rasterization->set_cull_mode(RenderingDevice::POLYGON_CULL_DISABLED);
+
+        Ref<RDPipelineDepthStencilState> depth_stencil;
+        depth_stencil.instantiate();
+        depth_stencil->set_enable_depth_test(true);
+        depth_stencil->set_enable_depth_write(true);
+        depth_stencil->set_depth_compare_operator(RenderingDevice::COMPARE_OP_LESS);
+
+        Ref<RDPipelineColorBlendState> blend;
+        blend.instantiate();
+        TypedArray<RDPipelineColorBlendStateAttachment> blend_attachments;
+        blend_attachments.push_back(memnew(RDPipelineColorBlendStateAttachment)); // no blending on integer targets
+        blend->set_attachments(blend_attachments);
+
+        Ref<RDPipelineMultisampleState> multisample;
+        multisample.instantiate();
+
+        pipeline = rd->render_pipeline_create(shader, rd->framebuffer_get_format(framebuffer),
+                                              RenderingDevice::INVALID_FORMAT_ID, RenderingDevice::RENDER_PRIMITIVE_TRIANGLES,
+                                              rasterization, multisample, depth_stencil, blend);
+    }
+
+    { // the scene buffers of main.glsl
+        TypedArray<RDUniform> uniforms;
+        const RID buffers[2] = {triangles_geometry, blas_instances};
+        for (int i = 0; i < 2; i++)
+        {
+            Ref<RDUniform> uniform;
+            uniform.instantiate();
+            uniform->set_uniform_type(RenderingDevice::UNIFORM_TYPE_STORAGE_BUFFER);
+            uniform->set_binding(i);
+            uniform->add_id(buffers[i]);
+            uniforms.push_back(uniform);
+        }
+        uniform_set = rd->uniform_set_create(uniforms, shader, 0);
+    }
+
+    if (!pipeline.is_valid() || !uniform_set.is_valid())
+    {
+        UtilityFunctions::printerr("Failed to create the visibility buffer pipeline.");
+        clear();
+        return false;
+    }
+    return true;
+}
+
+void VisibilityBuffer::clear()
+{
+    if (rd == nullptr)
+        return;
+    // dependents before the resources they were created from
+    RID *rids[6] = {&uniform_set, &pipeline, &framebuffer, &visibility_texture, &depth_texture, &shader};
+    for (RID *rid : rids)
+    {
+        if (rid->is_valid())
+            rd->free_rid(*rid);
+        *rid = RID();
+    }
+}
+
+void VisibilityBuffer::render(const float vp[16], const Vector2 jitter)
+{
+    if (!pipeline.is_valid())
+        return;
+
+    // the pixel centres of the raster land on pixel + jitter, where main.glsl shoots its primary rays
+    PushConstants constants;
+    std::memcpy(constants.vp, vp, sizeof(constants.vp));
+    constants.jitter[0] = -(jitter.x - 0.5f) * 2.0f / size.x;
+    constants.jitter[1] = (jitter.y - 0.5f) * 2.0f / size.y; // ndc y points up, pixel rows down
+
+    PackedColorArray clear_colors;
+    clear_colors.push_back(Color(0.0f, 0.0f, 0.0f, 0.0f));
+    const int64_t draw_list = rd->draw_list_begin(framebuffer, RenderingDevice::INITIAL_ACTION_CLEAR,
+                                                  RenderingDevice::FINAL_ACTION_STORE, RenderingDevice::INITIAL_ACTION_CLEAR,
+                                                  RenderingDevice::FINAL_ACTION_DISCARD, clear_colors, 1.0f);
+    rd->draw_list_bind_render_pipeline(draw_list, pipeline);
+    rd->draw_list_bind_uniform_set(draw_list, uniform_set, 0);
+    for (size_t i = 0; i < instance_triangles.size(); i++)
+    {
+        constants.instance = static_cast<unsigned int>(i);
+        constants.first_triangle = instance_triangles[i].x;
+        PackedByteArray bytes = constants.to_packed_byte_array();
+        rd->draw_list_set_push_constant(draw_list, bytes, bytes.size());
+        rd->draw_list_draw(draw_list, false, 1, instance_triangles[i].y * 3); // vertices are pulled in the shader
+    }
+    rd->draw_list_end();
+}
+
+RID VisibilityBuffer::get_texture() const
+{
+    return visibility_texture;
+}
@@ -0,0 +1,72 @@
+#ifndef VISIBILITY_BUFFER_H
+#define VISIBILITY_BUFFER_H
+
+#include <cstring> // for std::memcpy
+#include <godot_cpp/classes/rd_pipeline_color_blend_state.hpp>
+#include <godot_cpp/classes/rd_pipeline_color_blend_state_attachment.hpp>
+#include <godot_cpp/classes/rd_pipeline_depth_stencil_state.hpp>
+#include <godot_cpp/classes/rd_pipeline_multisample_state.hpp>
+#include <godot_cpp/classes/rd_pipeline_rasterization_state.hpp>
+#include <godot_cpp/classes/rd_shader_file.hpp>
+#include <godot_cpp/classes/rd_shader_spirv.hpp>
+#include <godot_cpp/classes/rd_texture_format.hpp>
+#include <godot_cpp/classes/rd_texture_view.hpp>
+#include <godot_cpp/classes/rd_uniform.hpp>
+#include <godot_cpp/classes/rendering_device.hpp>
+#include <godot_cpp/classes/resource_loader.hpp>
+#include <godot_cpp/variant/packed_byte_array.hpp>
+#include <godot_cpp/variant/vector2.hpp>
+#include <godot_cpp/variant/vector2i.hpp>
+#include <vector>
+
+using namespace godot;
+
+// Rasterizes the primary visibility of the scene into an rg32ui texture: instance + 1 and triangle per pixel, 0 where
+// the sky is visible. main.glsl starts its paths from these hits in hybrid mode instead of traversing the BVH for
+// the primary rays. Vertices are pulled from the triangle and blas buffers of main.glsl, one draw per instance.
+class VisibilityBuffer
+{
+    struct PushConstants // match the push constants on the gpu
+    {
+        float vp[16];
+        unsigned int instance;
+        unsigned int first_triangle;
+        float jitter[2];
+
+        PackedByteArray to_packed_byte_array()
+        {
+            PackedByteArray byte_array;
+            byte_array.resize(sizeof(PushConstants));
+            std::memcpy(byte_array.ptrw(), this, sizeof(PushConstants));
+            return byte_array;
+        }
+    };
+
+  public:
+    ~VisibilityBuffer();
+
+    // instance_triangles holds the first triangle and triangle count of every blas instance. Returns false if the
+    // raster pipeline could not be created, the buffer is unusable then.
+    bool init(RenderingDevice *rd, const Vector2i size, const RID triangles_geometry, const RID blas_instances,
+              const std::vector<Vector2i> &instance_triangles);
+    void clear();
+
+    // vp as uploaded to main.glsl, jitter is the subpixel position of the primary rays in [0, 1)
+    void render(const float vp[16], const Vector2 jitter);
+
+    RID get_texture() const;
+
+  private:
+    RenderingDevice *rd = nullptr;
+    Vector2i size;
+    std::vector<Vector2i> instance_triangles;
+
+    RID shader;
+    RID pipeline;
+    RID uniform_set;
+    RID visibility_texture;
+    RID depth_texture;
+    RID framebuffer;
+};
+
+#endif // VISIBILITY_BUFFER_H
@@ -1,6 +1,7 @@
 #include "register_types.h"
 #include "path_tracing/path_tracing_camera.h"
 #include "path_tracing/geometry_group3d.h"
+#include "bvh/bvh_godot.h"
 
 using namespace godot;
 
@@ -10,6 +11,7 @@ void initialize_jar_path_tracing_module(ModuleInitializationLevel p_level)
     {
         GDREGISTER_CLASS(PathTracingCamera)
         GDREGISTER_CLASS(GeometryGroup3D)
+        BVH::print_to_godot_console();
 
     }
 }
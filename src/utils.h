@@ -1,6 +1,7 @@
 #ifndef UTILS_H
 #define UTILS_H
 
+#include "bvh/vec.h"
 #include <algorithm>
 #include <godot_cpp/variant/transform3d.hpp>
 #include <godot_cpp/variant/projection.hpp>
@@ -48,6 +49,11 @@ inline void projection_to_float(float* target, const Projection &t)
     }
 }
 
+inline BVH::vec3 to_vec3(const Vector3 &v)
+{
+    return BVH::vec3(v.x, v.y, v.z);
+}
+
 } // namespace Utils
 
 #endif // UTILS_H